@@ -0,0 +1,419 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#include <string.h>
+#include "assets.h"
+#include "audio.h"
+#include "callbacks.h"
+#include "preview.h"
+#include "support.h"
+
+/* Opening a project only reads its structure, the preview surfaces of
+ * the pictures and the samples of the audio media placed on the
+ * timeline are read afterwards by a pool of threads. The items still
+ * waiting for them have is_loading set. A job is given to the pool only
+ * when a thread is free so the next one is always picked by its
+ * distance from the part of the timeline the user is looking at */
+
+/* One media to read, for all the items of the timeline showing it */
+typedef struct _ImgAssetJob
+{
+	gint				media_id;
+	gint				media_type;
+	gchar			*full_path;
+	gdouble			start_time;		/* Earliest start of the items */
+	gdouble			end_time;			/* Latest end of the items */
+	gint				width;				/* Size the picture is read at */
+	gint				height;
+	cairo_surface_t	*surface;
+	AudioData		*audio_data;
+} ImgAssetJob;
+
+/* The part of the timeline the jobs are sorted for, in seconds */
+typedef struct _ImgAssetFocus
+{
+	gdouble			playhead;
+	gdouble			visible_start;
+	gdouble			visible_end;
+} ImgAssetFocus;
+
+struct _ImgAssets
+{
+	img_window_struct	*img;
+	GThreadPool			*pool;
+	GAsyncQueue			*results;
+	GCancellable			*cancellable;
+	GList					*waiting;			/* Jobs not given to the pool yet */
+	ImgAssetFocus		focus;				/* The one waiting is sorted for */
+	gint						nr_threads;
+	gint						running;
+	gint						total;
+	gint						done;
+	gint						flush_pending;
+	gint64					load_start;
+};
+
+static void img_assets_read(ImgAssetJob *, ImgAssets *);
+static gboolean img_assets_flush(ImgAssets *);
+
+static void img_assets_free_job(ImgAssetJob *job)
+{
+	g_free(job->full_path);
+	if (job->surface)
+		cairo_surface_destroy(job->surface);
+	if (job->audio_data)
+		img_free_audio_data(job->audio_data);
+	g_slice_free(ImgAssetJob, job);
+}
+
+static void img_assets_free(ImgAssets *assets)
+{
+	if (assets->img->assets == assets)
+		assets->img->assets = NULL;
+
+	g_list_free_full(assets->waiting, (GDestroyNotify) img_assets_free_job);
+	g_thread_pool_free(assets->pool, FALSE, TRUE);
+	g_async_queue_unref(assets->results);
+	g_object_unref(assets->cancellable);
+	g_free(assets);
+}
+
+static void img_assets_get_focus(img_window_struct *img, ImgAssetFocus *focus)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_private_struct(img->timeline);
+	GtkAdjustment *hadj;
+	gdouble value;
+
+	hadj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(img->timeline_scrolled_window));
+	value = gtk_adjustment_get_value(hadj);
+
+	focus->playhead = priv->time_marker_pos / priv->pixels_per_second;
+	focus->visible_start = value / priv->pixels_per_second;
+	focus->visible_end = (value + gtk_adjustment_get_page_size(hadj)) / priv->pixels_per_second;
+}
+
+/* The media shown in the visible part of the timeline come first, then
+ * the ones closest to the playhead */
+static gint img_assets_compare_jobs(ImgAssetJob *a, ImgAssetJob *b, ImgAssetFocus *focus)
+{
+	gboolean visible_a, visible_b;
+	gdouble distance_a, distance_b;
+
+	visible_a = a->end_time >= focus->visible_start && a->start_time <= focus->visible_end;
+	visible_b = b->end_time >= focus->visible_start && b->start_time <= focus->visible_end;
+	if (visible_a != visible_b)
+		return visible_a ? -1 : 1;
+
+	distance_a = MAX(0, MAX(a->start_time - focus->playhead, focus->playhead - a->end_time));
+	distance_b = MAX(0, MAX(b->start_time - focus->playhead, focus->playhead - b->end_time));
+	if (distance_a != distance_b)
+		return distance_a < distance_b ? -1 : 1;
+
+	return 0;
+}
+
+/* Gives the pool as many jobs as it has free threads, sorting the
+ * waiting ones again if the user moved on the timeline since */
+static void img_assets_dispatch(ImgAssets *assets)
+{
+	img_window_struct *img = assets->img;
+	ImgAssetFocus focus;
+	ImgAssetJob *job;
+
+	if (assets->waiting == NULL || assets->running >= assets->nr_threads)
+		return;
+
+	img_assets_get_focus(img, &focus);
+	if (memcmp(&focus, &assets->focus, sizeof(ImgAssetFocus)) != 0)
+	{
+		assets->focus = focus;
+		assets->waiting = g_list_sort_with_data(assets->waiting, (GCompareDataFunc) img_assets_compare_jobs, &assets->focus);
+	}
+
+	while (assets->waiting && assets->running < assets->nr_threads)
+	{
+		job = assets->waiting->data;
+		assets->waiting = g_list_delete_link(assets->waiting, assets->waiting);
+
+		// Same size as img_read_preview_surface()
+		job->width = img->video_size[0] * img->image_area_zoom;
+		job->height = img->video_size[1] * img->image_area_zoom;
+
+		assets->running++;
+		g_thread_pool_push(assets->pool, job, NULL);
+	}
+}
+
+/* Creates one job for each media of the items having is_loading set and
+ * starts reading them. load_start is the monotonic time the opening of
+ * the project started at */
+void img_assets_load(img_window_struct *img, gint64 load_start)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_private_struct(img->timeline);
+	ImgAssets *assets;
+	ImgAssetJob *job;
+	GHashTable *jobs;
+	Track *track;
+	media_timeline *item;
+
+	img_assets_cancel(img);
+
+	assets = g_new0(ImgAssets, 1);
+	assets->img = img;
+	assets->load_start = load_start;
+	assets->results = g_async_queue_new();
+	assets->cancellable = g_cancellable_new();
+	assets->nr_threads = g_get_num_processors();
+	assets->pool = g_thread_pool_new((GFunc) img_assets_read, assets, assets->nr_threads, FALSE, NULL);
+	assets->focus.playhead = -1;
+
+	jobs = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (gint i = 0; i < priv->tracks->len; i++)
+	{
+		track = g_array_index(priv->tracks, Track *, i);
+		for (gint q = 0; q < track->items->len; q++)
+		{
+			item = g_array_index(track->items, media_timeline *, q);
+			if (! item->is_loading)
+				continue;
+
+			job = g_hash_table_lookup(jobs, GINT_TO_POINTER(item->id));
+			if (job == NULL)
+			{
+				job = g_slice_new0(ImgAssetJob);
+				job->media_id = item->id;
+				job->media_type = item->media_type;
+				job->full_path = g_strdup(img_get_media_filename(img, item->id));
+				job->start_time = item->start_time;
+				job->end_time = item->start_time + item->duration;
+				g_hash_table_insert(jobs, GINT_TO_POINTER(item->id), job);
+				assets->waiting = g_list_prepend(assets->waiting, job);
+				assets->total++;
+			}
+			job->start_time = MIN(job->start_time, item->start_time);
+			job->end_time = MAX(job->end_time, item->start_time + item->duration);
+		}
+	}
+	g_hash_table_destroy(jobs);
+
+	g_debug("Project opened in %.0f ms, %d media left to read",
+			(g_get_monotonic_time() - load_start) / 1000.0, assets->total);
+
+	if (assets->total == 0)
+	{
+		img_assets_free(assets);
+		return;
+	}
+	img->assets = assets;
+	img_assets_dispatch(assets);
+}
+
+/* The jobs waiting are dropped at once, the ones being read are
+ * dropped when they are done. While a flush is queued the struct
+ * is left to it, img_assets_flush() frees it when it runs */
+void img_assets_cancel(img_window_struct *img)
+{
+	ImgAssets *assets = img->assets;
+
+	if (assets == NULL)
+		return;
+
+	img->assets = NULL;
+	g_cancellable_cancel(assets->cancellable);
+	g_list_free_full(assets->waiting, (GDestroyNotify) img_assets_free_job);
+	assets->waiting = NULL;
+
+	if (assets->running == 0 && g_atomic_int_get(&assets->flush_pending) == 0)
+		img_assets_free(assets);
+}
+
+/* Runs in the threads of the pool */
+static void img_assets_read(ImgAssetJob *job, ImgAssets *assets)
+{
+	GdkPixbuf *pix;
+	cairo_t *cr;
+
+	if (! g_cancellable_is_cancelled(assets->cancellable) && job->full_path)
+	{
+		if (job->media_type == 0)
+		{
+			pix = gdk_pixbuf_new_from_file_at_scale(job->full_path, job->width, job->height, TRUE, NULL);
+			if (pix)
+			{
+				job->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, gdk_pixbuf_get_width(pix), gdk_pixbuf_get_height(pix));
+				cr = cairo_create(job->surface);
+				gdk_cairo_set_source_pixbuf(cr, pix, 0, 0);
+				cairo_paint(cr);
+				cairo_destroy(cr);
+				g_object_unref(pix);
+			}
+		}
+		else if (job->media_type == 1)
+			job->audio_data = img_read_audio_file(job->full_path);
+	}
+
+	g_async_queue_push(assets->results, job);
+	if (g_atomic_int_compare_and_exchange(&assets->flush_pending, 0, 1))
+		g_idle_add((GSourceFunc) img_assets_flush, assets);
+}
+
+/* Applies to the surface read for a picture the filter, the rotations
+ * and the flips saved in the project, in the order img_load_project()
+ * used to, then puts it in the cache. Takes over the reference on
+ * surface, which can be NULL if the file couldn't be read */
+static void img_assets_finish_picture(img_window_struct *img, media_timeline *item, cairo_surface_t *surface)
+{
+	item->is_loading = FALSE;
+	if (surface == NULL)
+		return;
+
+	item->width = cairo_image_surface_get_width(surface);
+	item->height = cairo_image_surface_get_height(surface);
+	surface = img_restore_surface_effects(surface, item, TRUE);
+	img_surface_cache_insert(img->cached_preview_surfaces, item->id, surface);
+}
+
+/* Hands a job read to the items waiting for it. Returns TRUE if the job
+ * has to be read again, for another audio item of the same media */
+static gboolean img_assets_apply(ImgAssets *assets, ImgAssetJob *job)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_private_struct(assets->img->timeline);
+	img_window_struct *img = assets->img;
+	cairo_surface_t *surface;
+	Track *track;
+	media_timeline *item;
+	gboolean shown = FALSE, given = FALSE, again = FALSE;
+
+	for (gint i = 0; i < priv->tracks->len; i++)
+	{
+		track = g_array_index(priv->tracks, Track *, i);
+		for (gint q = 0; q < track->items->len; q++)
+		{
+			item = g_array_index(track->items, media_timeline *, q);
+			if (! item->is_loading || item->id != job->media_id)
+				continue;
+
+			if (job->media_type == 0)
+			{
+				// An item of the media added meanwhile may have made the surface
+				surface = img_surface_cache_peek(img->cached_preview_surfaces, item->id);
+				if (surface)
+				{
+					item->width = cairo_image_surface_get_width(surface);
+					item->height = cairo_image_surface_get_height(surface);
+					item->is_loading = FALSE;
+				}
+				else
+				{
+					img_assets_finish_picture(img, item, job->surface);
+					job->surface = NULL;
+				}
+				shown = TRUE;
+			}
+			else if (job->audio_data && item->button)
+			{
+				// Each button owns its samples
+				img_media_audio_button_set_audio_data(IMG_MEDIA_AUDIO_BUTTON(item->button), job->audio_data);
+				job->audio_data = NULL;
+				item->is_loading = FALSE;
+				given = TRUE;
+			}
+			else if (given && item->button)
+				again = TRUE;
+			else
+				item->is_loading = FALSE;
+		}
+	}
+
+	if (shown)
+	{
+		img_image_area_invalidate_cache(img);
+		img_preview_invalidate(img);
+		gtk_widget_queue_draw(img->image_area);
+	}
+	return again;
+}
+
+/* Adds the media read since the last call to the timeline */
+static gboolean img_assets_flush(ImgAssets *assets)
+{
+	ImgAssetJob *job;
+
+	while ((job = g_async_queue_try_pop(assets->results)))
+	{
+		assets->running--;
+		if (! g_cancellable_is_cancelled(assets->cancellable) && img_assets_apply(assets, job))
+		{
+			assets->total++;
+			assets->waiting = g_list_prepend(assets->waiting, job);
+			assets->focus.playhead = -1;
+		}
+		else
+			img_assets_free_job(job);
+		assets->done++;
+	}
+
+	if (! g_cancellable_is_cancelled(assets->cancellable))
+	{
+		img_assets_dispatch(assets);
+		if (assets->running == 0 && assets->waiting == NULL)
+		{
+			g_debug("Read the %d media of the project %.0f ms after it started opening",
+					assets->done, (g_get_monotonic_time() - assets->load_start) / 1000.0);
+			img_assets_free(assets);
+			return FALSE;
+		}
+	}
+	else if (assets->running == 0)
+	{
+		img_assets_free(assets);
+		return FALSE;
+	}
+
+	/* A worker pushing a job after the flag is cleared schedules a new call */
+	g_atomic_int_set(&assets->flush_pending, 0);
+	if (g_async_queue_length(assets->results) > 0 && g_atomic_int_compare_and_exchange(&assets->flush_pending, 0, 1))
+		return TRUE;
+
+	return FALSE;
+}
+
+/* Reads at once what an item is still waiting for, for the callbacks
+ * changing its surface or playing it */
+void img_assets_ensure_loaded(img_window_struct *img, media_timeline *item)
+{
+	const gchar *filename;
+
+	if (! item->is_loading)
+		return;
+
+	filename = img_get_media_filename(img, item->id);
+	item->is_loading = FALSE;
+	if (filename == NULL)
+		return;
+
+	if (item->media_type == 0)
+	{
+		if (img_surface_cache_peek(img->cached_preview_surfaces, item->id) == NULL)
+			img_assets_finish_picture(img, item, img_read_preview_surface(img, item, filename));
+		img_image_area_invalidate_cache(img);
+	}
+	else if (item->media_type == 1 && item->button)
+		img_load_audio_file(IMG_MEDIA_AUDIO_BUTTON(item->button), filename);
+}
@@ -0,0 +1,35 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#ifndef __IMG_ASSETS_H__
+#define __IMG_ASSETS_H__
+
+#include <gtk/gtk.h>
+#include "imagination.h"
+#include "img_timeline.h"
+
+G_BEGIN_DECLS
+
+void img_assets_load(img_window_struct *, gint64);
+void img_assets_cancel(img_window_struct *);
+void img_assets_ensure_loaded(img_window_struct *, media_timeline *);
+
+G_END_DECLS
+
+#endif
@@ -21,7 +21,7 @@
 
 G_DEFINE_TYPE_WITH_PRIVATE(ImgMediaAudioButton, img_media_audio_button, GTK_TYPE_TOGGLE_BUTTON)
 
-static void img_free_audio_data(AudioData *data)
+void img_free_audio_data(AudioData *data)
 {
     if (data)
     {
@@ -384,28 +384,24 @@ end:
     av_packet_free(&packet);
 }
 
-gboolean img_load_audio_file(ImgMediaAudioButton *button, const char *filename)
+/* Decodes the whole file, it doesn't touch any widget so it can be
+ * called from a worker thread. Returns NULL on failure */
+AudioData *img_read_audio_file(const char *filename)
 {
-	ImgMediaAudioButtonPrivate *priv = img_media_audio_button_get_instance_private(button);
-
 	AudioData *audio_data = NULL;
     AVFormatContext *format_ctx = NULL;
     AVCodecContext *codec_ctx = NULL;
     int audio_stream_index = -1;
 
-	gchar *base_name = g_path_get_basename(filename);
-    priv->filename = g_strdup(base_name);
-	g_free(base_name);
-
     if (avformat_open_input(&format_ctx, filename, NULL, NULL) != 0) {
         g_warning("Could not open file %s", filename);
-        return FALSE;
+        return NULL;
     }
 
     if (avformat_find_stream_info(format_ctx, NULL) < 0) {
         g_printerr("Could not find stream information\n");
         avformat_close_input(&format_ctx);
-        return FALSE;
+        return NULL;
     }
 
     for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
@@ -418,35 +414,35 @@ gboolean img_load_audio_file(ImgMediaAudioButton *button, const char *filename)
     if (audio_stream_index == -1) {
         g_printerr("Could not find audio stream\n");
         avformat_close_input(&format_ctx);
-        return FALSE;
+        return NULL;
     }
 
     const AVCodec *codec = avcodec_find_decoder(format_ctx->streams[audio_stream_index]->codecpar->codec_id);
     if (!codec) {
         g_printerr("Unsupported codec\n");
         avformat_close_input(&format_ctx);
-        return FALSE;
+        return NULL;
     }
 
     codec_ctx = avcodec_alloc_context3(codec);
     if (!codec_ctx) {
         g_printerr("Could not allocate audio codec context\n");
         avformat_close_input(&format_ctx);
-        return FALSE;
+        return NULL;
     }
 
     if (avcodec_parameters_to_context(codec_ctx, format_ctx->streams[audio_stream_index]->codecpar) < 0) {
         g_printerr("Could not copy codec parameters to decoder context\n");
         avcodec_free_context(&codec_ctx);
         avformat_close_input(&format_ctx);
-        return FALSE;
+        return NULL;
     }
 
     if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
         g_printerr("Could not open codec\n");
         avcodec_free_context(&codec_ctx);
         avformat_close_input(&format_ctx);
-        return FALSE;
+        return NULL;
     }
 
    audio_data = img_create_audio_data_struct(format_ctx, codec_ctx, audio_stream_index);
@@ -454,7 +450,7 @@ gboolean img_load_audio_file(ImgMediaAudioButton *button, const char *filename)
         g_warning("Could not create audio data struct");
         avcodec_free_context(&codec_ctx);
         avformat_close_input(&format_ctx);
-        return FALSE;
+        return NULL;
     }
 
     img_read_raw_audio_data(audio_data);
@@ -462,10 +458,41 @@ gboolean img_load_audio_file(ImgMediaAudioButton *button, const char *filename)
     if (audio_data->size == 0) {
         g_warning("No samples were loaded");
         img_free_audio_data(audio_data);
-        return FALSE;
+        return NULL;
     }
+	return audio_data;
+}
+
+void img_media_audio_button_set_filename(ImgMediaAudioButton *button, const char *filename)
+{
+	ImgMediaAudioButtonPrivate *priv = img_media_audio_button_get_instance_private(button);
+
+	g_free(priv->filename);
+	priv->filename = g_path_get_basename(filename);
+}
+
+/* The button takes over the samples read by img_read_audio_file() */
+void img_media_audio_button_set_audio_data(ImgMediaAudioButton *button, AudioData *audio_data)
+{
+	ImgMediaAudioButtonPrivate *priv = img_media_audio_button_get_instance_private(button);
 
+	if (priv->audio_data)
+		img_free_audio_data(priv->audio_data);
 	priv->audio_data = audio_data;
+	priv->cache_valid = FALSE;
+	gtk_widget_queue_draw(GTK_WIDGET(button));
+}
+
+gboolean img_load_audio_file(ImgMediaAudioButton *button, const char *filename)
+{
+	AudioData *audio_data;
+
+	img_media_audio_button_set_filename(button, filename);
+	audio_data = img_read_audio_file(filename);
+	if (audio_data == NULL)
+		return FALSE;
+
+	img_media_audio_button_set_audio_data(button, audio_data);
 	return TRUE;
 }
 
@@ -561,6 +588,16 @@ int img_play_audio_alsa(img_window_struct *img)
             }
             
             written += rc;
+
+			// What is being heard is what was written minus what ALSA still buffers
+			snd_pcm_sframes_t delay;
+			if (snd_pcm_delay(handle, &delay) == 0 && samples_written + written > delay)
+			{
+				g_mutex_lock(&priv->audio_data->play_mutex);
+				priv->audio_data->clock_time = priv->audio_data->current_time + (double) (samples_written + written - delay) / priv->audio_data->sample_rate;
+				priv->audio_data->clock_stamp = g_get_monotonic_time();
+				g_mutex_unlock(&priv->audio_data->play_mutex);
+			}
         
 			g_mutex_lock(&priv->audio_data->play_mutex);
 			is_playing = g_atomic_int_get(&priv->audio_data->is_playing);
@@ -575,6 +612,10 @@ int img_play_audio_alsa(img_window_struct *img)
     rc = 0;
 
 cleanup:
+	g_mutex_lock(&priv->audio_data->play_mutex);
+	priv->audio_data->clock_stamp = 0;
+	g_mutex_unlock(&priv->audio_data->play_mutex);
+
 //g_print("Chiamo img_timeline_stop_audio da img_play_audio_alsa per %d\n",media->id); 
 	img_timeline_stop_audio(media, img);
     if (buffer)
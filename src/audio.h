@@ -58,6 +58,8 @@ typedef struct
     double current_time;
 	volatile gint is_playing;
 	GMutex play_mutex;
+	double clock_time;				// Timeline time being heard at clock_stamp
+	gint64 clock_stamp;				// Monotonic time of the last snd_pcm_delay() reading, 0 if none
 } AudioData;
 
 struct _ImgMediaAudioButton
@@ -82,6 +84,10 @@ G_DECLARE_FINAL_TYPE(ImgMediaAudioButton, img_media_audio_button, IMG, MEDIA_AUD
 GtkWidget *img_media_audio_button_new();
 ImgMediaAudioButtonPrivate *img_media_audio_button_get_private_struct(ImgMediaAudioButton *);
 gboolean img_load_audio_file(ImgMediaAudioButton *, const char *);
+AudioData *img_read_audio_file(const char *);
+void img_free_audio_data(AudioData *);
+void img_media_audio_button_set_filename(ImgMediaAudioButton *, const char *);
+void img_media_audio_button_set_audio_data(ImgMediaAudioButton *, AudioData *);
 int img_play_audio_alsa(img_window_struct *);
 G_END_DECLS
 
@@ -20,6 +20,9 @@
 #include "callbacks.h"
 #include "empty_slide.h"
 #include "export.h"
+#include "import.h"
+#include "assets.h"
+#include "preview.h"
 #include <math.h>
 #include <sys/stat.h>
 
@@ -100,22 +103,16 @@ void img_project_properties(GtkMenuItem *item, img_window_struct *img_struct)
 
 void img_add_media_items(GtkMenuItem *item, img_window_struct *img)
 {
-	GSList  *media, *bak;
+	GSList  *media;
 	
 	media = img_import_slides_file_chooser(img);
 
 	if (media == NULL)
 		return;
 
-	bak = media;
-	while (media)
-	{
-		if (img_create_media_struct(media->data, img))
-			img_taint_project(img);
-		 
-		media = media->next;
-	}
-	g_slist_free(bak);
+	/* The files are read in the background */
+	img_import_media(img, media);
+	g_slist_free_full(media, g_free);
 }
 
 gboolean img_create_media_struct(gchar *full_path, img_window_struct *img)
@@ -157,10 +154,8 @@ gboolean img_create_media_struct(gchar *full_path, img_window_struct *img)
 		flag = FALSE;
 		goto next_media;
 	}
-	media = g_new0(media_struct, 1);
-	media->full_path = g_strdup(full_path);
-	media->media_type = type;
-	media->id = img->next_id++;
+	media = img_media_new(img->next_id++, type, full_path);
+	img_media_registry_add(img->media_registry, media);
 	img->media_nr++;
 	img_add_media(media->full_path, media, img);
 
@@ -183,6 +178,7 @@ void img_add_media(gchar *full_path, media_struct *media, img_window_struct *img
 	GtkTreeIter iter;
 	GdkPixbufFormat *format;
 	GdkPixbuf *pb;
+	gchar *type;
 
 	filename = g_path_get_basename(full_path);
 	gtk_list_store_append (img->media_model, &iter);
@@ -191,11 +187,16 @@ void img_add_media(gchar *full_path, media_struct *media, img_window_struct *img
 	{
 		case 0:
 			format = gdk_pixbuf_get_file_info(full_path, &media->width, &media->height);
-			media->image_type = format ? gdk_pixbuf_format_get_name(format) : NULL;
-			to_upper(&media->image_type);
-			pb = gdk_pixbuf_new_from_file_at_scale(full_path, 120, 60, TRUE, NULL);
+			if (format)
+			{
+				type = gdk_pixbuf_format_get_name(format);
+				media->image_type = img_media_intern_type(type);
+				g_free(type);
+			}
+			pb = img_thumbnail_get(full_path, 120, 60);
 			gtk_list_store_set (img->media_model, &iter, 0, pb, 1, filename, 2, media, -1);
-			g_object_unref(pb);
+			if (pb)
+				g_object_unref(pb);
 		break;
 
 		case 1:
@@ -268,26 +269,21 @@ GSList *img_import_slides_file_chooser(img_window_struct *img)
 
 void img_free_allocated_memory(img_window_struct *img)
 {
-	GtkTreeModel *model;
-	GtkTreeIter iter;
-	media_struct *entry;
+	/* The media still being read don't belong to the next project */
+	img_import_cancel(img);
+	img_assets_cancel(img);
 
 	if (img->media_nr)
 	{
-		model = GTK_TREE_MODEL( img->media_model );
-
-		gtk_tree_model_get_iter_first(model,&iter);
-		do
-		{
-			gtk_tree_model_get(model, &iter, 2, &entry,-1);
-			img_free_media_struct(entry);
-		}
-		while (gtk_tree_model_iter_next (model,&iter));
+		/* The model only points to the media owned by the registry */
 		gtk_list_store_clear(GTK_LIST_STORE(img->media_model));
+		img_media_registry_clear(img->media_registry);
+		img->current_media = NULL;
 		
 		img_timeline_delete_all_media((ImgTimeline*)img->timeline);
 		img_timeline_delete_additional_tracks((ImgTimeline*)img->timeline);
-		g_hash_table_remove_all(img->cached_preview_surfaces);
+		img_surface_cache_report(img->cached_preview_surfaces);
+		img_surface_cache_clear(img->cached_preview_surfaces);
 	}
 	img->media_nr = 0;
 
@@ -589,7 +585,9 @@ gboolean img_quit_application(GtkWidget *widget, GdkEvent * event, img_window_st
 	}
 	g_slist_free(img->plugin_list);
 
-	g_hash_table_destroy(img->cached_preview_surfaces);
+	img_preview_renderer_free(img->preview_renderer);
+	img->preview_renderer = NULL;
+	img_surface_cache_free(img->cached_preview_surfaces);
 	return FALSE;
 }
 
@@ -621,8 +619,7 @@ static void img_update_preview_file_chooser(GtkFileChooser *file_chooser,img_win
 	gchar *filename,*size;
 	gboolean has_preview = FALSE;
 	gint width,height;
-	GdkPixbuf *pixbuf = NULL;
-	GdkPixbuf *pixbuf2;
+	GdkPixbuf *pixbuf;
 
 	filename = gtk_file_chooser_get_filename(file_chooser);
 	if (filename == NULL)
@@ -630,11 +627,8 @@ static void img_update_preview_file_chooser(GtkFileChooser *file_chooser,img_win
 		gtk_file_chooser_set_preview_widget_active (file_chooser, has_preview);
 		return;
 	}
-	pixbuf2 = gdk_pixbuf_new_from_file_at_scale(filename, 93, 70, TRUE, NULL);
-	if (pixbuf2) {
-		pixbuf = gdk_pixbuf_apply_embedded_orientation(pixbuf2);
-		g_object_unref (pixbuf2);
-	}
+	// The thumbnails in the store are already turned upright
+	pixbuf = img_thumbnail_get(filename, 93, 70);
 	has_preview = (pixbuf != NULL);
 	if (has_preview)
 	{
@@ -714,10 +708,10 @@ void img_media_library_drag_begin(GtkWidget *widget, GdkDragContext *context, im
 void img_media_library_drag_data_received (GtkWidget *widget, GdkDragContext *context , int x, int y, GtkSelectionData *data, unsigned int info, unsigned int time, img_window_struct *img)
 {
 	gchar **media = NULL;
-	gchar *filename;
+	GSList *filenames = NULL;
 	GtkWidget *dialog;
+	gchar *filename;
 	int i = 0;
-	gboolean dummy;
 
 	media = gtk_selection_data_get_uris(data);
 	if (media == NULL)
@@ -734,12 +728,14 @@ void img_media_library_drag_data_received (GtkWidget *widget, GdkDragContext *co
 	 while(media[i])
 	{
 		filename = g_filename_from_uri (media[i], NULL, NULL);
-		if ( img_create_media_struct(filename, img))
-			img_taint_project(img);
-		g_free(filename);
+		if (filename)
+			filenames = g_slist_prepend(filenames, filename);
 		i++;
 	}
+	filenames = g_slist_reverse(filenames);
+	img_import_media(img, filenames);
 
+	g_slist_free_full(filenames, g_free);
 	g_strfreev(media);
 }
 
@@ -784,11 +780,317 @@ void img_media_library_drag_end (GtkWidget *widget, GdkDragContext *context, img
     gtk_style_context_remove_class(style_context, "iconview-dragging");
 }
  
+/* Positions the media in the image area the first time it's shown and
+ * keeps its relative position when the image area is resized. Returns
+ * its preview surface and the scale it's shown at, NULL for a text */
+static cairo_surface_t *img_image_area_place_media(img_window_struct *img, media_timeline *media, GtkAllocation *allocation, gdouble *scale)
+{
+	cairo_surface_t *surface;
+	gint img_width, img_height;
+	gdouble x_ratio, y_ratio;
+
+	if (media->media_type == 3)
+		return NULL;
+
+	surface = img_get_preview_surface(img, media);
+	if (surface == NULL)
+		return NULL;
+
+	// Calculate offset x and y to center the image in the image area the first time
+	img_width 	= cairo_image_surface_get_width(surface);
+	img_height 	= cairo_image_surface_get_height(surface);
+	if (media->nr_rotations == 1 || media->nr_rotations == 3)
+		*scale = MIN((double)allocation->width / img_height, (double)allocation->height / img_width);
+	else
+		*scale = MIN((double)allocation->width / img_width, (double)allocation->height / img_height);
+
+	if (! media->is_positioned)
+	{
+		media->x = (allocation->width - (img_width * *scale)) / 2;
+		media->y = (allocation->height - (img_height * *scale)) / 2;
+		media->last_allocation_width = allocation->width;
+		media->last_allocation_height = allocation->height;
+		media->is_positioned = TRUE;
+	}
+	// Calculate relative position ratio of the surface
+	else if (media->last_allocation_width != allocation->width || media->last_allocation_height != allocation->height)
+	{
+		x_ratio = media->x / media->last_allocation_width;
+		y_ratio = media->y / media->last_allocation_height;
+
+		media->x = x_ratio * allocation->width;
+		media->y = y_ratio * allocation->height;
+		media->last_allocation_width = allocation->width;
+		media->last_allocation_height = allocation->height;
+	}
+	return surface;
+}
+
+static void img_image_area_paint_media(img_window_struct *img, cairo_t *cr, media_timeline *media, GtkAllocation *allocation)
+{
+	cairo_surface_t *surface, *level;
+	gdouble scale, level_scale;
+
+	surface = img_image_area_place_media(img, media, allocation, &scale);
+	if (surface)
+	{
+		// Paint the smallest copy of the surface which is still large enough
+		level = img_get_surface_mipmap(surface, scale, &level_scale);
+		cairo_save(cr);
+			cairo_translate(cr, media->x, media->y);
+			cairo_scale(cr, scale / level_scale, scale / level_scale);
+			cairo_set_source_surface(cr, level, 0, 0);
+			cairo_paint_with_alpha(cr, media->opacity);
+		cairo_restore(cr);
+	}
+	// Render textbox, text effects and text
+	if (media->text)
+		img_render_textbox(img, cr, media);
+}
+
+// If the user clicked on a picture draw a rectangle and the handles
+static void img_image_area_paint_selection(cairo_t *cr, media_timeline *media, cairo_surface_t *surface, gdouble scale)
+{
+	gdouble img_width, img_height, temp;
+
+	img_width 	= cairo_image_surface_get_width(surface);
+	img_height 	= cairo_image_surface_get_height(surface);
+
+	cairo_set_source_rgb(cr, 1.0, 1.0, 0);
+	cairo_rectangle(cr, media->x, media->y, img_width * scale, img_height * scale);
+	cairo_stroke(cr);
+	cairo_save(cr);
+		cairo_translate(cr, media->x + (img_width * scale) / 2, media->y + (img_height * scale) / 2);
+		if (media->nr_rotations == 1 || media->nr_rotations == 3)
+		{
+			temp = img_width;
+			img_width = img_height;
+			img_height = temp;
+		}
+		cairo_rotate(cr, G_PI / 2.0 * media->nr_rotations);
+		cairo_translate(cr, -(media->x + (img_width * scale) / 2), -(media->y + (img_height * scale) / 2));
+
+		cairo_rectangle(cr, (media->x + img_width * scale) - 11, (media->y + img_height * scale) - 11, 10, 10);
+		cairo_stroke_preserve(cr);
+		cairo_set_source_rgb(cr, 0, 0, 0);
+		cairo_fill(cr);
+		img_draw_rotating_handle(cr, media->x, img_width, media->y, img_height, scale, FALSE);
+	cairo_restore(cr);
+}
+
+/* Returns the area covered by a picture in the image area, its
+ * rotation and selection handles included */
+static void img_image_area_get_media_extents(img_window_struct *img, media_timeline *media, GdkRectangle *area)
+{
+	cairo_surface_t *surface;
+	GtkAllocation allocation;
+	gdouble scale, width, height, size;
+
+	gtk_widget_get_allocation(img->image_area, &allocation);
+	surface = img_image_area_place_media(img, media, &allocation, &scale);
+	if (surface == NULL)
+	{
+		*area = (GdkRectangle) {0, 0, allocation.width, allocation.height};
+		return;
+	}
+	width = cairo_image_surface_get_width(surface) * scale;
+	height = cairo_image_surface_get_height(surface) * scale;
+
+	/* A square large enough for any of the four rotations */
+	size = MAX(width, height) + 2 * IMG_IMAGE_AREA_HANDLE_MARGIN;
+	area->x = floor(media->x + width / 2 - size / 2);
+	area->y = floor(media->y + height / 2 - size / 2);
+	area->width = ceil(size) + 1;
+	area->height = ceil(size) + 1;
+}
+
+/* To be called when the media shown in the image area may have changed
+ * in any other way than through the current item. The frames of the
+ * scrub cache painted before are not used anymore */
+void img_image_area_invalidate_cache(img_window_struct *img)
+{
+	img->image_area_cache_valid = FALSE;
+	img->image_area_generation++;
+}
+
+/* A frame of the image area kept in the scrub cache */
+typedef struct
+{
+	gint64			frame;
+	guint			generation;
+	media_timeline	*item;			/* Current item, not painted on the surfaces */
+	gint				width;
+	gint				height;
+	cairo_surface_t	*below;
+	cairo_surface_t	*above;
+	gsize			size;
+} ImgScrubFrame;
+
+/* The needle position is rounded to the frame shown at that time in the
+ * exported video so that the frames can be found again in the scrub cache */
+static gint64 img_image_area_get_frame(img_window_struct *img, gdouble current_time)
+{
+	return (gint64) floor(current_time * MAX(img->export_fps, 1) + 1e-6);
+}
+
+static void img_scrub_frame_free(ImgScrubFrame *entry)
+{
+	cairo_surface_destroy(entry->below);
+	if (entry->above)
+		cairo_surface_destroy(entry->above);
+	g_slice_free(ImgScrubFrame, entry);
+}
+
+static void img_scrub_cache_count(img_window_struct *img, gboolean hit)
+{
+	guint lookups;
+
+	if (hit)
+		img->scrub_cache_hits++;
+	else
+		img->scrub_cache_misses++;
+
+	lookups = img->scrub_cache_hits + img->scrub_cache_misses;
+	if (lookups % 100 == 0)
+		g_debug("Scrub cache: %u hits out of %u (%.1f%%), %u frames in %" G_GSIZE_FORMAT " KiB",
+				img->scrub_cache_hits, lookups, 100.0 * img->scrub_cache_hits / lookups,
+				g_queue_get_length(img->scrub_cache), img->scrub_cache_size / 1024);
+}
+
+/* Looks for a frame painted for the same time, current item and size
+ * since the last edit. Frames of older generations are freed on the way */
+static ImgScrubFrame *img_scrub_cache_lookup(img_window_struct *img, gint64 frame, media_timeline *live, gint width, gint height)
+{
+	ImgScrubFrame *entry;
+	GList *link, *next;
+
+	for (link = img->scrub_cache->head; link; link = next)
+	{
+		next = link->next;
+		entry = link->data;
+		if (entry->generation != img->image_area_generation)
+		{
+			img->scrub_cache_size -= entry->size;
+			img_scrub_frame_free(entry);
+			g_queue_delete_link(img->scrub_cache, link);
+		}
+		else if (entry->frame == frame && entry->item == live && entry->width == width && entry->height == height)
+		{
+			g_queue_unlink(img->scrub_cache, link);
+			g_queue_push_head_link(img->scrub_cache, link);
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Keeps the surfaces just painted, the least recently shown frames
+ * are dropped when the cache grows over IMG_SCRUB_CACHE_SIZE */
+static void img_scrub_cache_insert(img_window_struct *img, gint64 frame, media_timeline *live, GtkAllocation *allocation)
+{
+	ImgScrubFrame *entry;
+
+	entry = g_slice_new0(ImgScrubFrame);
+	entry->frame = frame;
+	entry->generation = img->image_area_generation;
+	entry->item = live;
+	entry->width = allocation->width;
+	entry->height = allocation->height;
+	entry->below = cairo_surface_reference(img->image_area_below);
+	entry->above = img->image_area_above ? cairo_surface_reference(img->image_area_above) : NULL;
+	entry->size = (gsize) allocation->width * allocation->height * 4 * (entry->above ? 2 : 1);
+
+	g_queue_push_head(img->scrub_cache, entry);
+	img->scrub_cache_size += entry->size;
+
+	while (img->scrub_cache_size > IMG_SCRUB_CACHE_SIZE && img->scrub_cache->length > 1)
+	{
+		entry = g_queue_pop_tail(img->scrub_cache);
+		img->scrub_cache_size -= entry->size;
+		img_scrub_frame_free(entry);
+	}
+}
+
+static void img_scrub_cache_clear(img_window_struct *img)
+{
+	g_queue_clear_full(img->scrub_cache, (GDestroyNotify) img_scrub_frame_free);
+	img->scrub_cache_size = 0;
+}
+
+/* Paints the media under the current item, and the ones over it, on two
+ * surfaces kept until the time, the current item or the size of the image
+ * area change. Moving or editing the current item then only repaints it.
+ * The surfaces are also kept in the scrub cache so that moving the needle
+ * back to a frame already shown doesn't paint it again */
+static void img_image_area_update_cache(img_window_struct *img, GtkWidget *widget, GArray *active_media, gint live_index,
+										GtkAllocation *allocation, gint64 frame)
+{
+	media_timeline *live = live_index >= 0 ? g_array_index(active_media, media_timeline *, live_index) : NULL;
+	ImgScrubFrame *entry;
+	cairo_t *cr;
+
+	/* The current item is edited without tainting the project, the frames
+	 * where it was painted with the others can't be used once it changes */
+	if (img->current_item != img->image_area_generation_item)
+	{
+		img->image_area_generation_item = img->current_item;
+		img_image_area_invalidate_cache(img);
+	}
+
+	if (img->image_area_cache_valid && img->image_area_cache_frame == frame && img->image_area_cache_item == live &&
+		img->image_area_cache_width == allocation->width && img->image_area_cache_height == allocation->height)
+		return;
+
+	if (img->image_area_below)
+		cairo_surface_destroy(img->image_area_below);
+	if (img->image_area_above)
+		cairo_surface_destroy(img->image_area_above);
+	img->image_area_above = NULL;
+
+	entry = img_scrub_cache_lookup(img, frame, live, allocation->width, allocation->height);
+	img_scrub_cache_count(img, entry != NULL);
+	if (entry)
+	{
+		img->image_area_below = cairo_surface_reference(entry->below);
+		if (entry->above)
+			img->image_area_above = cairo_surface_reference(entry->above);
+		goto done;
+	}
+
+	img->image_area_below = gdk_window_create_similar_surface(gtk_widget_get_window(widget), CAIRO_CONTENT_COLOR,
+																	allocation->width, allocation->height);
+	cr = cairo_create(img->image_area_below);
+	cairo_set_source_rgb(cr, img->background_color[0], img->background_color[1], img->background_color[2]);
+	cairo_paint(cr);
+	for (gint i = active_media->len - 1; i > live_index; i--)
+		img_image_area_paint_media(img, cr, g_array_index(active_media, media_timeline *, i), allocation);
+	cairo_destroy(cr);
+
+	if (live_index > 0)
+	{
+		img->image_area_above = gdk_window_create_similar_surface(gtk_widget_get_window(widget), CAIRO_CONTENT_COLOR_ALPHA,
+																		allocation->width, allocation->height);
+		cr = cairo_create(img->image_area_above);
+		for (gint i = live_index - 1; i >= 0; i--)
+			img_image_area_paint_media(img, cr, g_array_index(active_media, media_timeline *, i), allocation);
+		cairo_destroy(cr);
+	}
+	img_scrub_cache_insert(img, frame, live, allocation);
+
+done:
+	img->image_area_cache_valid = TRUE;
+	img->image_area_cache_frame = frame;
+	img->image_area_cache_item = live;
+	img->image_area_cache_width = allocation->width;
+	img->image_area_cache_height = allocation->height;
+}
+
 gboolean img_on_draw_event( GtkWidget *widget, cairo_t *cr, img_window_struct *img )
 {
 	GArray* active_media = NULL;
-	gint img_width, img_height, media_type;
-	gdouble current_time, x, y, x_ratio, y_ratio, scale;
+	gint img_width, img_height, live_index;
+	gint64 frame;
+	gdouble current_time, x, y, scale;
 	media_timeline* media = NULL;
 	cairo_surface_t *surface = NULL;
 
@@ -797,13 +1099,13 @@ gboolean img_on_draw_event( GtkWidget *widget, cairo_t *cr, img_window_struct *i
 	GtkAllocation allocation;
 	gtk_widget_get_allocation(img->image_area, &allocation);
 
-	//Paint the canvas with the user chosen project background color
-	cairo_set_source_rgb(cr, img->background_color[0], img->background_color[1], img->background_color[2]);
-	cairo_paint(cr);
-
 	// Draw all the placed media items on the tracks
 	if (img->preview_is_running)
 	{
+		//Paint the canvas with the user chosen project background color
+		cairo_set_source_rgb(cr, img->background_color[0], img->background_color[1], img->background_color[2]);
+		cairo_paint(cr);
+
 		// Are there any pictures placed on the timeline?
 		if (img->exported_image)
 		{
@@ -823,77 +1125,34 @@ gboolean img_on_draw_event( GtkWidget *widget, cairo_t *cr, img_window_struct *i
 	}
 	else
 	{
-		// Get the list of active media on all tracks according to the position of the red needle
-		active_media = img_timeline_get_active_picture_media(img->timeline, current_time);
-		for (gint i = active_media->len-1; i >=0; i--)
+		// Get the list of active media on all tracks according to the frame under the red needle
+		frame = img_image_area_get_frame(img, current_time);
+		active_media = img_timeline_get_active_picture_media(img->timeline, (gdouble) frame / MAX(img->export_fps, 1));
+
+		// Only the current item is painted again, the others come from the cache
+		live_index = -1;
+		for (gint i = 0; i < active_media->len; i++)
 		{
-			media = g_array_index(active_media, media_timeline *, i);
-			if (media->media_type == 3)
-				goto text;
-
-			// Calculate offset x and y to center the image in the image area the first time
-			surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(media->id));			
-			img_width 	= cairo_image_surface_get_width(surface);
-			img_height 	= cairo_image_surface_get_height(surface);
-			if (media->nr_rotations == 1 || media->nr_rotations == 3)
-				scale = MIN((double)allocation.width / img_height, (double)allocation.height / img_width);
-			else
-				scale = MIN((double)allocation.width / img_width, (double)allocation.height / img_height);
+			if (g_array_index(active_media, media_timeline *, i) == img->current_item)
+				live_index = i;
+		}
+		img_image_area_update_cache(img, widget, active_media, live_index, &allocation, frame);
 
-			if (! media->is_positioned)					
-			{
-				media->x = (allocation.width - (img_width * scale)) / 2;
-				media->y = (allocation.height - (img_height * scale)) / 2;
-				media->last_allocation_width = allocation.width;
-				media->last_allocation_height = allocation.height;
-				media->is_positioned = TRUE;
-			}
-			// Calculate relative position ratio of the surface
-			else if (media->last_allocation_width != allocation.width || media->last_allocation_height != allocation.height)
-			{
-				x_ratio = media->x / media->last_allocation_width;
-				y_ratio = media->y / media->last_allocation_height;
-				
-				media->x = x_ratio * allocation.width;
-				media->y = y_ratio * allocation.height;
-				media->last_allocation_width = allocation.width;
-				media->last_allocation_height = allocation.height;
-			}
-			cairo_save(cr);
-				cairo_translate(cr, media->x, media->y);
-				cairo_scale(cr, scale, scale);
-				cairo_set_source_surface(cr, surface, 0, 0);
-				cairo_paint_with_alpha(cr, media->opacity);	
-			cairo_restore(cr);
-text:
-			// Render textbox, text effects and text
-			if (media->text)
-				img_render_textbox(img, cr, media);
+		cairo_set_source_surface(cr, img->image_area_below, 0, 0);
+		cairo_paint(cr);
+		if (live_index >= 0)
+			img_image_area_paint_media(img, cr, img->current_item, &allocation);
+		if (img->image_area_above)
+		{
+			cairo_set_source_surface(cr, img->image_area_above, 0, 0);
+			cairo_paint(cr);
+		}
 
-			// If the user clicked on a picture draw a rectangle and the handles
-			if (media->is_selected)
-			{
-				cairo_set_source_rgb(cr, 1.0, 1.0, 0);
-				cairo_rectangle(cr, media->x, media->y, img_width * scale, img_height * scale);
-				cairo_stroke(cr);
-				cairo_save(cr);
-					cairo_translate(cr, media->x + (img_width * scale) / 2, media->y + (img_height * scale) / 2);
-					if (media->nr_rotations == 1 || media->nr_rotations == 3)
-					{
-						gdouble temp = img_width;
-						img_width = img_height;
-						img_height = temp;
-					}
-					cairo_rotate(cr, G_PI / 2.0 * media->nr_rotations);
-					cairo_translate(cr, -(media->x + (img_width * scale) / 2), -(media->y + (img_height * scale) / 2));
-
-					cairo_rectangle(cr, (media->x + img_width * scale) - 11, (media->y + img_height * scale) - 11, 10, 10);
-					cairo_stroke_preserve(cr);
-					cairo_set_source_rgb(cr, 0, 0, 0);
-					cairo_fill(cr);
-					img_draw_rotating_handle(cr, media->x, img_width, media->y, img_height, scale, FALSE);
-				cairo_restore(cr);
-			}
+		for (gint i = active_media->len-1; i >=0; i--)
+		{
+			media = g_array_index(active_media, media_timeline *, i);
+			if (media->is_selected && (surface = img_image_area_place_media(img, media, &allocation, &scale)))
+				img_image_area_paint_selection(cr, media, surface, scale);
 		}
 		g_array_free(active_media, FALSE);
 	}
@@ -1076,11 +1335,14 @@ void img_close_project(GtkWidget *widget, img_window_struct *img)
 	gtk_widget_queue_draw( img->image_area );
 	gtk_label_set_text(GTK_LABEL (img->current_time),"00:00:00");
 	gtk_label_set_text(GTK_LABEL (img->total_time_label),"00:00:00");
+	img->total_time = 0;
 
 	/* Reset slideshow properties */
 	img->background_color[0] = 0;
 	img->background_color[1] = 0;
 	img->background_color[2] = 0;
+	img_image_area_invalidate_cache(img);
+	img_scrub_cache_clear(img);
 	
 	// This is needed to reset the id counter when loading a new slideshow without quitting Imagination
 	img->next_id = 1;
@@ -1200,12 +1462,17 @@ gboolean img_image_area_motion( GtkWidget *widget,  GdkEventMotion *event,  img_
 	
 	//transform_coords(img->current_item, event->x, event->y, &x, &y);
 
-	// Move the selected picture in the image area
+	// Move the selected picture in the image area, only where it was and where it goes is redrawn
 	if (event->state & GDK_BUTTON1_MASK &&  img->current_item && img->current_item->is_selected)// && img->current_item->text && ! img->current_item->text->visible)
 	{
+		GdkRectangle old_area, new_area;
+
+		img_image_area_get_media_extents(img, img->current_item, &old_area);
 		img->current_item->x = event->x - img->current_item->drag_x;
 		img->current_item->y = event->y - img->current_item->drag_y;
-		gtk_widget_queue_draw(img->image_area);
+		img_image_area_get_media_extents(img, img->current_item, &new_area);
+		gdk_rectangle_union(&old_area, &new_area, &new_area);
+		gtk_widget_queue_draw_area(img->image_area, new_area.x, new_area.y, new_area.width, new_area.height);
 	}
 
 	if (img->current_item->media_type == 3)
@@ -1570,6 +1837,7 @@ gboolean img_save_window_settings( img_window_struct *img )
 	g_key_file_set_boolean( kf, group, "max",     max );
 	g_key_file_set_double( kf, group, "time_marker_pos",  current_time);
 	g_key_file_set_integer( kf, group, "preview", img->preview_fps);
+	g_key_file_set_integer( kf, group, "preview_cache", img_surface_cache_get_budget(img->cached_preview_surfaces) >> 20);
 	g_key_file_set_string_list(kf, group, "recent_files", (const gchar * const *)recent_files->pdata, recent_files->len);
 
 	rc_path = g_build_filename( g_get_home_dir(), ".config", "imagination", NULL );
@@ -1597,7 +1865,7 @@ gboolean img_load_window_settings( img_window_struct *img )
 	gchar	  **recent_slideshows;
 	gchar     *rc_file, *recent_files = NULL;
 	gint      w, h, g, m, w2,h2;
-	gint	  i;
+	gint	  i, cache_size;
 	gboolean  max;
 	gdouble current_time;
 
@@ -1650,6 +1918,11 @@ gboolean img_load_window_settings( img_window_struct *img )
 	if( ! img->preview_fps )
 		img->preview_fps = 25;
 
+	// Memory given to the preview surfaces in MB
+	cache_size = g_key_file_get_integer( kf, group, "preview_cache", NULL );
+	if (cache_size > 0)
+		img_surface_cache_set_budget(img->cached_preview_surfaces, (gsize) cache_size << 20);
+
 	g_key_file_free( kf );
 
 	gtk_window_set_default_size( GTK_WINDOW( img->imagination_window ), w, h );
@@ -1815,11 +2088,13 @@ void img_media_duration_value_changed (GtkSpinButton *spinbutton, img_window_str
 			for (gint q = 0; q < track->items->len; q++)
 			{
 				item = g_array_index(track->items, media_timeline  *, q);
-				if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)))
+				if (img_timeline_item_is_selected(item))
 				{
 					item->duration = duration;
+					img_tracks_update_item(priv->tracks, item, item->start_time);
 					width = item->duration * priv->pixels_per_second;
-					gtk_widget_set_size_request(GTK_WIDGET(item->button), width, 50);
+					if (item->button)
+						gtk_widget_set_size_request(GTK_WIDGET(item->button), width, 50);
 				}
 			}
 		}
@@ -1833,7 +2108,7 @@ void img_surface_effect_changed(GtkComboBox *widget, img_window_struct *img)
 	ImgTimelinePrivate *priv = img_timeline_get_private_struct(img->timeline);
 	Track *track;
 	media_timeline *item;
-
+	cairo_surface_t *surface;
 	const gchar *filename;
 	gint active = gtk_combo_box_get_active(GTK_COMBO_BOX(widget));
 	
@@ -1845,14 +2120,20 @@ void img_surface_effect_changed(GtkComboBox *widget, img_window_struct *img)
 			for (gint q = 0; q < track->items->len; q++)
 			{
 				item = g_array_index(track->items, media_timeline  *, q);
-				if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)))
+				if (img_timeline_item_is_selected(item))
 				{
-					filename = img_get_media_filename(img,  item->id);
-					g_hash_table_remove(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-					img_create_cached_cairo_surface(img, item, (gchar*) filename);
+					img_assets_ensure_loaded(img, item);
 					item->color_filter = active;
-					img_apply_filter_on_surface(img, item, active);
-					
+					filename = img_get_media_filename(img,  item->id);
+					surface = filename ? img_read_preview_surface(img, item, filename) : NULL;
+					if (surface == NULL)
+					{
+						img_surface_cache_remove(img->cached_preview_surfaces, item->id);
+						continue;
+					}
+					// The picture is read again without effects, the item keeps its place
+					surface = img_restore_surface_effects(surface, item, FALSE);
+					img_surface_cache_insert(img->cached_preview_surfaces, item->id, surface);
 				}
 			}
 		}
@@ -1877,7 +2158,7 @@ void img_opacity_value_changed(GtkRange *range, img_window_struct *img)
 			for (gint q = 0; q < track->items->len; q++)
 			{
 				item = g_array_index(track->items, media_timeline  *, q);
-				if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)))
+				if (img_timeline_item_is_selected(item))
 					item->opacity = opacity / 100.0;
 			}
 		}
@@ -1907,8 +2188,9 @@ void img_flip_horizontal_button_clicked(GtkButton *button, img_window_struct *im
 			for (gint q = 0; q < track->items->len; q++)
 			{
 				item = g_array_index(track->items, media_timeline  *, q);
-				if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)))
+				if (img_timeline_item_is_selected(item))
 				{
+					img_assets_ensure_loaded(img, item);
 					img_flip_surface_horizontally(img, item);
 					item->flipped_horizontally = !item->flipped_horizontally;
 				}
@@ -1933,8 +2215,9 @@ void img_flip_vertical_button_clicked(GtkButton *button, img_window_struct *img)
 			for (gint q = 0; q < track->items->len; q++)
 			{
 				item = g_array_index(track->items, media_timeline  *, q);
-				if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)))
+				if (img_timeline_item_is_selected(item))
 				{
+					img_assets_ensure_loaded(img, item);
 					img_flip_surface_vertically(img, item);
 					item->flipped_vertically = !item->flipped_vertically;
 				}
@@ -1959,8 +2242,11 @@ void img_rotate_button_clicked(GtkButton *button, img_window_struct *img)
 			for (gint q = 0; q < track->items->len; q++)
 			{
 				item = g_array_index(track->items, media_timeline  *, q);
-				if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)))
+				if (img_timeline_item_is_selected(item))
+				{
+					img_assets_ensure_loaded(img, item);
 					img_rotate_surface(img, item, TRUE);
+				}
 			}
 		}
 	}
@@ -26,6 +26,16 @@
 #include "file.h"
 #include "text.h"
 
+/* Room around a picture for its selection handles when redrawing it */
+#define IMG_IMAGE_AREA_HANDLE_MARGIN 20
+
+/* Memory given to the frames kept while moving the red needle */
+#define IMG_SCRUB_CACHE_SIZE (96 * 1024 * 1024)
+
+/* Default memory given to the preview surfaces of the pictures, it can
+ * be changed with preview_cache, in MB, in the settings file */
+#define IMG_PREVIEW_CACHE_SIZE ((gsize) 1024 * 1024 * 1024)
+
 gboolean img_can_discard_unsaved_project(img_window_struct *);
 void img_project_properties(GtkMenuItem *item, img_window_struct *);
 void img_refresh_window_title(img_window_struct *);
@@ -64,6 +74,7 @@ gboolean img_window_key_pressed(GtkWidget *, GdkEventKey *, img_window_struct *)
 void img_exit_fullscreen(img_window_struct *img);
 gboolean img_quit_application(GtkWidget *, GdkEvent *, img_window_struct *);
 gboolean img_on_draw_event(GtkWidget *,cairo_t *,img_window_struct *);
+void img_image_area_invalidate_cache(img_window_struct *);
 void img_ken_burns_zoom_changed( GtkRange *, img_window_struct * );
 gboolean img_image_area_scroll( GtkWidget *, GdkEvent *, img_window_struct * );
 gboolean img_image_area_button_press( GtkWidget *, GdkEventButton *, img_window_struct * );
@@ -20,14 +20,121 @@
 #include "empty_slide.h"
 #include "support.h"
 #include "callbacks.h"
+#include "file.h"
+#include "render_plan.h"
+#include "yuv_convert.h"
+#include <glib/gstdio.h>
+
+/* A decoded media as painted on the exported frames */
+typedef struct _ImgExportCacheEntry ImgExportCacheEntry;
+struct _ImgExportCacheEntry
+{
+	gint					id;				/* Media id */
+	gint					width;			/* Size of the exported frame */
+	gint					height;
+	gint					x;					/* Position of the surface on the frame */
+	gint					y;
+	gdouble			end_time;		/* The surface is freed when the slide ends */
+	guint				last_used;		/* Last frame it was painted on */
+	gsize				size;				/* Memory used by the surface */
+	cairo_surface_t *surface;
+};
+
+/* A frame given to the worker threads. Frame n is rendered in
+ * the job n % export_queue_depth, so the jobs also act as the
+ * buffer putting the frames back in order for the encoder */
+typedef struct _ImgExportJob ImgExportJob;
+struct _ImgExportJob
+{
+	gint					frame_nr;		/* Frame number, also used as pts */
+	gint					status;			/* One of the IMG_EXPORT_JOB_* values */
+	const ImgRenderSegment *segment;	/* What the frame shows, NULL past the end */
+	cairo_surface_t *composite;		/* The media are composed on these two */
+	cairo_surface_t *next_composite;
+	struct SwsContext *sws_ctx;		/* Each job converts its own frame, NULL with img_yuv_convert() */
+	AVFrame			*frame;			/* Frame ready for the encoder */
+};
+
+enum
+{
+	IMG_EXPORT_JOB_IDLE,
+	IMG_EXPORT_JOB_RENDERING,
+	IMG_EXPORT_JOB_DONE,
+	IMG_EXPORT_JOB_EMPTY,			/* No media at this time, the export ends here */
+	IMG_EXPORT_JOB_FAILED,
+	IMG_EXPORT_JOB_STATIC			/* Same as the previous frame, nothing to render */
+};
+
+/* A range of frames encoded on its own thread by a parallel export.
+ * Every part starts with a key frame, so the packets of the parts
+ * can be muxed one after the other in the output */
+typedef struct _ImgExportPart
+{
+	img_window_struct *img;
+	gint					first_frame;
+	gint					last_frame;
+	gchar				*filename;		/* Temporary file the part is muxed in */
+	ImgExportJob		*job;				/* The part renders its frames itself */
+	GThread			*thread;
+	gint					result;			/* 0 or an AVERROR code */
+} ImgExportPart;
 
 static void img_start_export( img_window_struct *);
-static gint img_initialize_av_parameters(img_window_struct *, gint , gint , enum AVCodecID);
+/* An audio item of the timeline, decoded a few
+ * samples at a time while the export goes on */
+typedef struct _ImgExportAudioSource
+{
+	media_timeline		*media;
+	AVFormatContext	*format_context;
+	AVCodecContext		*decoder_context;
+	SwrContext			*swr_ctx;				/* To interleaved float at the export sample rate */
+	AVAudioFifo			*fifo;					/* Converted samples not mixed yet */
+	AVPacket				*packet;
+	AVFrame				*frame;
+	gint					stream_index;
+	gint64				start_sample;			/* Position on the timeline in export samples */
+	gint64				end_sample;
+	gboolean			is_open;
+	gboolean			eof;
+} ImgExportAudioSource;
+
+static gint img_initialize_av_parameters(img_window_struct *, gint , gint , enum AVCodecID, enum AVCodecID);
 static gboolean img_export_still(img_window_struct *);
 static void img_export_pause_unpause( GtkToggleButton  *, img_window_struct *);
-static gboolean img_convert_cairo_frame_to_avframe(img_window_struct *, cairo_surface_t *);
-static gboolean img_export_encode_av_frame(AVFrame *frame, AVFormatContext *fmt, AVCodecContext *ctx, AVPacket *pkt, AVStream *stream);
-static gboolean img_export_project(img_window_struct *);
+static gint img_export_encode_av_frame(AVFrame *frame, AVFormatContext *fmt, AVCodecContext *ctx, AVPacket *pkt, AVStream *stream);
+static gpointer img_export_encoder_thread(gpointer);
+static gboolean img_export_report_progress(img_window_struct *);
+static void img_export_print_progress(img_window_struct *);
+static gboolean img_export_thread_done(img_window_struct *);
+static gint img_export_next_frame(img_window_struct *);
+static gint img_export_render_frame(img_window_struct *, ImgExportJob *);
+static void img_export_render_job(gpointer, gpointer);
+static gboolean img_export_start_workers(img_window_struct *);
+static ImgExportJob *img_export_new_job(img_window_struct *);
+static void img_export_stop_workers(img_window_struct *);
+static void img_export_dispatch_jobs(img_window_struct *);
+static gboolean img_export_frame_is_static(img_window_struct *, ImgExportJob *);
+static const gchar *img_export_get_media_filename(img_window_struct *, gint);
+static gint img_export_write_trailer(img_window_struct *);
+static gint img_export_encode_parts(img_window_struct *);
+static GArray *img_export_split_frames(img_window_struct *, gint);
+static gpointer img_export_part_thread(gpointer);
+static gint img_export_copy_part(img_window_struct *, ImgExportPart *);
+static void img_export_setup_video_encoder(img_window_struct *, AVCodecContext *, enum AVCodecID, gint, gint);
+static gint img_export_audio_setup(img_window_struct *, enum AVCodecID);
+static void img_export_audio_free(img_window_struct *);
+static gint img_export_encode_audio(img_window_struct *, gdouble);
+static gint img_export_encode_audio_frame(img_window_struct *);
+static gboolean img_export_audio_source_open(img_window_struct *, ImgExportAudioSource *);
+static void img_export_audio_source_close(ImgExportAudioSource *);
+static void img_export_audio_source_close_streams(ImgExportAudioSource *);
+static void img_export_audio_source_fill(ImgExportAudioSource *, gint);
+static void img_export_print_usage(void);
+static void img_export_paint_media(img_window_struct *, cairo_t *, const ImgRenderLayer *, gint, gint, gint, gint);
+static cairo_surface_t *img_export_cache_get(img_window_struct *, const ImgRenderLayer *, gint, gint, gint, gint *, gint *);
+static void img_export_cache_expire(img_window_struct *, gdouble);
+static void img_export_cache_trim(img_window_struct *, ImgExportCacheEntry *);
+static void img_export_cache_destroy(img_window_struct *);
 static cairo_surface_t *img_get_next_composed_media(img_window_struct *);
 
 static void img_start_export( img_window_struct *img)
@@ -107,212 +214,1293 @@ static void img_start_export( img_window_struct *img)
 	gtk_box_pack_end( GTK_BOX(hbox), img->export_pause_button, FALSE, FALSE, 0);
 	gtk_widget_show_all(dialog);
 
-	// Create the surface to be passed to the encoder
-	img->exported_image = cairo_image_surface_create(CAIRO_FORMAT_RGB24, img->video_size[0], img->video_size[1]);
 	img->total_nr_frames = img->total_time * img->export_fps;
+	if (img->export_cache_max_size == 0)
+		img->export_cache_max_size = (gsize) IMG_EXPORT_CACHE_SIZE << 20;
 
 	img->elapsed_timer = g_timer_new();
-	img->source_id = g_idle_add((GSourceFunc) img_export_project, img);
+	if (! img_export_start_workers(img))
+	{
+		img_close_export_dialog(img);
+		img_message(img, _("Could not allocate the video frame data\n"));
+		return;
+	}
+	img->export_thread = g_thread_new("export", img_export_encoder_thread, img);
 }
 
-static gboolean img_export_project(img_window_struct *img)
+/* Runs in its own thread so that a slow encoder doesn't freeze the
+ * export dialog. The frames are taken from the workers in pts order,
+ * encoded and muxed while the next ones are rendered. The progress
+ * and the result are given back to the GUI with g_idle_add */
+static gpointer img_export_encoder_thread(gpointer data)
 {
-	media_timeline *media = NULL, *current_media = NULL;
-	GArray *current_media_array = NULL;
-	GArray *next_media_array = NULL;
-    cairo_surface_t *surface = NULL, *composite_surface = NULL;
-    cairo_surface_t *next_composite = NULL;
-    cairo_t *cr;
-    GdkPixbuf *pix = NULL;
-    gint max_width = 0, max_height = 0;
-    gdouble next_time, current_end_time, transition_duration;
-    gboolean is_transitioning = FALSE;
-    
-    // Get export dimensions
-    gint export_width = cairo_image_surface_get_width(img->exported_image);
-    gint export_height = cairo_image_surface_get_height(img->exported_image);
+	img_window_struct *img = data;
+	gint ret;
 
-	current_media_array = img_timeline_get_active_media_at_given_time(img->timeline, img->current_timeline_index);
-	if (current_media_array->len == 0)
+	if (img->export_segments > 1)
+		ret = img_export_encode_parts(img);
+	else
 	{
-		img_post_export(img);
+		while ((ret = img_export_next_frame(img)) > 0)
+		{
+			if (g_atomic_int_compare_and_exchange(&img->export_progress_pending, 0, 1))
+				g_idle_add((GSourceFunc) img_export_report_progress, img);
+		}
+	}
+	if (ret == 0 && ! img->export_cancelled)
+		ret = img_export_write_trailer(img);
+
+	img->export_result = ret;
+	g_idle_add((GSourceFunc) img_export_thread_done, img);
+	return NULL;
+}
+
+/* Prints the progress of the command line export each time its
+ * percentage changes. Called from the threads encoding the parts too */
+static void img_export_print_progress(img_window_struct *img)
+{
+	gint percent, printed;
+
+	percent = 100 * (gint64) g_atomic_int_get(&img->export_next_frame) / (img->export_last_frame + 1);
+	printed = g_atomic_int_get(&img->export_printed_percent);
+	if (percent > printed && g_atomic_int_compare_and_exchange(&img->export_printed_percent, printed, percent))
+		g_print(_("\rExporting: %d%%"), percent);
+}
+
+static gboolean img_export_report_progress(img_window_struct *img)
+{
+	const ImgRenderSegment *segment;
+	media_timeline *media;
+	gdouble progress;
+	gchar string[10], *dummy;
+
+	g_atomic_int_set(&img->export_progress_pending, 0);
+
+	/* The export may have been cancelled meanwhile */
+	if (! img->export_is_running)
 		return G_SOURCE_REMOVE;
+
+	/* Progress of the media currently exported */
+	progress = 0;
+	segment = img_render_plan_lookup(img->export_plan, img->current_timeline_index);
+	if (segment && segment->nr_layers > 0)
+	{
+		media = segment->layers[0].media;
+		if (media->duration > 0)
+			progress = CLAMP((img->current_timeline_index - media->start_time) / media->duration, 0, 1);
 	}
-	current_media = g_array_index(current_media_array, media_timeline *, 0);
+	snprintf( string, 10, "%.2f%%", progress * 100 );
+	gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR( img->export_pbar1 ), progress );
+	gtk_progress_bar_set_text( GTK_PROGRESS_BAR( img->export_pbar1 ), string );
+
+	progress = CLAMP( (gdouble) g_atomic_int_get(&img->export_next_frame) / (img->export_last_frame + 1), 0, 1 );
+	snprintf( string, 10, "%.2f%%", progress * 100 );
+	gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR( img->export_pbar2 ), progress );
+	gtk_progress_bar_set_text( GTK_PROGRESS_BAR( img->export_pbar2 ), string );
+
+	/* Update the elapsed time */
+	img->elapsed_time = g_timer_elapsed(img->elapsed_timer, NULL);
+	dummy = img_convert_seconds_to_time( (gint) img->elapsed_time);
+	gtk_label_set_text(GTK_LABEL(img->elapsed_time_label), dummy);
+	g_free(dummy);
 
-	if (current_media->transition_id > -1)
-		is_transitioning = TRUE;
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean img_export_thread_done(img_window_struct *img)
+{
+	/* Nothing to do if the user cancelled the export */
+	if (! img->export_is_running)
+		return G_SOURCE_REMOVE;
+
+	if (img->export_result < 0)
+	{
+		img_close_export_dialog(img);
+		img_message(img, av_err2str(img->export_result));
+	}
 	else
-		is_transitioning = FALSE;
-  
-	// Find max dimensions for all current media
-	for (gint i = 0; i < current_media_array->len; i++)
-	{
-		media = g_array_index(current_media_array, media_timeline *, i);
-		pix = gdk_pixbuf_new_from_file_at_scale(img_get_media_filename(img, media->id), 1, 1, TRUE, NULL);
-		if (pix)
+		img_post_export(img);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* The media are taken from the timeline widget or, when exporting
+ * from the command line, from the tracks read from the project file */
+static GArray *img_export_get_tracks(img_window_struct *img)
+{
+	if (img->headless)
+		return img->headless_tracks;
+
+	return img_timeline_get_private_struct(img->timeline)->tracks;
+}
+
+static const gchar *img_export_get_media_filename(img_window_struct *img, gint id)
+{
+	return img_render_plan_get_filename(img->export_plan, id);
+}
+
+/* The time of a frame on the timeline */
+static gdouble img_export_frame_time(img_window_struct *img, gint frame_nr)
+{
+	return (gdouble) frame_nr / img->export_fps;
+}
+
+/* A frame is static when the segment it falls in also contains the
+ * previous frame and has no transition nor animated text. It is then
+ * encoded again from the previous converted frame instead of being
+ * composed. Ken Burns motion isn't applied to the timeline media yet
+ * so it doesn't need to be checked here */
+static gboolean img_export_frame_is_static(img_window_struct *img, ImgExportJob *job)
+{
+	const ImgRenderSegment *segment = job->segment;
+
+	if (job->frame_nr == 0 || segment == NULL)
+		return FALSE;
+
+	return segment->render == NULL && ! segment->is_animated &&
+			img_export_frame_time(img, job->frame_nr - 1) >= segment->start_time;
+}
+
+/* Encodes the frame following the last encoded one, waiting for a
+ * worker to finish it if needed. Returns 1 if there are more frames
+ * to export, 0 when the export is completed or cancelled or a
+ * negative AVERROR code if the encoding failed */
+static gint img_export_next_frame(img_window_struct *img)
+{
+	ImgExportJob *job;
+	gint ret, status;
+
+	g_mutex_lock(&img->export_mutex);
+	while (img->export_paused && ! img->export_cancelled)
+		g_cond_wait(&img->export_cond, &img->export_mutex);
+
+	img_export_dispatch_jobs(img);
+	job = g_ptr_array_index(img->export_jobs, img->export_next_frame % img->export_queue_depth);
+	while (job->status == IMG_EXPORT_JOB_RENDERING && ! img->export_cancelled)
+		g_cond_wait(&img->export_cond, &img->export_mutex);
+
+	status = job->status;
+	if (img->export_cancelled)
+		status = IMG_EXPORT_JOB_EMPTY;
+	g_mutex_unlock(&img->export_mutex);
+
+	if (status == IMG_EXPORT_JOB_EMPTY)
+		return 0;
+	if (status == IMG_EXPORT_JOB_FAILED)
+		return AVERROR(ENOMEM);
+
+	//Send the frame to the encoder
+	img->current_timeline_index = img_export_frame_time(img, job->frame_nr);
+	img->export_slide++;
+	if (status == IMG_EXPORT_JOB_STATIC)
+	{
+		/* The encoder gets another reference to the buffers
+		 * of the previous frame, nothing is copied */
+		AVFrame *frame = av_frame_clone(img->export_prev_frame);
+		if (frame == NULL)
+			return AVERROR(ENOMEM);
+
+		frame->pts = job->frame_nr;
+		ret = img_export_encode_av_frame(frame, img->video_format_context, img->codec_context, img->video_packet, img->video_stream);
+		av_frame_free(&frame);
+	}
+	else
+	{
+		ret = img_export_encode_av_frame(job->frame, img->video_format_context, img->codec_context, img->video_packet, img->video_stream);
+		av_frame_unref(img->export_prev_frame);
+		av_frame_ref(img->export_prev_frame, job->frame);
+	}
+	if (ret < 0)
+		return ret;
+
+	// Mux the audio up to the end of this frame
+	ret = img_export_encode_audio(img, img_export_frame_time(img, job->frame_nr + 1));
+	if (ret < 0)
+		return ret;
+
+	g_mutex_lock(&img->export_mutex);
+	job->status = IMG_EXPORT_JOB_IDLE;
+	g_atomic_int_inc(&img->export_next_frame);
+	g_mutex_unlock(&img->export_mutex);
+
+	// Drop the decoded media whose slides are over
+	img_export_cache_expire(img, img_export_frame_time(img, img->export_next_frame));
+
+	if (img->export_next_frame > img->export_last_frame)
+		return 0;
+
+	return 1;
+}
+
+/* Gives the workers the frames following the last encoded one until
+ * export_queue_depth frames are being rendered. Called with
+ * export_mutex held */
+static void img_export_dispatch_jobs(img_window_struct *img)
+{
+	ImgExportJob *job;
+
+	while (img->export_next_job < img->export_next_frame + img->export_queue_depth &&
+				img->export_next_job <= img->export_last_frame)
+	{
+		job = g_ptr_array_index(img->export_jobs, img->export_next_job % img->export_queue_depth);
+		job->frame_nr = img->export_next_job++;
+		job->segment = img_render_plan_seek(img->export_plan, &img->export_plan_cursor,
+											img_export_frame_time(img, job->frame_nr));
+		if (img_export_frame_is_static(img, job))
 		{
-			max_width = MAX(max_width, gdk_pixbuf_get_width(pix));
-			max_height = MAX(max_height, gdk_pixbuf_get_height(pix));
-			g_object_unref(pix);
+			job->status = IMG_EXPORT_JOB_STATIC;
+			continue;
 		}
+		job->status = IMG_EXPORT_JOB_RENDERING;
+		g_thread_pool_push(img->export_pool, job, NULL);
 	}
+}
+
+/* Runs in the worker threads */
+static void img_export_render_job(gpointer data, gpointer user_data)
+{
+	ImgExportJob *job = data;
+	img_window_struct *img = user_data;
+	gint status;
+
+	status = img_export_render_frame(img, job);
+
+	g_mutex_lock(&img->export_mutex);
+	job->status = status;
+	g_cond_broadcast(&img->export_cond);
+	g_mutex_unlock(&img->export_mutex);
+}
+
+/* Composes the frame of the job and converts it to the encoder pixel
+ * format. Only the job and the export cache are written here since
+ * several frames are rendered at the same time */
+static gint img_export_render_frame(img_window_struct *img, ImgExportJob *job)
+{
+	const ImgRenderSegment *segment = job->segment;
+    cairo_t *cr;
+    const uint8_t *data[4] = { NULL };
+    gint linesize[4] = { 0 };
+    gdouble time, progress;
+
+    gint export_width = img->video_size[0];
+    gint export_height = img->video_size[1];
+
+	if (segment == NULL)
+		return IMG_EXPORT_JOB_EMPTY;
+
+	cr = cairo_create(job->composite);
+	img_export_paint_media(img, cr, segment->layers, segment->nr_layers, export_width, export_height, job->frame_nr);
+	cairo_destroy(cr);
+
+	if (segment->render && segment->nr_next_layers > 0)
+	{
+		time = img_export_frame_time(img, job->frame_nr);
+		progress = 1.0 - ((segment->transition_end - time) / segment->transition_duration);
+
+		cr = cairo_create(job->next_composite);
+		img_export_paint_media(img, cr, segment->next_layers, segment->nr_next_layers, export_width, export_height, job->frame_nr);
+		cairo_destroy(cr);
+
+		// Apply transition effect
+		cr = cairo_create(job->composite);
+		segment->render(cr, job->composite, job->next_composite, progress);
+		cairo_destroy(cr);
+	}
+
+	/* Convert the composed surface with its own stride, CAIRO_FORMAT_ARGB32
+	 * is stored as native endian 32 bits words like AV_PIX_FMT_RGB32.
+	 * The encoder may still hold the buffer of the frame encoded
+	 * export_queue_depth frames ago, if so a new one is allocated */
+	if (av_frame_make_writable(job->frame) < 0)
+		return IMG_EXPORT_JOB_FAILED;
+
+	cairo_surface_flush(job->composite);
+	data[0] = cairo_image_surface_get_data(job->composite);
+	linesize[0] = cairo_image_surface_get_stride(job->composite);
+	if (job->sws_ctx)
+		sws_scale(job->sws_ctx, data, linesize, 0, export_height, job->frame->data, job->frame->linesize);
+	else
+		img_yuv_convert(data[0], linesize[0], job->frame, 0, export_height);
+	job->frame->pts = job->frame_nr;
+
+	return IMG_EXPORT_JOB_DONE;
+}
+
+static void img_export_free_job(gpointer data)
+{
+	ImgExportJob *job = data;
+
+	if (job->composite)
+		cairo_surface_destroy(job->composite);
+	if (job->next_composite)
+		cairo_surface_destroy(job->next_composite);
+	sws_freeContext(job->sws_ctx);
+	av_frame_free(&job->frame);
+	g_slice_free(ImgExportJob, job);
+}
+
+/* Allocates export_queue_depth jobs and the threads rendering them,
+ * the memory used by the export is bounded by the queue depth */
+static gboolean img_export_start_workers(img_window_struct *img)
+{
+	gint nr_threads;
+
+	if (img->export_queue_depth <= 0)
+		img->export_queue_depth = IMG_EXPORT_QUEUE_DEPTH;
+
+	img->export_next_frame = 0;
+	img->export_next_job = 0;
+	img->export_printed_percent = -1;
+	img->export_paused = FALSE;
+	img->export_cancelled = FALSE;
+	img->export_progress_pending = 0;
+	img->export_last_frame = MAX(img->total_nr_frames, 1) - 1;
+	img->export_prev_frame = av_frame_alloc();
+	if (img->export_prev_frame == NULL)
+		return FALSE;
+	img->export_plan = img_render_plan_new(img, img_export_get_tracks(img));
+	img->export_plan_cursor = 0;
+
+	/* total_time is rounded up to the second, the frames after the last
+	 * media would end the export early and the audio would outlast it */
+	if (img->export_plan->nr_segments > 0)
+	{
+		gdouble end_time = img->export_plan->segments[img->export_plan->nr_segments - 1].end_time;
+
+		img->export_last_frame = MIN(img->export_last_frame, MAX((gint) ceil(end_time * img->export_fps) - 1, 0));
+	}
+	g_mutex_init(&img->export_mutex);
+	g_mutex_init(&img->export_cache_mutex);
+	g_cond_init(&img->export_cond);
+
+	img->export_jobs = g_ptr_array_new_with_free_func(img_export_free_job);
+
+	/* The parts of a parallel export render their frames themselves */
+	if (img->export_segments > 1)
+		return TRUE;
+
+	for (gint i = 0; i < img->export_queue_depth; i++)
+	{
+		if (img_export_new_job(img) == NULL)
+			return FALSE;
+	}
+
+	/* No point in having more threads than frames to render */
+	nr_threads = MIN(g_get_num_processors(), img->export_queue_depth);
+	img->export_pool = g_thread_pool_new(img_export_render_job, img, nr_threads, TRUE, NULL);
+
+	return img->export_pool != NULL;
+}
+
+/* Allocates the surfaces and the frame a job renders into and
+ * adds it to export_jobs, which frees it with the others */
+static ImgExportJob *img_export_new_job(img_window_struct *img)
+{
+	ImgExportJob *job;
+
+	job = g_slice_new0(ImgExportJob);
+	g_ptr_array_add(img->export_jobs, job);
+
+	job->composite = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, img->video_size[0], img->video_size[1]);
+	job->next_composite = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, img->video_size[0], img->video_size[1]);
+
+	/* The common YUV formats are converted without swscale, the
+	 * others don't need any filtering since the size is the same */
+	if (! img_yuv_convert_supported(img->codec_context->pix_fmt))
+	{
+		job->sws_ctx = sws_getContext(img->video_size[0], img->video_size[1], AV_PIX_FMT_RGB32,
+										img->video_size[0], img->video_size[1], img->codec_context->pix_fmt,
+										SWS_POINT, NULL, NULL, NULL);
+		if (job->sws_ctx == NULL)
+			return NULL;
+	}
+	job->frame = av_frame_alloc();
+	if (job->frame == NULL)
+		return NULL;
+
+	job->frame->format = img->codec_context->pix_fmt;
+	job->frame->width  = img->video_size[0];
+	job->frame->height = img->video_size[1];
+	if (av_frame_get_buffer(job->frame, 0) < 0)
+		return NULL;
+
+	return job;
+}
+
+/* Drops the frames not being rendered yet and waits for the others */
+static void img_export_stop_workers(img_window_struct *img)
+{
+	if (img->export_pool)
+	{
+		g_thread_pool_free(img->export_pool, TRUE, TRUE);
+		img->export_pool = NULL;
+	}
+	if (img->export_jobs)
+	{
+		g_ptr_array_free(img->export_jobs, TRUE);
+		img->export_jobs = NULL;
+		av_frame_free(&img->export_prev_frame);
+		img_render_plan_free(img->export_plan);
+		img->export_plan = NULL;
+
+		g_mutex_clear(&img->export_mutex);
+		g_mutex_clear(&img->export_cache_mutex);
+		g_cond_clear(&img->export_cond);
+	}
+}
+
+/* Fills the frame with the background color and paints the layers
+ * on it, the last one being the bottom one */
+static void img_export_paint_media(img_window_struct *img, cairo_t *cr, const ImgRenderLayer *layers, gint nr_layers,
+												gint width, gint height, gint frame_nr)
+{
+	cairo_surface_t *surface;
+	gint x, y;
+
+	cairo_set_source_rgb(cr, img->background_color[0], img->background_color[1], img->background_color[2]);
+	cairo_paint(cr);
+
+	for (gint i = nr_layers - 1; i >= 0; i--)
+	{
+		surface = img_export_cache_get(img, &layers[i], width, height, frame_nr, &x, &y);
+		if (surface)
+		{
+			cairo_set_source_surface(cr, surface, x, y);
+			cairo_paint(cr);
+			cairo_surface_destroy(surface);
+		}
+	}
+}
+
+static guint img_export_cache_hash(gconstpointer key)
+{
+	const ImgExportCacheEntry *entry = key;
+
+	return g_direct_hash(GINT_TO_POINTER(entry->id)) ^ (entry->width << 16) ^ entry->height;
+}
+
+static gboolean img_export_cache_equal(gconstpointer a, gconstpointer b)
+{
+	const ImgExportCacheEntry *e1 = a, *e2 = b;
+
+	return e1->id == e2->id && e1->width == e2->width && e1->height == e2->height;
+}
+
+static void img_export_cache_free_entry(gpointer data)
+{
+	ImgExportCacheEntry *entry = data;
+
+	cairo_surface_destroy(entry->surface);
+	g_slice_free(ImgExportCacheEntry, entry);
+}
+
+/* Returns a new reference to the surface of the media as painted on a
+ * frame of the given size and its position on the frame. The file is
+ * decoded only the first time, later calls return the cached surface
+ * until its slide is over or it's pushed out by the cap. The workers
+ * decode outside the lock so a slow file doesn't stall the others */
+static cairo_surface_t *img_export_cache_get(img_window_struct *img, const ImgRenderLayer *layer, gint width, gint height,
+												gint frame_nr, gint *pos_x, gint *pos_y)
+{
+	ImgExportCacheEntry key, *entry, *cached;
+	media_timeline *media = layer->media;
+	cairo_surface_t *surface;
+	GdkPixbuf *pix;
+	cairo_t *cr;
+	gint x, y, pix_width, pix_height;
+
+	/* Only pictures are decoded here */
+	if (media->media_type != 0)
+		return NULL;
+
+	key.id = media->id;
+	key.width = width;
+	key.height = height;
+
+	g_mutex_lock(&img->export_cache_mutex);
+	if (img->export_cache == NULL)
+		img->export_cache = g_hash_table_new_full(img_export_cache_hash, img_export_cache_equal, NULL, img_export_cache_free_entry);
+
+	entry = g_hash_table_lookup(img->export_cache, &key);
+	if (entry)
+	{
+		entry->end_time = MAX(entry->end_time, media->start_time + media->duration);
+		entry->last_used = MAX(entry->last_used, frame_nr);
+		*pos_x = entry->x;
+		*pos_y = entry->y;
+		surface = cairo_surface_reference(entry->surface);
+		g_mutex_unlock(&img->export_cache_mutex);
+		return surface;
+	}
+	g_mutex_unlock(&img->export_cache_mutex);
+
+	if (layer->filename == NULL)
+		return NULL;
+
+	pix = gdk_pixbuf_new_from_file(layer->filename, NULL);
+	if (pix == NULL)
+		return NULL;
+
+	surface = gdk_cairo_surface_create_from_pixbuf(pix, 0, NULL);
+	pix_width = gdk_pixbuf_get_width(pix);
+	pix_height = gdk_pixbuf_get_height(pix);
+	g_object_unref(pix);
+	if (surface == NULL)
+		return NULL;
+
+	/* The media is centered on the frame so keep only
+	 * the part of it which falls inside the frame */
+	x = (width - pix_width) / 2;
+	y = (height - pix_height) / 2;
+
+	entry = g_slice_new0(ImgExportCacheEntry);
+	entry->id = media->id;
+	entry->width = width;
+	entry->height = height;
+	entry->x = MAX(x, 0);
+	entry->y = MAX(y, 0);
+	entry->end_time = media->start_time + media->duration;
+	entry->last_used = frame_nr;
+	entry->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, MIN(pix_width, width), MIN(pix_height, height));
+	cr = cairo_create(entry->surface);
+	cairo_set_source_surface(cr, surface, MIN(x, 0), MIN(y, 0));
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+	entry->size = cairo_image_surface_get_stride(entry->surface) * cairo_image_surface_get_height(entry->surface);
+
+	g_mutex_lock(&img->export_cache_mutex);
+
+	/* Another worker may have decoded the same media meanwhile */
+	cached = g_hash_table_lookup(img->export_cache, &key);
+	if (cached)
+	{
+		img_export_cache_free_entry(entry);
+		entry = cached;
+		entry->last_used = MAX(entry->last_used, frame_nr);
+	}
+	else
+	{
+		img->export_cache_size += entry->size;
+		g_hash_table_add(img->export_cache, entry);
+		img_export_cache_trim(img, entry);
+	}
+	*pos_x = entry->x;
+	*pos_y = entry->y;
+	surface = cairo_surface_reference(entry->surface);
+	g_mutex_unlock(&img->export_cache_mutex);
+
+	return surface;
+}
+
+/* Frees the surfaces of the media whose time range ended before
+ * the given time. The frames being rendered hold their own
+ * reference to the surfaces they use */
+static void img_export_cache_expire(img_window_struct *img, gdouble time)
+{
+	ImgExportCacheEntry *entry;
+	GHashTableIter iter;
+
+	g_mutex_lock(&img->export_cache_mutex);
+	if (img->export_cache)
+	{
+		g_hash_table_iter_init(&iter, img->export_cache);
+		while (g_hash_table_iter_next(&iter, (gpointer *) &entry, NULL))
+		{
+			if (entry->end_time <= time)
+			{
+				img->export_cache_size -= entry->size;
+				g_hash_table_iter_remove(&iter);
+			}
+		}
+	}
+	g_mutex_unlock(&img->export_cache_mutex);
+}
+
+/* Frees the least recently used surfaces until the cache fits in
+ * its memory cap, but never the one just added. Called with
+ * export_cache_mutex held */
+static void img_export_cache_trim(img_window_struct *img, ImgExportCacheEntry *keep)
+{
+	ImgExportCacheEntry *entry, *oldest;
+	GHashTableIter iter;
+
+	while (img->export_cache_size > img->export_cache_max_size)
+	{
+		oldest = NULL;
+		g_hash_table_iter_init(&iter, img->export_cache);
+		while (g_hash_table_iter_next(&iter, (gpointer *) &entry, NULL))
+		{
+			if (entry != keep && (oldest == NULL || entry->last_used < oldest->last_used))
+				oldest = entry;
+		}
+		if (oldest == NULL)
+			break;
+
+		img->export_cache_size -= oldest->size;
+		g_hash_table_remove(img->export_cache, oldest);
+	}
+}
+
+static void img_export_cache_destroy(img_window_struct *img)
+{
+	if (img->export_cache)
+	{
+		g_hash_table_destroy(img->export_cache);
+		img->export_cache = NULL;
+	}
+	img->export_cache_size = 0;
+}
+
+gboolean on_close_export_dialog(GtkWidget * widget, GdkEvent * event,  img_window_struct *img)
+{
+    img_close_export_dialog(img);
+    return TRUE;
+}
+
+/* If the export wasn't aborted by user display the close button
+ * and wait for the user to click it to close the dialog. This
+ * way the elapsed time is still shown until the dialog is closed */
+void img_post_export(img_window_struct *img)
+{
+	img_stop_export(img);
+
+	gtk_widget_hide(img->export_pause_button);
+	gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR( img->export_pbar1 ), 1);
+	gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR( img->export_pbar2 ), 1);
+	gtk_button_set_label(GTK_BUTTON(img->export_cancel_button), _("Close"));
+	g_signal_connect_swapped (img->export_cancel_button, "clicked", G_CALLBACK (gtk_widget_destroy), img->export_dialog);
+}
+
+/* Returns 0 or a negative AVERROR code */
+static gint img_export_write_trailer(img_window_struct *img)
+{
+	gint ret;
+
+	/* Flush remaining packets out of video by sending a NULL frame */
+	ret = img_export_encode_av_frame(NULL, img->video_format_context, img->codec_context, img->video_packet, img->video_stream);
+	if (ret < 0)
+		return ret;
+
+	/* Do the same with the audio once it reaches the end of the video */
+	if (img->audio_codec_context)
+	{
+		ret = img_export_encode_audio(img, img_export_frame_time(img, img->export_last_frame + 1));
+		if (ret < 0)
+			return ret;
+		ret = img_export_encode_av_frame(NULL, img->video_format_context, img->audio_codec_context, img->audio_packet, img->audio_stream);
+		if (ret < 0)
+			return ret;
+	}
+	return av_write_trailer(img->video_format_context);
+}
+
+/* Encodes the frames in export_segments parts at the same time, each
+ * one with its own encoder, then puts the parts in the output. Used
+ * instead of img_export_next_frame() when the encoder, rather than the
+ * rendering, is what limits the export speed. Returns 0 when the export
+ * is completed or cancelled, an AVERROR code if it failed */
+static gint img_export_encode_parts(img_window_struct *img)
+{
+	ImgExportPart *parts;
+	GArray *cuts;
+	gchar *dir, *name;
+	gint nr_parts, ret = 0;
+
+	dir = g_dir_make_tmp("imagination-XXXXXX", NULL);
+	if (dir == NULL)
+		return AVERROR(EIO);
+
+	cuts = img_export_split_frames(img, img->export_segments);
+	nr_parts = cuts->len;
+	parts = g_new0(ImgExportPart, nr_parts);
+	for (gint i = 0; i < nr_parts; i++)
+	{
+		parts[i].img = img;
+		parts[i].first_frame = g_array_index(cuts, gint, i);
+		parts[i].last_frame = i + 1 < nr_parts ? g_array_index(cuts, gint, i + 1) - 1 : img->export_last_frame;
+		name = g_strdup_printf("part%d.nut", i);
+		parts[i].filename = g_build_filename(dir, name, NULL);
+		g_free(name);
+		parts[i].job = img_export_new_job(img);
+		if (parts[i].job == NULL)
+			ret = AVERROR(ENOMEM);
+	}
+	g_array_free(cuts, TRUE);
+
+	if (ret == 0)
+	{
+		for (gint i = 0; i < nr_parts; i++)
+			parts[i].thread = g_thread_new("export-part", img_export_part_thread, &parts[i]);
+	}
+
+	/* The parts are muxed as soon as they are done, all of
+	 * them are waited for even if one of them failed */
+	for (gint i = 0; i < nr_parts; i++)
+	{
+		if (parts[i].thread)
+			g_thread_join(parts[i].thread);
+
+		if (ret == 0)
+			ret = parts[i].result;
+		if (ret == 0 && ! img->export_cancelled)
+			ret = img_export_copy_part(img, &parts[i]);
+
+		g_unlink(parts[i].filename);
+		g_free(parts[i].filename);
+	}
+	g_rmdir(dir);
+	g_free(dir);
+	g_free(parts);
+
+	return ret;
+}
+
+/* Returns the first frame of each part. The parts are cut where a slide
+ * begins without a transition into it, so that the key frame starting a
+ * part would have been needed there anyway. The cut nearest to an even
+ * split is taken, or the even split itself if there's no such slide */
+static GArray *img_export_split_frames(img_window_struct *img, gint nr_parts)
+{
+	const ImgRenderPlan *plan = img->export_plan;
+	GArray *cuts;
+	gint nr_frames = img->export_last_frame + 1;
+	gint frame, target, best, prev;
+
+	cuts = g_array_new(FALSE, FALSE, sizeof(gint));
+	frame = 0;
+	g_array_append_val(cuts, frame);
+
+	nr_parts = MIN(nr_parts, nr_frames);
+	for (gint k = 1; k < nr_parts; k++)
+	{
+		prev = g_array_index(cuts, gint, cuts->len - 1);
+		target = (gint64) nr_frames * k / nr_parts;
+		best = -1;
+		for (gint i = 1; i < plan->nr_segments; i++)
+		{
+			if (plan->segments[i - 1].render)
+				continue;
+
+			frame = ceil(plan->segments[i].start_time * img->export_fps);
+			if (frame <= prev || frame >= nr_frames)
+				continue;
+			if (best < 0 || ABS(frame - target) < ABS(best - target))
+				best = frame;
+		}
+		/* Don't let a far away slide make a part much longer than the others */
+		if (best < 0 || ABS(best - target) > nr_frames / (2 * nr_parts))
+			best = target;
+		if (best > prev)
+			g_array_append_val(cuts, best);
+	}
+	return cuts;
+}
+
+/* Runs in the thread of a part. Renders and encodes its frames in
+ * a temporary file with an encoder set up like the main one */
+static gpointer img_export_part_thread(gpointer data)
+{
+	ImgExportPart *part = data;
+	img_window_struct *img = part->img;
+	ImgExportJob *job = part->job;
+	AVFormatContext *fmt = NULL;
+	AVCodecContext *ctx = NULL;
+	AVStream *stream;
+	AVPacket *pkt = NULL;
+	AVFrame *prev = NULL, *frame;
+	gint cursor = 0, status, ret;
+	gboolean cancelled;
+
+	ret = avformat_alloc_output_context2(&fmt, NULL, "nut", part->filename);
+	if (ret < 0)
+		goto end;
+	ret = avio_open(&fmt->pb, part->filename, AVIO_FLAG_WRITE);
+	if (ret < 0)
+		goto end;
+
+	stream = avformat_new_stream(fmt, NULL);
+	ctx = avcodec_alloc_context3(img->codec_context->codec);
+	pkt = av_packet_alloc();
+	prev = av_frame_alloc();
+	if (stream == NULL || ctx == NULL || pkt == NULL || prev == NULL)
+	{
+		ret = AVERROR(ENOMEM);
+		goto end;
+	}
+	img_export_setup_video_encoder(img, ctx, img->codec_context->codec_id, img->export_fps, img->export_bitrate_crf);
+	ret = avcodec_open2(ctx, img->codec_context->codec, NULL);
+	if (ret < 0)
+		goto end;
+	ret = avcodec_parameters_from_context(stream->codecpar, ctx);
+	if (ret < 0)
+		goto end;
+	stream->time_base = ctx->time_base;
+	ret = avformat_write_header(fmt, NULL);
+	if (ret < 0)
+		goto end;
+
+	for (gint frame_nr = part->first_frame; frame_nr <= part->last_frame; frame_nr++)
+	{
+		g_mutex_lock(&img->export_mutex);
+		while (img->export_paused && ! img->export_cancelled)
+			g_cond_wait(&img->export_cond, &img->export_mutex);
+		cancelled = img->export_cancelled;
+		g_mutex_unlock(&img->export_mutex);
+		if (cancelled)
+			break;
+
+		job->frame_nr = frame_nr;
+		job->segment = img_render_plan_seek(img->export_plan, &cursor, img_export_frame_time(img, frame_nr));
+		if (frame_nr > part->first_frame && img_export_frame_is_static(img, job))
+		{
+			frame = av_frame_clone(prev);
+			if (frame == NULL)
+			{
+				ret = AVERROR(ENOMEM);
+				break;
+			}
+			frame->pts = frame_nr;
+			ret = img_export_encode_av_frame(frame, fmt, ctx, pkt, stream);
+			av_frame_free(&frame);
+		}
+		else
+		{
+			status = img_export_render_frame(img, job);
+			if (status == IMG_EXPORT_JOB_EMPTY)
+				break;
+			if (status == IMG_EXPORT_JOB_FAILED)
+			{
+				ret = AVERROR(ENOMEM);
+				break;
+			}
+			ret = img_export_encode_av_frame(job->frame, fmt, ctx, pkt, stream);
+			av_frame_unref(prev);
+			av_frame_ref(prev, job->frame);
+		}
+		if (ret < 0)
+			break;
+
+		g_atomic_int_inc(&img->export_next_frame);
+		if (img->headless)
+			img_export_print_progress(img);
+		else if (g_atomic_int_compare_and_exchange(&img->export_progress_pending, 0, 1))
+			g_idle_add((GSourceFunc) img_export_report_progress, img);
+	}
+	if (ret >= 0)
+		ret = img_export_encode_av_frame(NULL, fmt, ctx, pkt, stream);
+	if (ret >= 0)
+		ret = av_write_trailer(fmt);
+
+end:
+	/* Stop the other parts, the export can't be completed anymore */
+	if (ret < 0)
+	{
+		g_mutex_lock(&img->export_mutex);
+		img->export_cancelled = TRUE;
+		g_cond_broadcast(&img->export_cond);
+		g_mutex_unlock(&img->export_mutex);
+	}
+	part->result = ret < 0 ? ret : 0;
+
+	av_frame_free(&prev);
+	av_packet_free(&pkt);
+	avcodec_free_context(&ctx);
+	if (fmt)
+	{
+		avio_closep(&fmt->pb);
+		avformat_free_context(fmt);
+	}
+	return NULL;
+}
+
+/* Muxes the packets of an encoded part in the output, along with
+ * the audio playing up to the end of each of them */
+static gint img_export_copy_part(img_window_struct *img, ImgExportPart *part)
+{
+	AVFormatContext *fmt = NULL;
+	AVPacket *pkt;
+	gdouble time;
+	gint ret;
+
+	ret = avformat_open_input(&fmt, part->filename, NULL, NULL);
+	if (ret < 0)
+		return ret;
+
+	pkt = av_packet_alloc();
+	if (pkt == NULL)
+	{
+		avformat_close_input(&fmt);
+		return AVERROR(ENOMEM);
+	}
+	while ((ret = av_read_frame(fmt, pkt)) >= 0)
+	{
+		av_packet_rescale_ts(pkt, fmt->streams[pkt->stream_index]->time_base, img->video_stream->time_base);
+		pkt->stream_index = img->video_stream->index;
+		pkt->pos = -1;
+		time = (pkt->pts + MAX(pkt->duration, 1)) * av_q2d(img->video_stream->time_base);
+		img->current_timeline_index = pkt->pts * av_q2d(img->video_stream->time_base);
+		img->export_slide++;
+
+		ret = av_interleaved_write_frame(img->video_format_context, pkt);
+		if (ret < 0)
+			break;
+		ret = img_export_encode_audio(img, time);
+		if (ret < 0)
+			break;
+	}
+	if (ret == AVERROR_EOF)
+		ret = 0;
+
+	av_packet_free(&pkt);
+	avformat_close_input(&fmt);
+
+	return ret;
+}
+
+/* Sets up the audio encoder and the sources of the audio items on the
+ * timeline. Nothing is done when the project has no audio. Returns TRUE
+ * on success, FALSE or an AVERROR code on failure */
+static gint img_export_audio_setup(img_window_struct *img, enum AVCodecID codec_id)
+{
+	const AVCodec *acodec;
+	AVCodecContext *ctx;
+	AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+	ImgExportAudioSource *source;
+	GArray *tracks;
+	Track *track;
+	media_timeline *media;
+	gint sample_rate, ret;
+
+	img->export_audio_sources = g_ptr_array_new_with_free_func((GDestroyNotify) img_export_audio_source_close);
+	tracks = img_export_get_tracks(img);
+	for (gint i = 0; i < tracks->len; i++)
+	{
+		track = g_array_index(tracks, Track *, i);
+		for (gint j = 0; j < track->items->len; j++)
+		{
+			media = g_array_index(track->items, media_timeline *, j);
+			if (media->media_type != 1 || media->duration <= 0)
+				continue;
+
+			source = g_new0(ImgExportAudioSource, 1);
+			source->media = media;
+			g_ptr_array_add(img->export_audio_sources, source);
+		}
+	}
+	if (img->export_audio_sources->len == 0)
+		return TRUE;
+
+	if (codec_id == AV_CODEC_ID_NONE)
+		codec_id = img->video_format_context->oformat->audio_codec;
+
+	acodec = avcodec_find_encoder(codec_id);
+	if (acodec == NULL)
+	{
+		img_message(img, _("Couldn't find the audio encoder\n"));
+		return FALSE;
+	}
+	img->audio_stream = avformat_new_stream(img->video_format_context, NULL);
+	if (! img->audio_stream)
+	{
+		img_message(img, _("Couldn't not allocate audio stream\n"));
+		return FALSE;
+	}
+	img->audio_stream->id = img->video_format_context->nb_streams - 1;
+
+	ctx = avcodec_alloc_context3(acodec);
+	if (! ctx)
+	{
+		img_message(img, _("Couldn't allocate audio enconding context\n"));
+		return FALSE;
+	}
+	img->audio_codec_context = ctx;
+
+	/* Use the chosen sample rate if the encoder supports it */
+	sample_rate = img->sample_rate;
+	if (acodec->supported_samplerates)
+	{
+		gint i;
+		for (i = 0; acodec->supported_samplerates[i]; i++)
+			if (acodec->supported_samplerates[i] == sample_rate)
+				break;
+		if (acodec->supported_samplerates[i] == 0)
+			sample_rate = acodec->supported_samplerates[0];
+	}
+	ctx->sample_fmt = acodec->sample_fmts ? acodec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+	ctx->sample_rate = sample_rate;
+	ctx->bit_rate = img->bitrate * 1000;
+	av_channel_layout_copy(&ctx->ch_layout, &stereo);
+	ctx->time_base = (AVRational) {1, sample_rate};
+	img->audio_stream->time_base = ctx->time_base;
+
+	if (img->video_format_context->oformat->flags & AVFMT_GLOBALHEADER)
+		ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	ret = avcodec_open2(ctx, acodec, NULL);
+	if (ret < 0)
+		return ret;
+
+	ret = avcodec_parameters_from_context(img->audio_stream->codecpar, ctx);
+	if (ret < 0)
+		return ret;
+
+	/* The encoder is fed with frames of the size it wants,
+	 * or 1024 samples when it takes any size */
+	img->audio_frame = av_frame_alloc();
+	img->audio_packet = av_packet_alloc();
+	if (img->audio_frame == NULL || img->audio_packet == NULL)
+		return AVERROR(ENOMEM);
+
+	if (ctx->frame_size == 0 || (acodec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+		img->audio_frame->nb_samples = 1024;
+	else
+		img->audio_frame->nb_samples = ctx->frame_size;
+	img->audio_frame->format = ctx->sample_fmt;
+	img->audio_frame->sample_rate = ctx->sample_rate;
+	av_channel_layout_copy(&img->audio_frame->ch_layout, &ctx->ch_layout);
+	ret = av_frame_get_buffer(img->audio_frame, 0);
+	if (ret < 0)
+		return ret;
+
+	/* The sources are mixed as interleaved float, this
+	 * only converts the mix to the encoder sample format */
+	ret = swr_alloc_set_opts2(&img->swr_ctx, &ctx->ch_layout, ctx->sample_fmt, ctx->sample_rate,
+												&ctx->ch_layout, AV_SAMPLE_FMT_FLT, ctx->sample_rate, 0, NULL);
+	if (ret < 0)
+		return ret;
+	ret = swr_init(img->swr_ctx);
+	if (ret < 0)
+		return ret;
+
+	img->export_audio_mix = g_new(gfloat, img->audio_frame->nb_samples * 2);
+	img->export_audio_buffer = g_new(gfloat, img->audio_frame->nb_samples * 2);
+	img->export_audio_next_pts = 0;
+
+	for (gint i = 0; i < img->export_audio_sources->len; i++)
+	{
+		source = g_ptr_array_index(img->export_audio_sources, i);
+		source->start_sample = llround(source->media->start_time * sample_rate);
+		source->end_sample = llround((source->media->start_time + source->media->duration) * sample_rate);
+	}
+	return TRUE;
+}
 
-	if (is_transitioning)
+static void img_export_audio_free(img_window_struct *img)
+{
+	if (img->export_audio_sources)
 	{
-		current_media = g_array_index(current_media_array, media_timeline *, 0);
-		current_end_time = current_media->start_time + current_media->duration;	
-		transition_duration = 1.5;
-		img->transition_progress = 1.0 - ((current_end_time - img->current_timeline_index) / transition_duration);
-		
-		next_time = current_end_time + 0.01;
-		next_media_array = img_timeline_get_active_picture_media(img->timeline, next_time);
-		
-		if (next_media_array)
-		{
-			for (gint i = 0; i < next_media_array->len; i++)
-			{
-				media = g_array_index(next_media_array, media_timeline *, i);
-				pix = gdk_pixbuf_new_from_file_at_scale(img_get_media_filename(img, media->id), 1, 1, TRUE, NULL);
-				if (pix)
-				{
-					max_width = MAX(max_width, gdk_pixbuf_get_width(pix));
-					max_height = MAX(max_height, gdk_pixbuf_get_height(pix));
-					g_object_unref(pix);
-				}
-			}
-		}
+		g_ptr_array_free(img->export_audio_sources, TRUE);
+		img->export_audio_sources = NULL;
 	}
+	avcodec_free_context(&img->audio_codec_context);
+	av_frame_free(&img->audio_frame);
+	av_packet_free(&img->audio_packet);
+	swr_free(&img->swr_ctx);
+	g_free(img->export_audio_mix);
+	g_free(img->export_audio_buffer);
+	img->export_audio_mix = NULL;
+	img->export_audio_buffer = NULL;
+	img->audio_stream = NULL;
+}
 
-	// Create main composite surface first - using export dimensions
-	composite_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, export_width, export_height);
-		
-	// Compose current media items
-	cr = cairo_create(composite_surface);
+/* Encodes the audio up to the given time */
+static gint img_export_encode_audio(img_window_struct *img, gdouble time)
+{
+	gint64 last_sample;
+	gint ret;
 
-	// Fill the background colour with the user chosen color
-	cairo_set_source_rgb(cr, img->background_color[0], img->background_color[1], img->background_color[2]);
-	cairo_paint(cr);
+	if (img->audio_codec_context == NULL)
+		return 0;
 
-	for (gint i = current_media_array->len - 1; i >= 0; i--)
+	last_sample = llround(time * img->audio_codec_context->sample_rate);
+	while (img->export_audio_next_pts < last_sample)
 	{
-		media = g_array_index(current_media_array, media_timeline *, i);
-		pix = gdk_pixbuf_new_from_file(img_get_media_filename(img, media->id), NULL);
-		if (pix)
-		{
-			surface = gdk_cairo_surface_create_from_pixbuf(pix, 0, NULL);
-			if (surface)
-			{
-				// Center the image on the export surface
-				gint x = (export_width - cairo_image_surface_get_width(surface)) / 2;
-				gint y = (export_height - cairo_image_surface_get_height(surface)) / 2;
-				cairo_set_source_surface(cr, surface, x, y);
-				cairo_paint(cr);
-				cairo_surface_destroy(surface);
-			}
-			g_object_unref(pix);
-		}
+		ret = img_export_encode_audio_frame(img);
+		if (ret < 0)
+			return ret;
 	}
-	cairo_destroy(cr);
+	return 0;
+}
 
-	if (is_transitioning && next_media_array && next_media_array->len > 0)
+/* Mixes the sources playing during the next audio frame and encodes it */
+static gint img_export_encode_audio_frame(img_window_struct *img)
+{
+	ImgExportAudioSource *source;
+	gint64 pos = img->export_audio_next_pts;
+	gint nb_samples = img->audio_frame->nb_samples;
+	gint offset, count, ret;
+	gfloat *mix = img->export_audio_mix;
+	gfloat volume;
+
+	memset(mix, 0, nb_samples * 2 * sizeof(gfloat));
+	for (gint i = 0; i < img->export_audio_sources->len; i++)
 	{
-		next_composite = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, export_width, export_height);
-		cr = cairo_create(next_composite);
-
-		// Fill the background colour with the user chosen color
-		cairo_set_source_rgb(cr, img->background_color[0], img->background_color[1], img->background_color[2]);
-		cairo_paint(cr);
-
-		for (gint i = next_media_array->len - 1; i >= 0; i--)
+		source = g_ptr_array_index(img->export_audio_sources, i);
+		if (source->end_sample <= pos)
 		{
-			media = g_array_index(next_media_array, media_timeline *, i);
-			pix = gdk_pixbuf_new_from_file(img_get_media_filename(img, media->id), NULL);
-			if (pix)
-			{
-				surface = gdk_cairo_surface_create_from_pixbuf(pix, 0, NULL);
-				if (surface)
-				{
-					// Center the image on the export surface
-					gint x = (export_width - cairo_image_surface_get_width(surface)) / 2;
-					gint y = (export_height - cairo_image_surface_get_height(surface)) / 2;
-					cairo_set_source_surface(cr, surface, x, y);
-					cairo_paint(cr);
-					cairo_surface_destroy(surface);
-				}
-				g_object_unref(pix);
-			}
+			// Its item is over, keep memory bounded
+			if (source->is_open)
+				img_export_audio_source_close_streams(source);
+			continue;
 		}
-		cairo_destroy(cr);
+		if (source->start_sample >= pos + nb_samples)
+			continue;
+		if (! source->is_open && (source->eof || ! img_export_audio_source_open(img, source)))
+			continue;
 
-		// Apply transition effect
-		cr = cairo_create(composite_surface);
-		current_media->render(cr, composite_surface, next_composite, img->transition_progress);
-		cairo_destroy(cr);
-		cairo_surface_destroy(next_composite);
+		offset = MAX(source->start_sample - pos, 0);
+		count = MIN(pos + nb_samples, source->end_sample) - (pos + offset);
+		img_export_audio_source_fill(source, count);
+		count = av_audio_fifo_read(source->fifo, (void **) &img->export_audio_buffer, count);
+
+		volume = source->media->volume;
+		for (gint j = 0; j < count * 2; j++)
+			mix[offset * 2 + j] += img->export_audio_buffer[j] * volume;
 	}
-	else
+	for (gint j = 0; j < nb_samples * 2; j++)
+		mix[j] = CLAMP(mix[j], -1.0f, 1.0f);
+
+	ret = av_frame_make_writable(img->audio_frame);
+	if (ret < 0)
+		return ret;
+
+	ret = swr_convert(img->swr_ctx, img->audio_frame->data, nb_samples, (const uint8_t **) &mix, nb_samples);
+	if (ret < 0)
+		return ret;
+
+	img->audio_frame->pts = pos;
+	img->export_audio_next_pts += nb_samples;
+
+	return img_export_encode_av_frame(img->audio_frame, img->video_format_context, img->audio_codec_context, img->audio_packet, img->audio_stream);
+}
+
+/* Opens the audio file of the source and the resampler converting it to
+ * the export format. A file that can't be read is left out of the mix */
+static gboolean img_export_audio_source_open(img_window_struct *img, ImgExportAudioSource *source)
+{
+	const AVCodec *codec;
+	const gchar *filename;
+	AVCodecContext *ctx = img->audio_codec_context;
+
+	source->eof = TRUE;
+	filename = img_export_get_media_filename(img, source->media->id);
+	if (filename == NULL || avformat_open_input(&source->format_context, filename, NULL, NULL) != 0)
 	{
-		cr = cairo_create(composite_surface);
-		cairo_set_source_surface(cr, composite_surface, 0, 0);
-		cairo_paint(cr);
-		cairo_destroy(cr);
-		img->transition_progress = 0.0;
+		g_warning("Could not open file %s", filename);
+		return FALSE;
 	}
-	
-	if (next_media_array)
-		g_array_free(next_media_array, FALSE);
+	source->is_open = TRUE;
+	if (avformat_find_stream_info(source->format_context, NULL) < 0)
+		goto fail;
+
+	source->stream_index = av_find_best_stream(source->format_context, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
+	if (source->stream_index < 0)
+		goto fail;
+
+	source->decoder_context = avcodec_alloc_context3(codec);
+	if (source->decoder_context == NULL ||
+		avcodec_parameters_to_context(source->decoder_context, source->format_context->streams[source->stream_index]->codecpar) < 0 ||
+		avcodec_open2(source->decoder_context, codec, NULL) < 0)
+		goto fail;
+
+	if (swr_alloc_set_opts2(&source->swr_ctx, &ctx->ch_layout, AV_SAMPLE_FMT_FLT, ctx->sample_rate,
+											&source->decoder_context->ch_layout, source->decoder_context->sample_fmt,
+											source->decoder_context->sample_rate, 0, NULL) < 0 ||
+		swr_init(source->swr_ctx) < 0)
+		goto fail;
+
+	source->fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLT, 2, img->audio_frame->nb_samples);
+	source->packet = av_packet_alloc();
+	source->frame = av_frame_alloc();
+	if (source->fifo == NULL || source->packet == NULL || source->frame == NULL)
+		goto fail;
+
+	source->eof = FALSE;
+	return TRUE;
 
-	g_array_free(current_media_array, FALSE);
-	
-	// Draw to export surface
-	cr = cairo_create(img->exported_image);
-	cairo_set_source_surface(cr, composite_surface, 0, 0); 
-	cairo_paint(cr);
-	cairo_destroy(cr);
-	
-	cairo_surface_destroy(composite_surface);
+fail:
+	g_warning("Could not decode the audio of %s", filename);
+	img_export_audio_source_close_streams(source);
+	return FALSE;
+}
 
-	//Convert the cairo surface to AVframe and send it to the encoder
-	img->export_slide++;
-	gboolean ok = img_convert_cairo_frame_to_avframe(img, img->exported_image);
-	
-	if (img->current_timeline_index >= img->total_time)
+/* Frees the decoding state of the source, its item is done */
+static void img_export_audio_source_close_streams(ImgExportAudioSource *source)
+{
+	avformat_close_input(&source->format_context);
+	avcodec_free_context(&source->decoder_context);
+	swr_free(&source->swr_ctx);
+	if (source->fifo)
 	{
-		g_source_remove(img->source_id);
-		img->source_id = 0;
-		img_post_export(img);
-		return G_SOURCE_REMOVE;
+		av_audio_fifo_free(source->fifo);
+		source->fifo = NULL;
 	}
-
-	img->current_timeline_index += 1.0;
-	g_print("\r%d - %d", (int)img->current_timeline_index, (int)img->total_time);
-	return G_SOURCE_CONTINUE;
+	av_packet_free(&source->packet);
+	av_frame_free(&source->frame);
+	source->is_open = FALSE;
+	source->eof = TRUE;
 }
 
-gboolean on_close_export_dialog(GtkWidget * widget, GdkEvent * event,  img_window_struct *img)
+static void img_export_audio_source_close(ImgExportAudioSource *source)
 {
-    img_close_export_dialog(img);
-    return TRUE;
+	img_export_audio_source_close_streams(source);
+	g_free(source);
 }
 
-/* If the export wasn't aborted by user display the close button
- * and wait for the user to click it to close the dialog. This
- * way the elapsed time is still shown until the dialog is closed */
-void img_post_export(img_window_struct *img)
+/* Decodes until the fifo holds the given number of samples or the
+ * file ends. Only what the next audio frame needs is kept around */
+static void img_export_audio_source_fill(ImgExportAudioSource *source, gint nb_samples)
 {
-	/* Flush remaining packets out of video by sending a NULL frame */
-	img_export_encode_av_frame(NULL, img->video_format_context, img->codec_context, img->video_packet, img->video_stream);
-	av_write_trailer(img->video_format_context);
-	
-	/* Free all the allocated resources */
-	img_stop_export(img);
-	
-	gtk_widget_hide(img->export_pause_button);
-	gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR( img->export_pbar1 ), 1);
-	gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR( img->export_pbar2 ), 1);
-	gtk_button_set_label(GTK_BUTTON(img->export_cancel_button), _("Close"));
-	g_signal_connect_swapped (img->export_cancel_button, "clicked", G_CALLBACK (gtk_widget_destroy), img->export_dialog);
+	uint8_t *buffer;
+	gint ret, count;
+
+	while (! source->eof && av_audio_fifo_size(source->fifo) < nb_samples)
+	{
+		ret = av_read_frame(source->format_context, source->packet);
+		if (ret < 0)
+		{
+			// Drain the decoder and the resampler
+			avcodec_send_packet(source->decoder_context, NULL);
+			source->eof = TRUE;
+		}
+		else if (source->packet->stream_index != source->stream_index)
+		{
+			av_packet_unref(source->packet);
+			continue;
+		}
+		else
+		{
+			ret = avcodec_send_packet(source->decoder_context, source->packet);
+			av_packet_unref(source->packet);
+			if (ret < 0)
+				continue;
+		}
+		while (avcodec_receive_frame(source->decoder_context, source->frame) >= 0)
+		{
+			count = swr_get_out_samples(source->swr_ctx, source->frame->nb_samples);
+			if (av_samples_alloc(&buffer, NULL, 2, count, AV_SAMPLE_FMT_FLT, 0) >= 0)
+			{
+				count = swr_convert(source->swr_ctx, &buffer, count, (const uint8_t **) source->frame->extended_data, source->frame->nb_samples);
+				if (count > 0)
+					av_audio_fifo_write(source->fifo, (void **) &buffer, count);
+				av_freep(&buffer);
+			}
+			av_frame_unref(source->frame);
+		}
+		if (source->eof)
+		{
+			count = swr_get_out_samples(source->swr_ctx, 0);
+			if (count > 0 && av_samples_alloc(&buffer, NULL, 2, count, AV_SAMPLE_FMT_FLT, 0) >= 0)
+			{
+				count = swr_convert(source->swr_ctx, &buffer, count, NULL, 0);
+				if (count > 0)
+					av_audio_fifo_write(source->fifo, (void **) &buffer, count);
+				av_freep(&buffer);
+			}
+		}
+	}
 }
 
 void img_close_export_dialog(img_window_struct *img)
@@ -326,14 +1514,31 @@ gboolean img_stop_export( img_window_struct *img )
 	/* Do any additional tasks */
 	if( img->export_is_running)
 	{
-		g_source_remove( img->source_id );
+		if (img->source_id)
+		{
+			g_source_remove( img->source_id );
+			img->source_id = 0;
+		}
 
 		/* Destroy images that were used */
 		//~ if (img->image1) cairo_surface_destroy( img->image1 );
 		//~ if (img->image2) cairo_surface_destroy( img->image2 );
 		//~ cairo_surface_destroy( img->image_from );
 		//~ cairo_surface_destroy( img->image_to );
-		cairo_surface_destroy( img->exported_image );
+
+		/* Stop the encoder thread, it returns as soon as it sees the flag */
+		if (img->export_thread)
+		{
+			g_mutex_lock(&img->export_mutex);
+			img->export_cancelled = TRUE;
+			g_cond_broadcast(&img->export_cond);
+			g_mutex_unlock(&img->export_mutex);
+
+			g_thread_join(img->export_thread);
+			img->export_thread = NULL;
+		}
+		img_export_stop_workers(img);
+		img_export_cache_destroy(img);
 
 		/* Stops the timer */
 		g_timer_destroy(img->elapsed_timer);
@@ -345,11 +1550,8 @@ gboolean img_stop_export( img_window_struct *img )
 	avcodec_close(img->codec_context);
     avcodec_free_context(&img->codec_context);
 
-	av_frame_free(&img->video_frame);
-	//av_frame_free(&img->audio_frame);
-	
 	av_packet_free(&img->video_packet);
-	//av_packet_unref(img->audio_packet);
+	img_export_audio_free(img);
 
 	/* Indicate that export is not running any more */
 	img->export_is_running = 0;
@@ -359,7 +1561,8 @@ gboolean img_stop_export( img_window_struct *img )
 	img->slideshow_filename = NULL;
 
 	/* Redraw preview area */
-	gtk_widget_queue_draw( img->image_area );
+	if (! img->headless)
+		gtk_widget_queue_draw( img->image_area );
 	return( FALSE );
 }
 
@@ -429,74 +1632,24 @@ static gboolean img_export_still( img_window_struct *img )
 
 static void img_export_pause_unpause( GtkToggleButton *button,  img_window_struct *img )
 {
-	if( gtk_toggle_button_get_active(button))
-	{
-		// Pause export
-		g_source_remove(img->source_id);
+	/* The encoder thread waits before taking the next frame,
+	 * the workers finish the frames they were given */
+	g_mutex_lock(&img->export_mutex);
+	img->export_paused = gtk_toggle_button_get_active(button);
+	g_cond_broadcast(&img->export_cond);
+	g_mutex_unlock(&img->export_mutex);
+
+	if (img->export_paused)
 		g_timer_stop(img->elapsed_timer);
-	}
 	else
-	{
-		img->source_id = g_idle_add(img->export_idle_func, img);
 		g_timer_continue(img->elapsed_timer);
-	}
-}
-
-static gboolean img_convert_cairo_frame_to_avframe(img_window_struct *img, cairo_surface_t *surface)
-{
-	static int pts = 0;
-	gint	width, height, stride, ret;
-	unsigned char  *pix;
-
-	/* Image info and pixel data */
-	width  = cairo_image_surface_get_width( surface );
-	height = cairo_image_surface_get_height( surface );
-	stride = cairo_image_surface_get_stride( surface );
-	pix    = cairo_image_surface_get_data( surface );
-	
-	// Set up conversion context
-	img->sws_ctx = sws_getContext(
-        img->video_size[0],
-        img->video_size[1],
-        AV_PIX_FMT_BGRA,
-        img->video_size[0],
-        img->video_size[1],
-        img->codec_context->pix_fmt,
-        SWS_BICUBIC,
-        NULL,
-        NULL,
-        NULL);
-	memcpy(img->video_frame->data[0], pix, width * height * 4);
-	
-	 // Allocate the output frame
-    AVFrame *out_frame = av_frame_alloc();
-    out_frame->format = img->codec_context->pix_fmt;
-    out_frame->width = width;
-    out_frame->height = height;
-    av_frame_get_buffer(out_frame, 0);
-	sws_scale(img->sws_ctx, (const uint8_t * const*)img->video_frame->data, img->video_frame->linesize, 0,
-				img->video_size[1], out_frame->data, out_frame->linesize);
-
-	out_frame->pts = pts;
-
-	ret = img_export_encode_av_frame(out_frame, img->video_format_context, img->codec_context, img->video_packet, img->video_stream);
-	if (ret < 0)
-	{
-		img_stop_export(img);
-		img_close_export_dialog(img);
-		img_message(img, av_err2str(ret));
-		return ret;
-	}
-    av_frame_free(&out_frame);
-	sws_freeContext(img->sws_ctx);
-	
-	pts++;
-	return ret;
 }
 
-gboolean img_export_encode_av_frame(AVFrame *frame, AVFormatContext *fmt, AVCodecContext *ctx, AVPacket *pkt, AVStream *stream)
+/* Sends the frame to the encoder, or flushes it when frame is NULL, and
+ * muxes the packets it gives back. Returns 0 or a negative AVERROR code */
+static gint img_export_encode_av_frame(AVFrame *frame, AVFormatContext *fmt, AVCodecContext *ctx, AVPacket *pkt, AVStream *stream)
 {
-	 gint ret;
+	gint ret;
 
     /* send the frame to the encoder */
     ret = avcodec_send_frame(ctx, frame);
@@ -509,28 +1662,30 @@ gboolean img_export_encode_av_frame(AVFrame *frame, AVFormatContext *fmt, AVCode
     while (ret >= 0)
     {
         ret = avcodec_receive_packet(ctx, pkt);
-        if (ret == AVERROR(EAGAIN))
-			return TRUE;
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			return 0;
         else if (ret < 0)
 		{
-			if (ret != AVERROR_EOF)
-				g_print("Error during encoding\n");
-
-			return FALSE;
+			g_print("Error during encoding\n");
+			return ret;
 		}
 		pkt->stream_index = stream->index;
 		av_packet_rescale_ts(pkt, ctx->time_base, stream->time_base);
 
-		av_interleaved_write_frame(fmt, pkt);
-		//av_write_frame(fmt, pkt);
+		ret = av_interleaved_write_frame(fmt, pkt);
 		av_packet_unref(pkt);
+		if (ret < 0)
+		{
+			g_print("Error writing a packet: %s\n", av_err2str(ret));
+			return ret;
+		}
     }
-    return TRUE;
+    return 0;
 }
 
 void img_show_export_dialog (GtkWidget *button, img_window_struct *img )
 {
-	gint			codec_id, ret, result, crf, slides_selected = 0;
+	gint			codec_id, audio_codec_id, ret, result, crf, slides_selected = 0;
 	GtkIconTheme *theme;
 	const gchar *filename;
 	GtkListStore	*liststore;
@@ -540,7 +1695,7 @@ void img_show_export_dialog (GtkWidget *button, img_window_struct *img )
 	GtkWidget	*iconview;
 	GtkWidget	*vbox, *range_menu, *export_grid, *sample_rate, *bitrate;
 	GtkWidget	*ex_vbox, *audio_frame, *video_frame, *label;
-	GtkWidget	*frame_rate, *slideshow_title_entry, *fill_filename;
+	GtkWidget	*frame_rate, *slideshow_title_entry, *fill_filename, *segments;
 	GtkTreeModel *model;
 	GtkListStore *store;
 	GtkCellRenderer *cell;
@@ -685,6 +1840,16 @@ void img_show_export_dialog (GtkWidget *button, img_window_struct *img )
 	g_signal_connect (slideshow_title_entry, "icon-press", G_CALLBACK (img_show_file_chooser), img);
 	gtk_grid_attach( GTK_GRID(export_grid), slideshow_title_entry, 1,5,1,1);
 
+	label = gtk_label_new( _("Parallel Parts:") );
+	gtk_label_set_xalign (GTK_LABEL(label), 0.0);
+	gtk_grid_attach( GTK_GRID(export_grid), label, 0,6,1,1);
+
+	segments = gtk_spin_button_new_with_range(1, g_get_num_processors(), 1);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(segments), 1);
+	gtk_widget_set_tooltip_text(segments, _("Number of parts of the video encoded at the same time.\n"
+	"More than one speeds up slow encoders on machines with many cores."));
+	gtk_grid_attach( GTK_GRID(export_grid), segments, 1,6,1,1);
+
 	/* Define the popup error message */
 	img->file_po = gtk_popover_new(slideshow_title_entry);
 	fill_filename = gtk_label_new(_("\n Please fill this field \n"));
@@ -795,16 +1960,24 @@ void img_show_export_dialog (GtkWidget *button, img_window_struct *img )
 	}
 	img->export_fps = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(frame_rate));
 	crf = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(img->video_quality));
+	img->export_segments = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(segments));
 
 	model = gtk_combo_box_get_model(GTK_COMBO_BOX(img->vcodec_menu));
 	gtk_combo_box_get_active_iter(GTK_COMBO_BOX(img->vcodec_menu), &iter);
 	gtk_tree_model_get( model, &iter, 1, &codec_id, -1);
 
+	audio_codec_id = AV_CODEC_ID_NONE;
+	model = gtk_combo_box_get_model(GTK_COMBO_BOX(img->acodec_menu));
+	if (gtk_combo_box_get_active_iter(GTK_COMBO_BOX(img->acodec_menu), &iter))
+		gtk_tree_model_get( model, &iter, 1, &audio_codec_id, -1);
+	img->sample_rate = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(sample_rate));
+	img->bitrate = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(bitrate));
+
 	result = gtk_combo_box_get_active(GTK_COMBO_BOX(range_menu));
 
 	gtk_widget_destroy( dialog );
 	
-	ret = img_initialize_av_parameters(img, img->export_fps, crf, codec_id);
+	ret = img_initialize_av_parameters(img, img->export_fps, crf, codec_id, audio_codec_id);
 
 	if ( ret < 0)
 	{
@@ -959,10 +2132,69 @@ void img_swap_bitrate_for_quality(img_window_struct *img)
 	"17-28 = visually lossless (still compressed but unnoticeable)\n23 = high quality\n51 = worst quality possible"));
 }
 
+/* Sets the parameters of a video encoding context from the export
+ * settings. The parts of a parallel export get the same ones with a
+ * closed GOP and no B frames, so that they can be put one after the
+ * other without decoding them */
+static void img_export_setup_video_encoder(img_window_struct *img, AVCodecContext *ctx, enum AVCodecID codec_id,
+												gint frame_rate, gint bitrate_crf)
+{
+	ctx->codec_id = codec_id;
+	ctx->codec_type = AVMEDIA_TYPE_VIDEO;
+	ctx->width  = img->video_size[0];
+	ctx->height = img->video_size[1];
+	ctx->sample_aspect_ratio = (struct AVRational) {1, 1};
+	
+	switch (codec_id)
+	{
+		case AV_CODEC_ID_QTRLE:
+		ctx->pix_fmt = AV_PIX_FMT_RGB24;
+		break;
+		
+		case AV_CODEC_ID_MJPEG:
+		ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+		break;
+		
+		case AV_CODEC_ID_PRORES:
+		ctx->pix_fmt = AV_PIX_FMT_YUV422P10LE;
+		break;
+		
+		default:
+		ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	}
+	
+	ctx->framerate = av_d2q(frame_rate, INT_MAX);
+
+	if (codec_id == AV_CODEC_ID_VP8 || codec_id == AV_CODEC_ID_VP9 || codec_id == AV_CODEC_ID_THEORA || 
+		AV_CODEC_ID_MPEG1VIDEO || codec_id == AV_CODEC_ID_MPEG2VIDEO)
+		ctx->bit_rate = round(bitrate_crf * 1000000);
+
+	ctx->time_base = av_inv_q(ctx->framerate);
+
+	if (img->video_format_context->oformat->flags & AVFMT_GLOBALHEADER)
+		ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	/* Some codecs require the CRF value */
+	if (codec_id == AV_CODEC_ID_H264 || codec_id == AV_CODEC_ID_H265)
+	{
+		gchar *crf = g_strdup_printf("%i", bitrate_crf);
+		av_opt_set(ctx->priv_data, "crf", crf, AV_OPT_SEARCH_CHILDREN);
+		g_free(crf);
+	}
+
+	if (img->export_segments > 1)
+	{
+		ctx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+		ctx->max_b_frames = 0;
+		ctx->thread_count = MAX(1, g_get_num_processors() / img->export_segments);
+	}
+}
+
 static gint img_initialize_av_parameters(	img_window_struct *img,
 												gint frame_rate,
 												gint bitrate_crf,
-												enum AVCodecID codec_id)
+												enum AVCodecID codec_id,
+												enum AVCodecID audio_codec_id)
 {
 	const AVCodec* vcodec;
     gint ret;
@@ -1011,53 +2243,15 @@ static gint img_initialize_av_parameters(	img_window_struct *img,
 		img_message(img, _("Couldn't allocate video enconding context\n"));
 		return FALSE;
 	}
-	/* Setup video enconding context parameters */
-	img->codec_context->codec_id = codec_id;
-	img->codec_context->codec_type = AVMEDIA_TYPE_VIDEO;
-	img->codec_context->width  = img->video_size[0];
-	img->codec_context->height = img->video_size[1];
-	img->codec_context->sample_aspect_ratio = (struct AVRational) {1, 1};
-	
-	switch (codec_id)
-	{
-		case AV_CODEC_ID_QTRLE:
-		img->codec_context->pix_fmt = AV_PIX_FMT_RGB24;
-		break;
-		
-		case AV_CODEC_ID_MJPEG:
-		img->codec_context->pix_fmt = AV_PIX_FMT_YUVJ420P;
-		break;
-		
-		case AV_CODEC_ID_PRORES:
-		img->codec_context->pix_fmt = AV_PIX_FMT_YUV422P10LE;
-		break;
-		
-		default:
-		img->codec_context->pix_fmt = AV_PIX_FMT_YUV420P;
-	}
-	
-	img->codec_context->framerate = av_d2q(frame_rate, INT_MAX);
-
-	if (codec_id == AV_CODEC_ID_VP8 || codec_id == AV_CODEC_ID_VP9 || codec_id == AV_CODEC_ID_THEORA || 
-		AV_CODEC_ID_MPEG1VIDEO || codec_id == AV_CODEC_ID_MPEG2VIDEO)
-		img->codec_context->bit_rate = round(bitrate_crf * 1000000);
-
-	img->codec_context->time_base = av_inv_q(img->codec_context->framerate);
+	img->export_bitrate_crf = bitrate_crf;
+	img_export_setup_video_encoder(img, img->codec_context, codec_id, frame_rate, bitrate_crf);
 	img->video_stream->time_base = img->codec_context->time_base;
 
-	if (img->video_format_context->oformat->flags & AVFMT_GLOBALHEADER)
-		img->codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-
-	/* Some codecs require the CRF value */
-	if (codec_id == AV_CODEC_ID_H264 || codec_id == AV_CODEC_ID_H265)
-	{
-		gchar *crf = g_strdup_printf("%i", bitrate_crf);
-		av_opt_set(img->codec_context->priv_data, "crf", crf, AV_OPT_SEARCH_CHILDREN);
-		g_free(crf);
-	}
-	/* Set exporting stage to be multithreaded */
+	/* Set exporting stage to be multithreaded, the threads
+	 * are shared between the encoders of a parallel export */
 	AVDictionary* opts = NULL;
-	av_dict_set(&opts, "threads", "auto", 0);
+	if (img->export_segments <= 1)
+		av_dict_set(&opts, "threads", "auto", 0);
 
 	/* Open video encoder */
 	ret = avcodec_open2(img->codec_context, vcodec, &opts);
@@ -1076,28 +2270,19 @@ static gint img_initialize_av_parameters(	img_window_struct *img,
 
 	/* AVFRAME stuff */
 	img->video_packet = av_packet_alloc();
-	img->video_frame = av_frame_alloc();
-	av_frame_make_writable(img->video_frame);
-	img->video_frame->format = AV_PIX_FMT_BGRA;
-	img->video_frame->width  = img->video_size[0];
-	img->video_frame->height = img->video_size[1];
-	
-	ret = av_frame_get_buffer(img->video_frame, 0);
+
+	/*						*/
+	/* SETUP AUDIO
+	 * 						*/
+	ret = img_export_audio_setup(img, audio_codec_id);
 	if (ret < 0)
-	{	
-		img_message(img, _("Could not allocate the video frame data\n"));
-		return FALSE;
-	}
-	if ( (ret = av_frame_make_writable(img->video_frame)) < 0)
 	{
 		img_message(img, av_err2str(ret));
-		return FALSE;
+		return ret;
 	}
+	if (ret == FALSE)
+		return FALSE;
 
-	/*						*/
-	/* SETUP AUDIO
-	 * 						*/
-	
 	/* Write Imagination header in the metadata */
 	opts =  NULL;
 	av_dict_set(&opts, "movflags", "use_metadata_tags", 0);
@@ -1114,3 +2299,140 @@ static gint img_initialize_av_parameters(	img_window_struct *img,
 static cairo_surface_t *img_get_next_composed_media(img_window_struct *img)
 {
 }
+
+static void img_export_print_usage(void)
+{
+	g_printerr(_("Usage: imagination --export <project file> --output <video file> [--codec <encoder>] [--fps <frame rate>] [--crf <quality>] [--cache-size <MB>] [--queue-depth <frames>] [--segments <parts>]\n"));
+}
+
+/* Exports the project given with --export without creating any widget.
+ * The encoder is guessed from the output filename extension if it's not
+ * given with --codec. Returns the exit status of the program */
+gint img_export_from_command_line(gint argc, gchar **argv)
+{
+	img_window_struct *img;
+	const AVCodec *vcodec;
+	const AVOutputFormat *oformat;
+	enum AVCodecID codec_id;
+	const gchar *project = NULL, *output = NULL, *codec_name = NULL;
+	gint fps = 25, crf = -1, cache_size = IMG_EXPORT_CACHE_SIZE, queue_depth = IMG_EXPORT_QUEUE_DEPTH, segments = 1, ret;
+	gdouble elapsed;
+
+	for (gint i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+			project = argv[++i];
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc)
+			codec_name = argv[++i];
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+			fps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--crf") == 0 && i + 1 < argc)
+			crf = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+			cache_size = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--queue-depth") == 0 && i + 1 < argc)
+			queue_depth = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--segments") == 0 && i + 1 < argc)
+			segments = atoi(argv[++i]);
+		else
+		{
+			img_export_print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (project == NULL || output == NULL || fps <= 0 || cache_size < 0 || queue_depth <= 0 || segments <= 0)
+	{
+		img_export_print_usage();
+		return EXIT_FAILURE;
+	}
+
+	if (codec_name)
+	{
+		vcodec = avcodec_find_encoder_by_name(codec_name);
+		if (vcodec == NULL)
+		{
+			g_printerr(_("Couldn't find the encoder %s\n"), codec_name);
+			return EXIT_FAILURE;
+		}
+		codec_id = vcodec->id;
+	}
+	else
+	{
+		oformat = av_guess_format(NULL, output, NULL);
+		if (oformat == NULL || oformat->video_codec == AV_CODEC_ID_NONE)
+		{
+			g_printerr(_("Failed to find a suitable container for %s\n"), output);
+			return EXIT_FAILURE;
+		}
+		codec_id = oformat->video_codec;
+	}
+	if (crf < 0)
+		crf = (codec_id == AV_CODEC_ID_H264 || codec_id == AV_CODEC_ID_H265) ? 20 : 12;
+
+	img = g_new0(img_window_struct, 1);
+	img->headless = TRUE;
+	if (! img_load_project_headless(img, project))
+	{
+		g_free(img);
+		return EXIT_FAILURE;
+	}
+
+	img->export_fps = fps;
+	img->export_cache_max_size = (gsize) cache_size << 20;
+	img->export_queue_depth = queue_depth;
+	img->export_segments = segments;
+	img->slideshow_filename = g_strdup(output);
+	img->sample_rate = 44100;
+	img->bitrate = 192;
+	if (img_initialize_av_parameters(img, img->export_fps, crf, codec_id, AV_CODEC_ID_NONE) != TRUE)
+	{
+		img_stop_export(img);
+		img_free_headless_project(img);
+		g_free(img);
+		return EXIT_FAILURE;
+	}
+
+	img->export_is_running = 1;
+	img->total_nr_frames = img->total_time * img->export_fps;
+	img->elapsed_timer = g_timer_new();
+	if (! img_export_start_workers(img))
+	{
+		g_printerr(_("Could not allocate the video frame data\n"));
+		img_stop_export(img);
+		img_free_headless_project(img);
+		g_free(img);
+		return EXIT_FAILURE;
+	}
+
+	if (img->export_segments > 1)
+		ret = img_export_encode_parts(img);
+	else
+	{
+		while ((ret = img_export_next_frame(img)) > 0)
+			img_export_print_progress(img);
+	}
+
+	if (ret == 0)
+		ret = img_export_write_trailer(img);
+
+	elapsed = g_timer_elapsed(img->elapsed_timer, NULL);
+	if (ret < 0)
+	{
+		g_printerr("\n%s\n", av_err2str(ret));
+		img_stop_export(img);
+	}
+	else
+	{
+		img_stop_export(img);
+		g_print(_("\nExported %u frames in %.2f seconds (%.2f frames per second)\n"),
+					img->export_slide, elapsed, elapsed > 0 ? img->export_slide / elapsed : 0.0);
+	}
+
+	img_free_headless_project(img);
+	g_slist_free_full(img->plugin_list, (GDestroyNotify) g_module_close);
+	g_free(img);
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -23,6 +23,15 @@
 #include "imagination.h"
 #include <libavcodec/avcodec.h>
 #include <libavutil/opt.h>
+#include <libavutil/audio_fifo.h>
+#include <libswresample/swresample.h>
+
+/* Default memory cap in MB of the decoded media kept during the export */
+#define IMG_EXPORT_CACHE_SIZE 256
+
+/* Default number of frames rendered at the same time by the export
+ * threads. Each of them takes about 10 bytes per pixel of the video */
+#define IMG_EXPORT_QUEUE_DEPTH 8
 
 gboolean img_export_transition( img_window_struct *img );
 
@@ -59,6 +68,9 @@ img_render_still_frame( img_window_struct *img,
 void
 img_show_export_dialog(GtkWidget *button, img_window_struct *img);
 
+gint
+img_export_from_command_line(gint argc, gchar **argv);
+
 void
 img_container_changed (GtkComboBox *combo, img_window_struct *);
 
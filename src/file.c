@@ -231,6 +231,10 @@ void img_load_project( img_window_struct *img, GtkWidget *menuitem, const gchar
 	const gchar 			*content_type;
 	GString 					*media_not_found = NULL;
 	GtkAllocation			allocation;
+	GPtrArray				*thumbnail_paths;
+	GArray					*thumbnail_rows;
+	GdkPixbuf				**thumbnails;
+	gint64					load_start = g_get_monotonic_time();
 	
 	if (img->media_nr > 0)
 		img_close_project(NULL, img);
@@ -320,7 +324,9 @@ void img_load_project( img_window_struct *img, GtkWidget *menuitem, const gchar
 	track_nr =	g_key_file_get_integer( img_key_file, "project settings",  "number of tracks", NULL);
 	
     //groups = g_key_file_get_groups(img_key_file, &length);
-    
+    thumbnail_paths = g_ptr_array_new();
+    thumbnail_rows = g_array_new(FALSE, FALSE, sizeof(GtkTreeIter));
+
 	for( gint i = 1; i <= number ; i++ )
 	{
 		conf = g_strdup_printf("media %d", i);
@@ -348,10 +354,8 @@ void img_load_project( img_window_struct *img, GtkWidget *menuitem, const gchar
 			}
 		}
 		/* Create the media structure */
-		media = g_new0(media_struct, 1);
-		media->id = media_id;
-		media->media_type = media_type;
-		media->full_path = g_strdup(media_filename);
+		media = img_media_new(media_id, media_type, media_filename);
+		img_media_registry_add(img->media_registry, media);
 		g_free(media_filename);
 		img->media_nr++;
 		switch (media->media_type)
@@ -360,8 +364,21 @@ void img_load_project( img_window_struct *img, GtkWidget *menuitem, const gchar
 			case 0:
 				media->width 			= g_key_file_get_integer( img_key_file, conf, "width", NULL );
 				media->height 			= g_key_file_get_integer( img_key_file, conf, "height", NULL );
-				media->image_type 	= g_key_file_get_string( img_key_file, conf, "image_type", NULL );
-				img_add_media(media->full_path, media, img);
+				dummy 					= g_key_file_get_string( img_key_file, conf, "image_type", NULL );
+				media->image_type 	= img_media_intern_type(dummy);
+				g_free(dummy);
+				// The thumbnails of the pictures are all looked up at once below
+				if (media->width > 0 && media->image_type)
+				{
+					dummy = g_path_get_basename(media->full_path);
+					gtk_list_store_insert_with_values(img->media_model, &iter, -1, 1, dummy, 2, media, -1);
+					g_free(dummy);
+					g_array_append_val(thumbnail_rows, iter);
+					g_ptr_array_add(thumbnail_paths, media->full_path);
+					img->current_media = media;
+				}
+				else
+					img_add_media(media->full_path, media, img);
 			break;
 			
 			//Media audio
@@ -400,6 +417,19 @@ void img_load_project( img_window_struct *img, GtkWidget *menuitem, const gchar
 		g_free(conf);
 	}
 	img->next_id = ++number;
+
+	thumbnails = g_new0(GdkPixbuf *, thumbnail_paths->len);
+	img_thumbnail_get_batch((gchar **) thumbnail_paths->pdata, thumbnail_paths->len, 120, 60, thumbnails);
+	for (guint i = 0; i < thumbnail_paths->len; i++)
+	{
+		if (thumbnails[i] == NULL)
+			continue;
+		gtk_list_store_set(img->media_model, &g_array_index(thumbnail_rows, GtkTreeIter, i), 0, thumbnails[i], -1);
+		g_object_unref(thumbnails[i]);
+	}
+	g_free(thumbnails);
+	g_ptr_array_free(thumbnail_paths, TRUE);
+	g_array_free(thumbnail_rows, TRUE);
 	
 	// If some media were not found display an error dialog
 	if (media_not_found->len > 0)
@@ -444,6 +474,7 @@ void img_load_project( img_window_struct *img, GtkWidget *menuitem, const gchar
 			item->id 				=	g_ascii_strtoll(values[q+0], NULL, 10);
 			item->start_time 	=	g_ascii_strtod(values[q+1], NULL);
 			item->duration 		=	g_ascii_strtod(values[q+2], NULL);
+			item->volume			=	1.0;
 			if (track->type == 0)
 			{
 				item->transition_id=	g_ascii_strtoll(values[q+3], NULL, 10);
@@ -467,7 +498,6 @@ void img_load_project( img_window_struct *img, GtkWidget *menuitem, const gchar
 				gtk_tree_model_get(model, &iter, 2, &render, 0, &pix, -1);
 				item->render = render;
 				item->tree_path = g_strdup(spath);
-				img_create_cached_cairo_surface(img, item, media_filename);
 
 				if(gtk_tree_model_iter_parent(model, &parent_iter, &iter))
 				{
@@ -478,34 +508,27 @@ void img_load_project( img_window_struct *img, GtkWidget *menuitem, const gchar
 			}
 			g_free(conf2);
 
+			// The surface of a picture and the samples of an audio are read by img_assets_load()
+			item->is_loading = (media_type == 0 || media_type == 1);
 			img_timeline_create_toggle_button(item, media_type, media_filename, img);
 			g_free(media_filename);
 				
 			//Position the toggle button in the timeline
 			width = item->duration * BASE_SCALE * priv->zoom_scale;
-			gtk_widget_set_size_request(item->button, width, 50);
 			posx = item->start_time * BASE_SCALE *priv->zoom_scale;
-			gtk_layout_move(GTK_LAYOUT(img->timeline), item->button, posx, posy);
+			if (item->button)
+			{
+				gtk_widget_set_size_request(item->button, width, 50);
+				gtk_layout_move(GTK_LAYOUT(img->timeline), item->button, posx, posy);
+			}
 			item->old_x = posx;
 			item->timeline_y = posy;
 			item->is_positioned = TRUE;
 			item->last_allocation_width = allocation.width;
 			item->last_allocation_height = allocation.height;
 
-			// Apply image filter
-			img_apply_filter_on_surface(img, item, item->color_filter);
-
-			// Apply rotations
-			for (int r =0; r < item->nr_rotations; r++)
-				img_rotate_surface(img, item, FALSE);
-			
-			// Apply flipping
-			if (item->flipped_horizontally)
-				img_flip_surface_horizontally(img, item);				
-			if (item->flipped_vertically)
-				img_flip_surface_vertically(img, item);
-
 			g_array_append_val(track->items, item);
+			img_track_invalidate_index(track);
 			
 			// Make the first picture media the current one
 			if (q == 0 && i == 0)
@@ -536,9 +559,195 @@ next:
 	img->project_current_dir = project_current_dir;
 	img_refresh_window_title(img);
 	
+	img_image_area_invalidate_cache(img);
 	gtk_widget_queue_draw(img->image_area);
 
 	gint unused = img_timeline_get_final_time(img);
+
+	img_assets_load(img, load_start);
+}
+
+/* Load the project without creating any widget. The tracks are stored
+ * in img->headless_tracks and the media in img->media_registry so that
+ * the export code can render the slideshow from the command line */
+gboolean img_load_project_headless( img_window_struct *img, const gchar *input )
+{
+	GKeyFile 			*img_key_file;
+	GHashTable 		*renderers;
+	Track				*track;
+	media_struct 	*media;
+	media_timeline	*item;
+	gchar 				*dummy, *conf, *media_filename, *value_string;
+	gchar				**values;
+	gdouble			*color, end_time;
+	gint					number, track_nr, step, count;
+
+	img_key_file = g_key_file_new();
+	if (! g_key_file_load_from_file( img_key_file, input, G_KEY_FILE_KEEP_COMMENTS, NULL ))
+	{
+		g_printerr(_("Error: couldn't read the project file %s\n"), input);
+		g_key_file_free(img_key_file);
+		return FALSE;
+	}
+	dummy = g_key_file_get_comment( img_key_file, NULL, NULL, NULL);
+	if (dummy == NULL)
+	{
+		g_printerr(_("%s is not an Imagination project file!\n"), input);
+		g_key_file_free(img_key_file);
+		return FALSE;
+	}
+	g_free( dummy );
+
+	img->project_filename = g_strdup(input);
+	img->project_current_dir = g_path_get_dirname(input);
+
+	/* Video Size */
+	img->video_size[0] = g_key_file_get_integer(img_key_file, "project settings", "video width", NULL);
+	img->video_size[1] = g_key_file_get_integer(img_key_file, "project settings", "video height", NULL);
+	if (img->video_size[0] == 0)
+		img->video_size[0] = 1280;
+
+	if (img->video_size[1] == 0)
+		img->video_size[1] = 720;
+
+	img->video_ratio = (gdouble)img->video_size[0] / img->video_size[1];
+
+	color = g_key_file_get_double_list( img_key_file, "project settings",	"background color", NULL, NULL );
+	if (color)
+	{
+		img->background_color[0] = color[0];
+		img->background_color[1] = color[1];
+		img->background_color[2] = color[2];
+		g_free( color );
+	}
+
+	/* Media, indexed by their id */
+	img->media_registry = img_media_registry_new();
+	number = 	g_key_file_get_integer( img_key_file, "project settings",  "number of media", NULL);
+	track_nr =	g_key_file_get_integer( img_key_file, "project settings",  "number of tracks", NULL);
+
+	for( gint i = 1; i <= number ; i++ )
+	{
+		conf = g_strdup_printf("media %d", i);
+		if ( ! g_key_file_has_group(img_key_file, conf))
+		{
+			number++;
+			g_free(conf);
+			continue;
+		}
+		media_filename = g_key_file_get_string(img_key_file, conf, "filename", NULL);
+		if (media_filename == NULL)
+		{
+			g_free(conf);
+			continue;
+		}
+		/* Relative filenames are saved relative to the project file */
+		if (! g_path_is_absolute(media_filename))
+		{
+			dummy = g_build_filename(img->project_current_dir, media_filename, NULL);
+			g_free(media_filename);
+			media_filename = dummy;
+		}
+		if ( ! g_file_test (media_filename, G_FILE_TEST_EXISTS))
+			g_printerr(_("Warning: media %d %s couldn't be found\n"), i, media_filename);
+
+		media = img_media_new(g_key_file_get_integer(img_key_file, conf, "id", NULL),
+										g_key_file_get_integer(img_key_file, conf, "media_type", NULL),
+										media_filename);
+		media->width = g_key_file_get_integer( img_key_file, conf, "width", NULL );
+		media->height = g_key_file_get_integer( img_key_file, conf, "height", NULL );
+		img_media_registry_add(img->media_registry, media);
+		g_free(media_filename);
+		img->media_nr++;
+		g_free(conf);
+	}
+
+	/* Tracks and the items placed on them */
+	renderers = img_get_transition_renderers(img);
+	img->headless_tracks = g_array_new(FALSE, TRUE, sizeof(Track *));
+	end_time = 0;
+	for (gint i = 0; i < track_nr; i++)
+	{
+		track = g_new0(Track, 1);
+		track->items = g_array_new(FALSE, TRUE, sizeof(media_timeline *));
+		track->order = i;
+
+		conf = g_strdup_printf("track %d",  i);
+		track->type = g_key_file_get_integer( img_key_file, conf, "track_type", NULL);
+		track->is_default = g_key_file_get_boolean( img_key_file, conf, "is_default", NULL);
+		g_array_append_val(img->headless_tracks, track);
+
+		value_string = g_key_file_get_string(img_key_file, conf, "media_sequence", NULL);
+		g_free(conf);
+		if (value_string == NULL)
+			continue;
+
+		values = g_strsplit(value_string, ";", -1);
+		count = g_strv_length(values);
+		step = (track->type == 0) ? 11 : 3;
+		for (gint q = 0; q < count - 2; q += step)
+		{
+			item = g_new0(media_timeline, 1);
+			item->id 				=	g_ascii_strtoll(values[q+0], NULL, 10);
+			item->start_time 	=	g_ascii_strtod(values[q+1], NULL);
+			item->duration 		=	g_ascii_strtod(values[q+2], NULL);
+			item->volume			=	1.0;
+			item->transition_id = -1;
+			if (track->type == 0)
+			{
+				item->transition_id=	g_ascii_strtoll(values[q+3], NULL, 10);
+				item->opacity		=	g_ascii_strtod(values[q+4], NULL);
+				item->x					=	g_ascii_strtod(values[q+5], NULL);
+				item->y					=	g_ascii_strtod(values[q+6], NULL);
+				item->color_filter	=	g_ascii_strtoll(values[q+7], NULL, 10);
+				item->nr_rotations	=	g_ascii_strtoll(values[q+8], NULL, 10);
+				item->flipped_horizontally	=	g_ascii_strtoll(values[q+9], NULL, 10);
+				item->flipped_vertically		=	g_ascii_strtoll(values[q+10], NULL, 10);
+				item->render = g_hash_table_lookup(renderers, GINT_TO_POINTER(item->transition_id));
+			}
+			media = img_media_registry_lookup(img->media_registry, item->id);
+			item->media_type = media ? media->media_type : track->type;
+			end_time = MAX(end_time, item->start_time + item->duration);
+			g_array_append_val(track->items, item);
+		}
+		g_strfreev(values);
+		g_free(value_string);
+	}
+	g_hash_table_destroy(renderers);
+	g_key_file_free(img_key_file);
+
+	img->total_time = ceil(end_time);
+	return TRUE;
+}
+
+void img_free_headless_project( img_window_struct *img )
+{
+	Track *track;
+
+	if (img->headless_tracks)
+	{
+		for (gint i = 0; i < img->headless_tracks->len; i++)
+		{
+			track = g_array_index(img->headless_tracks, Track *, i);
+			for (gint j = 0; j < track->items->len; j++)
+				g_free(g_array_index(track->items, media_timeline *, j));
+
+			g_array_free(track->items, TRUE);
+			img_track_free_index(track);
+			g_free(track);
+		}
+		g_array_free(img->headless_tracks, TRUE);
+		img->headless_tracks = NULL;
+	}
+	if (img->media_registry)
+	{
+		img_media_registry_free(img->media_registry);
+		img->media_registry = NULL;
+	}
+	g_free(img->project_filename);
+	img->project_filename = NULL;
+	g_free(img->project_current_dir);
+	img->project_current_dir = NULL;
 }
 
 static gboolean img_populate_hash_table( GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, GHashTable **table )
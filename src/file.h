@@ -26,7 +26,10 @@
 #include "imagination.h"
 #include "support.h"
 #include "callbacks.h"
+#include "assets.h"
 
 void img_save_project( img_window_struct *, const gchar *, gboolean);
 void img_load_project( img_window_struct *, GtkWidget *, const gchar * );
+gboolean img_load_project_headless( img_window_struct *, const gchar * );
+void img_free_headless_project( img_window_struct * );
 #endif
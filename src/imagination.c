@@ -37,13 +37,20 @@ int main (int argc, char *argv[])
   		textdomain (GETTEXT_PACKAGE);
 	#endif
 	
-	gtk_init (&argc, &argv);
-
 	#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58,9,100)
 		av_register_all();
 		avcodec_register_all();
 	#endif
 
+	/* Export the project without creating the main window */
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--export") == 0)
+			return img_export_from_command_line(argc, argv);
+	}
+
+	gtk_init (&argc, &argv);
+
 	// Check if the dark theme parameter is provided
 	gboolean dark_theme = FALSE;
 	for (int i = 0; i < argc; i++)
@@ -32,6 +32,10 @@
 
 typedef struct _media_timeline media_timeline;
 typedef struct _media_text media_text;
+typedef struct _ImgMediaRegistry ImgMediaRegistry;
+typedef struct _ImgImport ImgImport;
+typedef struct _ImgAssets ImgAssets;
+typedef struct _ImgSurfaceCache ImgSurfaceCache;
 
 /*
  * TextAnimationFunc:
@@ -111,12 +115,12 @@ struct _media_struct
 	gint			width;
 	gint			height;
 	gchar		*full_path;
-	gchar 		*image_type;
-	gchar 		*video_type;
-	gchar 		*audio_type;
+	const gchar	*image_type;				// Interned, see img_media_intern_type()
+	const gchar	*video_type;
+	const gchar	*audio_type;
 	gchar		*video_duration;
 	gchar		*audio_duration;
-	gchar		metadata[1024];
+	gchar		*metadata;					// Read on request by img_media_get_metadata()
     gboolean  to_be_deleted;
 	/* Fields that are filled if we create slide in memory */
 	gint  gradient;         			/* Gradient type */
@@ -178,11 +182,28 @@ struct _img_window_struct
 	GtkWidget	*timeline_scrolled_window;
   	GtkWidget	*media_option_popover;
   	GtkWidget	*image_area;
+	cairo_surface_t *image_area_below;		/* Background and media painted under the current item */
+	cairo_surface_t *image_area_above;		/* Media painted over the current item, NULL if none */
+	gboolean		image_area_cache_valid;
+	gint64			image_area_cache_frame;		/* What the two surfaces above were painted for */
+	media_timeline *image_area_cache_item;
+	gint				image_area_cache_width;
+	gint				image_area_cache_height;
+	guint			image_area_generation;		/* Incremented at each edit of the project */
+	media_timeline *image_area_generation_item;	/* Current item the generation was checked for */
+	GQueue			*scrub_cache;				/* Frames painted at each needle position, most recent first */
+	gsize			scrub_cache_size;			/* Memory used by the frames in the queue */
+	guint			scrub_cache_hits;
+	guint			scrub_cache_misses;
   	GtkListStore *media_model;
   	GtkTreeModelFilter *media_model_filter;
   	GtkWidget	*media_library_filter;
   	GtkWidget 	*media_iconview_swindow;
   	GtkWidget 	*media_iconview;
+  	GtkWidget	*import_progress;		/* Shown under the media library while importing */
+  	GtkWidget	*import_pbar;
+  	ImgImport	*import;					/* Media being imported, NULL if none */
+  	ImgAssets	*assets;					/* Timeline media of the project being read, NULL if none */
   	GtkTreeIter 	popup_iter;
   	GtkIconTheme *icon_theme;
   	gchar			*current_dir;
@@ -261,6 +282,7 @@ struct _img_window_struct
 	gdouble   	video_ratio;
     gdouble   	background_color[3];
   	gint				media_nr;
+  	ImgMediaRegistry	*media_registry;	// Owns the media_struct, indexed by id and by path
 
 	/* Variables common to export and preview functions */
 	GtkWidget		*container_menu;	/* Container combo box in the export dialog */
@@ -269,7 +291,7 @@ struct _img_window_struct
 	GtkWidget		*video_quality;		/* Combo box to store the quality CRF when enconding */
 	GtkWidget		*quality_label;		/* label to be changed when selecting formats which don't require CRF */
 	GtkWidget		*file_po;					/* Popover to notify user to choose a slideshow filename */
-	GHashTable		*cached_preview_surfaces;	/* GHashTable to store the cached surfaces during the preview */
+	ImgSurfaceCache	*cached_preview_surfaces;	/* Preview surfaces of the pictures by media id */
 	cairo_surface_t *current_image;  		/* Image in preview area */
 	cairo_surface_t *exported_image; 	/* Image being exported */
 	ImgStopPoint    *point1;        			/* Last stop point of image1 */
@@ -300,13 +322,16 @@ struct _img_window_struct
 	/* Preview related variables */
 	gboolean		window_is_fullscreen;
   	gboolean		preview_is_running;
+	struct _ImgPreviewRenderer *preview_renderer;	/* Composes the frames ahead while previewing */
+	gint64			preview_start_clock;		/* Monotonic time at which preview_start_time was shown */
+	gdouble			preview_start_time;
   	GtkWidget	*import_slide_chooser;
 	GtkWidget	*total_stop_points_label;
 	GtkWidget	*slide_number_entry;
 
 	/* Export dialog related stuff */
 	gint        		export_is_running;
-	gint 				current_timeline_index;
+	gdouble			current_timeline_index;	/* Time of the frame being exported */
 	gint		     	export_fps;        				/* Frame rate for exported video */
 	GtkWidget   *export_pbar1;
 	GtkWidget   *export_pbar2;
@@ -319,12 +344,44 @@ struct _img_window_struct
 	guint        		export_slide;					/* Number of slide being exported */
 	GSourceFunc  export_idle_func;			/* Stored procedure for pause */
 	GTimer			 *elapsed_timer;				/* GTimer for the elapsed time */
+	GThreadPool		*export_pool;				/* Threads rendering the frames */
+	GPtrArray			*export_jobs;				/* Frames being rendered, in the order they are encoded */
+	GMutex				export_mutex;
+	GCond				export_cond;				/* Signalled when a frame is rendered */
+	gint					export_queue_depth;	/* Maximum number of frames rendered at once */
+	gint					export_next_frame;		/* Next frame to be encoded */
+	gint					export_next_job;			/* Next frame to be rendered */
+	gint					export_last_frame;
+	AVFrame			*export_prev_frame;		/* Last composed frame, encoded again for the static ones */
+	GThread			*export_thread;			/* Thread encoding and muxing the frames */
+	gboolean			export_paused;			/* Pause and cancel requests, set under export_mutex */
+	gboolean			export_cancelled;
+	gint					export_result;			/* Result of the encoder thread */
+	gint					export_progress_pending;	/* TRUE while a progress update is queued */
+	gint					export_printed_percent;	/* Last progress printed by the command line export */
+	struct _ImgRenderPlan *export_plan;		/* The timeline flattened for the export threads */
+	gint					export_plan_cursor;		/* Segment of the last dispatched frame */
+	GMutex				export_cache_mutex;
+	GHashTable		*export_cache;				/* Decoded media surfaces reused across the exported frames */
+	gsize			export_cache_size;			/* Bytes currently held by export_cache */
+	gsize			export_cache_max_size;	/* Memory cap of export_cache in bytes */
+	GPtrArray		*export_audio_sources;	/* Audio items decoded while exporting */
+	gint64			export_audio_next_pts;	/* Next audio sample to be encoded */
+	gfloat			*export_audio_mix;		/* Interleaved stereo mix of one audio frame */
+	gfloat			*export_audio_buffer;	/* Samples of one source for the mix */
+	gint				export_segments;			/* Number of parts encoded in parallel, 1 or less for none */
+	gint				export_bitrate_crf;		/* Kept to open the encoders of the parts */
+
+	/* Command line export related stuff */
+	gboolean		headless;						/* TRUE when exporting with --export, no widgets are created */
+	GArray			*headless_tracks;			/* Tracks read from the project file in place of the timeline ones */
 
 	/* AV library stuff */
-	AVFrame 				*video_frame;
 	AVFrame 				*audio_frame;
 	AVStream				*video_stream;
+	AVStream				*audio_stream;
 	AVCodecContext		*codec_context;
+	AVCodecContext		*audio_codec_context;
 	AVPacket					*video_packet;
 	AVPacket					*audio_packet;
 	AVFormatContext	*video_format_context;
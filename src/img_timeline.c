@@ -17,9 +17,12 @@
  *
  */
 
+#include <math.h>
 #include "audio.h"
 #include "img_timeline.h"
 #include "callbacks.h"
+#include "preview.h"
+#include "assets.h"
 
 static int next_order = 0;
 
@@ -28,6 +31,7 @@ static void img_timeline_set_property(GObject *, guint , const GValue *, GParamS
 static void img_timeline_get_property(GObject *, guint , GValue *, GParamSpec *);
 static void img_timeline_init(ImgTimeline *);
 static void img_timeline_draw_ticks(GtkWidget *widget, cairo_t *);
+static void img_timeline_paint_ruler(ImgTimelinePrivate *, cairo_t *, gdouble, gdouble, gint);
 static void img_timeline_draw_rubber_band(cairo_t *, ImgTimelinePrivate *);
 static void img_timeline_select_items_in_rubber_band(GtkWidget *);
 static void img_timeline_finalize(GObject *);
@@ -36,6 +40,17 @@ static gint img_timeline_calculate_total_tracks_height(GtkWidget *);
 static gint img_sort_image_track_first(gconstpointer , gconstpointer );
 static gint img_timeline_get_track_at_position(GtkWidget *, gint, gint *);
 static void img_timeline_unhighlight_track(GArray *);
+static void img_timeline_set_virtualized(GtkWidget *, gboolean, ImgMediaRegistry *);
+static void img_timeline_draw_virtual_items(GtkWidget *, cairo_t *);
+static media_timeline *img_timeline_get_item_at(GtkWidget *, gdouble, gdouble);
+static media_timeline *img_track_get_item_at(Track *, gdouble);
+static void img_timeline_media_press(img_window_struct *, media_timeline *, gdouble, gdouble);
+static void img_timeline_media_release(img_window_struct *, media_timeline *, gboolean);
+static void img_timeline_media_drag(img_window_struct *, media_timeline *, gdouble);
+static void img_timeline_queue_drag(img_window_struct *, media_timeline *, gdouble);
+static void img_timeline_flush_drag(img_window_struct *);
+static void img_timeline_media_toggled(GtkToggleButton *, GtkWidget *);
+static gdouble img_timeline_get_preview_clock(img_window_struct *);
 
 G_DEFINE_TYPE_WITH_PRIVATE(ImgTimeline, img_timeline, GTK_TYPE_LAYOUT);
 
@@ -58,6 +73,8 @@ void img_timeline_start_stop_preview(GtkWidget *item, img_window_struct *img)
 		img->preview_is_running = FALSE;
 		img_swap_preview_button_images(img, TRUE);
 		img_timeline_update_audio_states(img, priv->current_preview_time);
+		img_preview_renderer_free(img->preview_renderer);
+		img->preview_renderer = NULL;
 		cairo_surface_destroy(img->exported_image);
 		img->exported_image = NULL;
 		g_slist_free(img->media_playing);
@@ -73,161 +90,88 @@ void img_timeline_start_stop_preview(GtkWidget *item, img_window_struct *img)
 
 		active_elements = img_timeline_get_active_media_at_given_time(img->timeline, priv->current_preview_time);
 		if (active_elements)
-			img->source_id = g_timeout_add(1000 / priv->pixels_per_second, (GSourceFunc) img_timeline_preview_timeout, img);
+			img->source_id = g_timeout_add(1000 / img->preview_fps, (GSourceFunc) img_timeline_preview_timeout, img);
 
 		img->preview_is_running = TRUE;
 		img_swap_preview_button_images(img, FALSE);
 		priv->current_preview_time = priv->time_marker_pos / priv->pixels_per_second;
 
+		img->preview_renderer = img_preview_renderer_new(img, img->preview_fps);
+		img_timeline_preview_seek(img, priv->current_preview_time);
+
 		img_timeline_update_audio_states(img, priv->current_preview_time);
 		g_array_free(active_elements, FALSE);
 	}
 }
 
+/* Only presents the frame composed ahead by the preview renderer,
+ * the previous one stays on screen if it isn't ready yet. The frame
+ * is the one due at the current time, so when the ticks come late
+ * the frames in between are dropped instead of slowing down */
 gboolean img_timeline_preview_timeout(img_window_struct *img)
 {
-    ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
-    media_timeline *current_media = NULL,  *media = NULL;
-    GArray *current_media_array = NULL;
-    GArray *next_media_array = NULL;
-    cairo_surface_t *surface = NULL, *composite_surface = NULL;
-    cairo_surface_t *next_composite = NULL;
-    cairo_t *cr;
-    gint max_width = 0, max_height = 0;
-    gdouble next_time, current_end_time, transition_duration;
-    gboolean is_transitioning = FALSE;
-    
-    // Get current active media
-    current_media_array = img_timeline_get_active_picture_media(img->timeline, priv->current_preview_time);
-    if (current_media_array->len == 0)
-        goto update_red_needle;
-
-	current_media = g_array_index(current_media_array, media_timeline *, 0);
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
+	cairo_surface_t *surface = NULL;
+	gint frame_nr;
 
-	if (current_media->transition_id > -1)
-		is_transitioning = TRUE;
-	else
-		is_transitioning = FALSE;
-  
-    // Find max dimensions for all current media
-    for (gint i = 0; i < current_media_array->len; i++)
-    {
-        media = g_array_index(current_media_array, media_timeline *, i);
-        surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(media->id));
-        if (surface)
-        {
-            max_width = MAX(max_width, cairo_image_surface_get_width(surface));
-            max_height = MAX(max_height, cairo_image_surface_get_height(surface));
-        }
-    }
-	if (is_transitioning)
+	priv->current_preview_time = img_timeline_get_preview_clock(img);
+	frame_nr = (gint) (priv->current_preview_time * img->preview_fps);
+	if (img_preview_renderer_take(img->preview_renderer, frame_nr, &surface))
 	{
-		// Get the first media to check for transition timing
-		current_media = g_array_index(current_media_array, media_timeline *, 0);
+		if (img->exported_image)
+			cairo_surface_destroy(img->exported_image);
+		img->exported_image = surface;
+	}
+	img_timeline_preview_update(img);
+	gtk_widget_queue_draw(img->image_area);
+
+	return G_SOURCE_CONTINUE;
+}
 
-		// Calculate when current media ends
-		current_end_time = current_media->start_time + current_media->duration;	
+/* Restarts the preview clock from the given time */
+void img_timeline_preview_seek(img_window_struct *img, gdouble time)
+{
+	img->preview_start_time = time;
+	img->preview_start_clock = g_get_monotonic_time();
+	if (img->preview_renderer)
+		img_preview_renderer_seek(img->preview_renderer, time, 1);
+}
 
-		// Check if we're near the end of current media (transition zone)
-		transition_duration = 1.5;
+/* Returns the time the preview should show now. It's the time elapsed
+ * on the monotonic clock since the preview started unless some audio
+ * is playing, the picture then follows what ALSA says is being heard.
+ * An audio position too far from the clock, as right after a seek,
+ * isn't followed */
+static gdouble img_timeline_get_preview_clock(img_window_struct *img)
+{
+	ImgMediaAudioButtonPrivate *priv;
+	media_timeline *media;
+	gint64 now;
+	gdouble time, audio_time;
+	gboolean found;
 
-		// Calculate transition progress
-		img->transition_progress = 1.0 - ((current_end_time - priv->current_preview_time) / transition_duration);
-		
-		// Get the next set of media items
-		next_time = current_end_time + 0.01; // Look slightly after current end
-		next_media_array = img_timeline_get_active_picture_media(img->timeline, next_time);
-		
-		// Update max dimensions considering next media items
-		if (next_media_array)
-		{
-			for (gint i = 0; i < next_media_array->len; i++)
-			{
-				media = g_array_index(next_media_array, media_timeline *, i);
-				surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(media->id));
-				if (surface)
-				{
-					max_width = MAX(max_width, cairo_image_surface_get_width(surface));
-					max_height = MAX(max_height, cairo_image_surface_get_height(surface));
-				}
-			}
-		}
-	}
-	// Create composite surface for final output
-	if (max_width > 0 && max_height > 0)
+	now = g_get_monotonic_time();
+	time = img->preview_start_time + (gdouble) (now - img->preview_start_clock) / G_USEC_PER_SEC;
+
+	for (GSList *node = img->media_playing; node; node = node->next)
 	{
-		composite_surface = cairo_surface_create_similar(g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(current_media->id)),
-			CAIRO_CONTENT_COLOR_ALPHA, max_width, max_height);
+		media = node->data;
+		priv = img_media_audio_button_get_private_struct((ImgMediaAudioButton*)media->button);
 
-		// Compose current media items
-		cr = cairo_create(composite_surface);
-		for (gint i = current_media_array->len - 1; i >= 0; i--)
-		{
-			media = g_array_index(current_media_array, media_timeline *, i);
-			surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(media->id));
-			if (surface)
-			{
-				//gint x = (max_width - cairo_image_surface_get_width(surface)) / 2;
-				//gint y = (max_height - cairo_image_surface_get_height(surface)) / 2;
-				cairo_set_source_surface(cr, surface, media->x, media->y);
-				cairo_paint(cr);
-			}
-		}
-		cairo_destroy(cr);
-	
-		// If transitioning, compose next media items
-		if (is_transitioning && next_media_array && next_media_array->len > 0)
-		{
-			next_composite = cairo_surface_create_similar(composite_surface, CAIRO_CONTENT_COLOR_ALPHA, max_width, max_height);
-			cr = cairo_create(next_composite);
-			for (gint i = next_media_array->len - 1; i >= 0; i--)
-			{
-				media = g_array_index(next_media_array, media_timeline *, i);
-				surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(media->id));
-				if (surface)
-				{
-					gint x = (max_width - cairo_image_surface_get_width(surface)) / 2;
-					gint y = (max_height - cairo_image_surface_get_height(surface)) / 2;
-					cairo_set_source_surface(cr, surface, x, y);
-					cairo_paint(cr);
-				}
-			}
-			cairo_destroy(cr);
+		g_mutex_lock(&priv->audio_data->play_mutex);
+		found = priv->audio_data->clock_stamp > 0;
+		audio_time = priv->audio_data->clock_time + (gdouble) (now - priv->audio_data->clock_stamp) / G_USEC_PER_SEC;
+		g_mutex_unlock(&priv->audio_data->play_mutex);
 
-			// Apply transition effect using current media's render function
-			cr = cairo_create(composite_surface);
-			current_media->render(cr, composite_surface, next_composite, img->transition_progress);
-			cairo_destroy(cr);
-			cairo_surface_destroy(next_composite);
-		}
-		else
+		if (found && fabs(audio_time - time) < IMG_PREVIEW_MAX_AUDIO_DRIFT)
 		{
-			cr = cairo_create(composite_surface);
-			cairo_set_source_surface(cr, composite_surface, 0, 0);
-			cairo_paint(cr);
-			cairo_destroy(cr);
-			
-			// Reset transition progress when not transitioning
-			img->transition_progress = 0.0;
+			/* Keep going from there if the audio stops */
+			img->preview_start_time = audio_time;
+			img->preview_start_clock = now;
+			return audio_time;
 		}
 	}
-	
-	if (next_media_array)
-		g_array_free(next_media_array, FALSE);
-
-update_red_needle:
-	g_array_free(current_media_array, FALSE);
-	
-	if (img->exported_image)
-	{
-		cairo_surface_destroy(img->exported_image);
-		img->exported_image = NULL;
-	}
-	img->exported_image = composite_surface;
-	img_timeline_preview_update(img);
-	gtk_widget_queue_draw(img->image_area);
-
-	return G_SOURCE_CONTINUE;
+	return time;
 }
 
 void img_timeline_preview_update(img_window_struct *img)
@@ -235,8 +179,8 @@ void img_timeline_preview_update(img_window_struct *img)
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
 	
 	// Update timeline position
-	priv->current_preview_time += (1.0 / priv->pixels_per_second);
 	img_timeline_update_audio_states(img, priv->current_preview_time);
+	img_preview_prefetch(img, priv->current_preview_time);
 	
 	// Update UI
 	gdouble new_marker_pos = priv->current_preview_time * priv->pixels_per_second;
@@ -262,6 +206,8 @@ void img_timeline_preview_update(img_window_struct *img)
 		img->preview_is_running = FALSE;		
 		img_swap_preview_button_images(img, TRUE);
 		img_timeline_update_audio_states(img, priv->current_preview_time);
+		img_preview_renderer_free(img->preview_renderer);
+		img->preview_renderer = NULL;
 		cairo_surface_destroy(img->exported_image);
 		img->exported_image = NULL;
 	}
@@ -293,6 +239,9 @@ static void img_timeline_init(ImgTimeline *timeline)
 	priv->total_time = 0;
 	priv->time_marker_pos = 0.0;
 	priv->tracks = g_array_new(FALSE, TRUE, sizeof(Track *));
+	priv->selected_items = g_hash_table_new(g_direct_hash, g_direct_equal);
+	priv->ruler_tiles = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) cairo_surface_destroy);
+	priv->thumbnails = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) cairo_surface_destroy);
 	
 	priv->rubber_band_active = FALSE;
 	priv->rubber_band_start_x = 0;
@@ -308,6 +257,7 @@ static void img_timeline_init(ImgTimeline *timeline)
 	image_track->order = next_order++;
 	image_track->items = g_array_new(FALSE, TRUE, sizeof(media_timeline *));
 	image_track->background_color = g_strdup("#CCCCFF");
+	gdk_rgba_parse(&image_track->background_rgba, image_track->background_color);
 	g_array_append_val(priv->tracks, image_track);
 	
 	Track *audio_track = g_new0(Track, 1);
@@ -317,6 +267,7 @@ static void img_timeline_init(ImgTimeline *timeline)
 	audio_track->order = next_order++;
 	audio_track->items = g_array_new(FALSE, TRUE, sizeof(media_timeline *));
 	audio_track->background_color = g_strdup("#d6d1cd");
+	gdk_rgba_parse(&audio_track->background_rgba, audio_track->background_color);
 	g_array_append_val(priv->tracks, audio_track);	
 }
 
@@ -346,12 +297,20 @@ void img_timeline_set_total_time(ImgTimeline *da, gint total_time)
 	priv->total_time = total_time;
 }
 
+/* Only the strips under the old and the new position of the
+ * needle are painted again */
 void img_timeline_set_time_marker(ImgTimeline *timeline, gdouble posx)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private(timeline);
+	gint height;
+
+	if (priv->time_marker_pos == posx)
+		return;
 
+	height = img_timeline_calculate_total_tracks_height(GTK_WIDGET(timeline)) + 8;
+	gtk_widget_queue_draw_area(GTK_WIDGET(timeline), floor(priv->time_marker_pos) - 7, 0, 15, height);
 	priv->time_marker_pos = posx;
-	gtk_widget_queue_draw(GTK_WIDGET(timeline));
+	gtk_widget_queue_draw_area(GTK_WIDGET(timeline), floor(posx) - 7, 0, 15, height);
 }
 
 ImgTimelinePrivate *img_timeline_get_private_struct(GtkWidget *timeline)
@@ -387,24 +346,29 @@ GtkWidget* img_timeline_new()
 static gboolean img_timeline_draw(GtkWidget *timeline, cairo_t *cr)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
-	GdkRGBA rgba;
 	Track *track;
+	gdouble x1, y1, x2, y2;
 
 	gint width = gtk_widget_get_allocated_width(timeline);
 	img_timeline_draw_ticks(timeline, cr);
 
-	// Draw the tracks
+	// Draw the tracks, only in the part of the timeline being exposed
+	cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
 	int y = 0;
 	for (int i = 0; i < priv->tracks->len; i++)
 	{
 		track = g_array_index(priv->tracks, Track *, i);
-		gdk_rgba_parse(&rgba, track->background_color);
+		if (y + IMG_TIMELINE_RULER_HEIGHT > y2 || y + IMG_TIMELINE_RULER_HEIGHT + TRACK_HEIGHT < y1)
+		{
+			y += TRACK_HEIGHT + TRACK_GAP;
+			continue;
+		}
 		cairo_set_line_width(cr, 1.0);
 		if (priv->dark_theme)
 			cairo_set_source_rgb(cr, 0.2, 0.2, 0.2);
 		else
-			cairo_set_source_rgb(cr, rgba.red, rgba.green, rgba.blue);
-		cairo_rectangle(cr, 0, y+32 , width, TRACK_HEIGHT);
+			gdk_cairo_set_source_rgba(cr, &track->background_rgba);
+		cairo_rectangle(cr, x1, y+32 , x2 - x1, TRACK_HEIGHT);
 		cairo_fill(cr);
 	
 		if (track->is_selected)
@@ -417,6 +381,9 @@ static gboolean img_timeline_draw(GtkWidget *timeline, cairo_t *cr)
 		y += TRACK_HEIGHT + TRACK_GAP;
 	}
 
+	if (priv->virtualized)
+		img_timeline_draw_virtual_items(timeline, cr);
+
 	  //This is necessary to draw the media represented by the GtkToggleButtons
 	  GTK_WIDGET_CLASS (img_timeline_parent_class)->draw (timeline, cr);
 
@@ -463,31 +430,25 @@ static void img_timeline_finalize(GObject *object)
 			Track *track = g_array_index(priv->tracks, Track *, i);
 			if (track->items)
 				g_array_free(track->items, TRUE);
+			img_track_free_index(track);
 			
 			g_free(track->background_color);
 			g_free(track);
 		}
         g_array_free(priv->tracks, TRUE);
     }
+	g_hash_table_destroy(priv->selected_items);
+	g_hash_table_destroy(priv->ruler_tiles);
+	g_hash_table_destroy(priv->thumbnails);
 
   G_OBJECT_CLASS(img_timeline_parent_class)->finalize(object);
 }
 
-void img_timeline_draw_ticks(GtkWidget *da, cairo_t *cr)
+/* Paints the ticks and the labels of the ruler between x1 and x2 */
+static void img_timeline_paint_ruler(ImgTimelinePrivate *priv, cairo_t *cr, gdouble x1, gdouble x2, gint width)
 {
-    ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)da);
     cairo_text_extents_t extents;
-    gint width, total_time = 0;
-    
-    width  = gtk_widget_get_allocated_width(da);
-    g_object_get(G_OBJECT(da), "total_time", &total_time, NULL);
 
-	if (priv->dark_theme)
-    cairo_set_source_rgb(cr, 0.33, 0.33, 0.33);
-    else
-		cairo_set_source_rgb(cr, 1, 1, 1);
-    cairo_paint(cr);
-    
     if (priv->dark_theme)
 		cairo_set_source_rgb(cr, 1, 1, 1);
 	else	
@@ -510,21 +471,23 @@ void img_timeline_draw_ticks(GtkWidget *da, cairo_t *cr)
     else if (priv->pixels_per_second < 40) tick_interval = 2.0;			// 2 seconds
     else tick_interval = 1.0;                                         							// 1 second
 
-    gdouble label_interval = tick_interval * 2;
-    gdouble max_time = width / priv->pixels_per_second;
-
     // Calculate the minimum width needed for a label
     char min_time_str[20];
     snprintf(min_time_str, sizeof(min_time_str), "00:00:00");
     cairo_text_extents(cr, min_time_str, &extents);
     gdouble min_label_width = extents.width * 1.0;  // Add padding
 
-    for (gdouble t = 0; t <= max_time; t += tick_interval)
+    // Labels are centered on their tick so start half a label before x1
+    gint first = MAX(0, floor((x1 - min_label_width) / priv->pixels_per_second / tick_interval));
+    gint last = ceil((MIN(x2, width) + min_label_width) / priv->pixels_per_second / tick_interval);
+
+    for (gint tick = first; tick <= last; tick++)
     {
+        gdouble t = tick * tick_interval;
         gdouble x = t * priv->pixels_per_second;
         if (x > width)
 			break;
-        if (fmod(t, label_interval) < 0.05)
+        if (tick % 2 == 0)
         {
             // Draw major tick and label
             cairo_set_line_width(cr, 2.0);
@@ -563,6 +526,62 @@ void img_timeline_draw_ticks(GtkWidget *da, cairo_t *cr)
     }
 }
 
+/* The ruler is painted in tiles kept until the zoom or the width of the
+ * timeline change, a redraw only copies the tiles of the exposed area */
+void img_timeline_draw_ticks(GtkWidget *da, cairo_t *cr)
+{
+    ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)da);
+    cairo_surface_t *tile;
+    cairo_t *tile_cr;
+    gdouble x1, y1, x2, y2;
+    gint width, first, last;
+    
+    width  = gtk_widget_get_allocated_width(da);
+
+	if (priv->dark_theme)
+    cairo_set_source_rgb(cr, 0.33, 0.33, 0.33);
+    else
+		cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_paint(cr);
+
+    cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+    if (y1 >= IMG_TIMELINE_RULER_HEIGHT)
+		return;
+
+    if (priv->ruler_tiles_scale != priv->pixels_per_second || priv->ruler_tiles_width != width || priv->ruler_tiles_dark != priv->dark_theme)
+    {
+		g_hash_table_remove_all(priv->ruler_tiles);
+		priv->ruler_tiles_scale = priv->pixels_per_second;
+		priv->ruler_tiles_width = width;
+		priv->ruler_tiles_dark = priv->dark_theme;
+	}
+
+    first = MAX(0, floor(x1 / IMG_TIMELINE_TILE_WIDTH));
+    last = floor(MIN(x2, width) / IMG_TIMELINE_TILE_WIDTH);
+    for (gint i = first; i <= last; i++)
+    {
+		tile = g_hash_table_lookup(priv->ruler_tiles, GINT_TO_POINTER(i));
+		if (tile == NULL)
+		{
+			tile = gdk_window_create_similar_surface(gtk_widget_get_window(da), CAIRO_CONTENT_COLOR,
+															IMG_TIMELINE_TILE_WIDTH, IMG_TIMELINE_RULER_HEIGHT);
+			tile_cr = cairo_create(tile);
+			if (priv->dark_theme)
+				cairo_set_source_rgb(tile_cr, 0.33, 0.33, 0.33);
+			else
+				cairo_set_source_rgb(tile_cr, 1, 1, 1);
+			cairo_paint(tile_cr);
+			cairo_translate(tile_cr, -i * IMG_TIMELINE_TILE_WIDTH, 0);
+			img_timeline_paint_ruler(priv, tile_cr, i * IMG_TIMELINE_TILE_WIDTH, (i + 1) * IMG_TIMELINE_TILE_WIDTH, width);
+			cairo_destroy(tile_cr);
+			g_hash_table_insert(priv->ruler_tiles, GINT_TO_POINTER(i), tile);
+		}
+		cairo_set_source_surface(cr, tile, i * IMG_TIMELINE_TILE_WIDTH, 0);
+		cairo_rectangle(cr, i * IMG_TIMELINE_TILE_WIDTH, 0, IMG_TIMELINE_TILE_WIDTH, IMG_TIMELINE_RULER_HEIGHT);
+		cairo_fill(cr);
+	}
+}
+
 void img_timeline_add_media(GtkWidget *timeline, media_struct *entry, gint x, gint y, img_window_struct *img)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
@@ -599,6 +618,7 @@ void img_timeline_add_media(GtkWidget *timeline, media_struct *entry, gint x, gi
 	else if (entry->media_type == 1)
 	{
 		item->duration = img_convert_time_string_to_seconds(entry->audio_duration);
+		item->volume = 1.0;
 		width = img_convert_time_string_to_seconds(entry->audio_duration);
 		item->trans_group = NULL;
 		item->tree_path = NULL;
@@ -618,11 +638,17 @@ void img_timeline_add_media(GtkWidget *timeline, media_struct *entry, gint x, gi
 	// Set start time based on the actual position
 	item->old_x = position_x;
     item->start_time = position_x / (BASE_SCALE * priv->zoom_scale);
-   	gtk_widget_set_size_request(item->button, width, 50);
-	gtk_layout_move(GTK_LAYOUT(timeline), item->button, position_x, new_y);
+	if (item->button)
+	{
+		gtk_widget_set_size_request(item->button, width, 50);
+		gtk_layout_move(GTK_LAYOUT(timeline), item->button, position_x, new_y);
+	}
+	else
+		gtk_widget_queue_draw(timeline);
 	track->last_media_posX += width;
 	
 	g_array_append_val(track->items, item);
+	img_track_invalidate_index(track);
 	img_taint_project(img);
 	
 	gint test = img_timeline_get_final_time(img);
@@ -630,8 +656,24 @@ void img_timeline_add_media(GtkWidget *timeline, media_struct *entry, gint x, gi
 
 void img_timeline_create_toggle_button(media_timeline *item, gint media_type, gchar *filename, img_window_struct *img)
 {
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
 	GdkPixbuf *pix = NULL;
     GtkWidget *image, *layout;
+	gint nr_items = 0;
+
+	if (! priv->virtualized)
+	{
+		for (gint i = 0; i < priv->tracks->len; i++)
+			nr_items += g_array_index(priv->tracks, Track *, i)->items->len;
+		if (nr_items >= IMG_TIMELINE_VIRTUAL_THRESHOLD)
+			img_timeline_set_virtualized(img->timeline, TRUE, img->media_registry);
+	}
+	// Audio media keep their button since it plays them
+	if (priv->virtualized && item->media_type != 1)
+	{
+		item->button = NULL;
+		return;
+	}
 
 	if (item->media_type == 0)
 	{
@@ -641,9 +683,10 @@ void img_timeline_create_toggle_button(media_timeline *item, gint media_type, gc
 		layout = gtk_layout_new(NULL, NULL);
 		gtk_container_add(GTK_CONTAINER(item->button), layout);
 		gtk_style_context_add_class(gtk_widget_get_style_context(item->button), "timeline-button");
-		pix = gdk_pixbuf_new_from_file_at_scale(filename, -1, 45, TRUE, NULL);
+		pix = img_thumbnail_get(filename, -1, 45);
 		image = gtk_image_new_from_pixbuf(pix);
-		g_object_unref(pix);
+		if (pix)
+			g_object_unref(pix);
 
 		// Add the image to the layout
 		gtk_layout_put(GTK_LAYOUT(layout), image, 0, 0);
@@ -653,7 +696,11 @@ void img_timeline_create_toggle_button(media_timeline *item, gint media_type, gc
 	{
 		item->button = img_media_audio_button_new();
 		gtk_widget_set_has_tooltip(item->button, TRUE);
-		img_load_audio_file(IMG_MEDIA_AUDIO_BUTTON(item->button), filename);
+		// The samples of the media of a project being opened are read later
+		if (item->is_loading)
+			img_media_audio_button_set_filename(IMG_MEDIA_AUDIO_BUTTON(item->button), filename);
+		else
+			img_load_audio_file(IMG_MEDIA_AUDIO_BUTTON(item->button), filename);
 	}
 	else if (item->media_type == 3)
 	{
@@ -675,6 +722,7 @@ void img_timeline_create_toggle_button(media_timeline *item, gint media_type, gc
 	g_signal_connect(item->button, "button-press-event",		G_CALLBACK(img_timeline_media_button_press_event), img);
 	g_signal_connect(item->button, "button-release-event", 	G_CALLBACK(img_timeline_media_button_release_event), img);
 	g_signal_connect(item->button, "query-tooltip",					G_CALLBACK(img_timeline_media_button_tooltip), item);
+	g_signal_connect(item->button, "toggled",							G_CALLBACK(img_timeline_media_toggled), img->timeline);
 
 	gtk_container_add(GTK_CONTAINER(img->timeline), item->button);
 	gtk_widget_show_all(item->button);
@@ -693,6 +741,7 @@ void img_timeline_add_track(GtkWidget *timeline, gint type, gchar *hexcode)
 	new_track->order = next_order++;
 	new_track->items = g_array_new(FALSE, TRUE, sizeof(media_timeline *));
 	new_track->background_color = g_strdup(hexcode);
+	gdk_rgba_parse(&new_track->background_rgba, new_track->background_color);
 	g_array_append_val(priv->tracks, new_track);
 	
 	// Sort by image track first so they can be easily drawn in the draw event
@@ -738,7 +787,15 @@ void img_timeline_media_drag_data_get(GtkWidget *widget, GdkDragContext *drag_co
 gboolean img_timeline_mouse_button_press (GtkWidget *timeline, GdkEventButton *event, img_window_struct *img)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
+	media_timeline *item;
 	gchar *time;
+
+	if (priv->virtualized && event->button == 1 && (item = img_timeline_get_item_at(timeline, event->x, event->y)))
+	{
+		priv->pressed_item = item;
+		img_timeline_media_press(img, item, event->x - item->old_x, item->duration * priv->pixels_per_second);
+		return TRUE;
+	}
 	
 	if (event->y < 12.0 || event->y > 32.0)
 	{
@@ -757,6 +814,8 @@ gboolean img_timeline_mouse_button_press (GtkWidget *timeline, GdkEventButton *e
 	if (event->button == 1)
 	{
 		priv->current_preview_time = event->x  / priv->pixels_per_second;
+		if (img->preview_is_running)
+			img_timeline_preview_seek(img, priv->current_preview_time);
 		priv->button_pressed_on_needle = TRUE;
 		img_timeline_set_time_marker((ImgTimeline*)timeline, event->x);
 		time = img_convert_time_to_string(event->x  / priv->pixels_per_second);
@@ -771,6 +830,21 @@ gboolean img_timeline_mouse_button_release (GtkWidget *timeline, GdkEvent *event
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
 	Track *track = NULL;
+	media_timeline *item;
+	GdkModifierType state = 0;
+
+	if (priv->pressed_item)
+	{
+		item = priv->pressed_item;
+		priv->pressed_item = NULL;
+		img_timeline_flush_drag(img);
+		gdk_event_get_state(event, &state);
+		img_timeline_media_release(img, item, (state & GDK_SHIFT_MASK) != 0);
+
+		// Toggled after the release like the GtkToggleButton does
+		img_timeline_select_item(timeline, item, ! img_timeline_item_is_selected(item));
+		return TRUE;
+	}
 
 	if (priv->rubber_band_active)
     {
@@ -831,7 +905,7 @@ gboolean img_timeline_key_press(GtkWidget *widget, GdkEventKey *event, img_windo
 						for (gint q = track->items->len - 1; q >= 0; q--)
 						{
 							item = g_array_index(track->items, media_timeline  *, q);
-							gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(item->button), TRUE);
+							img_timeline_select_item(img->timeline, item, TRUE);
 						}
 					}
 				}
@@ -847,9 +921,11 @@ gboolean img_timeline_key_press(GtkWidget *widget, GdkEventKey *event, img_windo
 					for (gint q = track->items->len - 1; q >= 0; q--)
 					{
 						item = g_array_index(track->items, media_timeline  *, q);
-						if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)))
+						if (img_timeline_item_is_selected(item))
 						{
-							gtk_widget_destroy(item->button);
+							g_hash_table_remove(priv->selected_items, item);
+							if (item->button)
+								gtk_widget_destroy(item->button);
 							if (item->tree_path)
 								g_free(item->tree_path);
 							if (item->trans_group)
@@ -864,6 +940,7 @@ gboolean img_timeline_key_press(GtkWidget *widget, GdkEventKey *event, img_windo
 								img_free_media_text_struct(item->text);
 							}
 							g_array_remove_index(track->items, q);
+							img_track_invalidate_index(track);
 							g_free(item);
 							img_taint_project(img);
 						}
@@ -887,10 +964,13 @@ gboolean img_timeline_key_press(GtkWidget *widget, GdkEventKey *event, img_windo
 								for (gint q = 0; q < track2->items->len; q++)
 								{
 									item = g_array_index(track2->items, media_timeline  *, q);
-									GtkAllocation allocation;
-									gtk_widget_get_allocation(item->button, &allocation);
-									item->timeline_y = allocation.y - (TRACK_HEIGHT + TRACK_GAP);
-									gtk_layout_move(GTK_LAYOUT(img->timeline), item->button, allocation.x, item->timeline_y);
+									item->timeline_y -= TRACK_HEIGHT + TRACK_GAP;
+									if (item->button)
+									{
+										GtkAllocation allocation;
+										gtk_widget_get_allocation(item->button, &allocation);
+										gtk_layout_move(GTK_LAYOUT(img->timeline), item->button, allocation.x, item->timeline_y);
+									}
 								}
 							}
 						}
@@ -905,6 +985,7 @@ gboolean img_timeline_key_press(GtkWidget *widget, GdkEventKey *event, img_windo
 				{
 					g_array_remove_index(priv->tracks, i);
 					g_free(track->background_color);
+					img_track_free_index(track);
 					g_free(track);
 				}
 			}
@@ -919,8 +1000,30 @@ gboolean img_timeline_key_press(GtkWidget *widget, GdkEventKey *event, img_windo
 gboolean img_timeline_motion_notify(GtkWidget *timeline, GdkEventMotion *event, img_window_struct *img)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline *)timeline);
+	media_timeline *item;
+	GdkCursor *cursor;
+	gdouble x;
 	gchar *time;
 
+	if (priv->pressed_item)
+	{
+		img_timeline_queue_drag(img, priv->pressed_item, event->x);
+		return TRUE;
+	}
+
+	// The painted media have no window of their own to set the cursor on
+	if (priv->virtualized)
+	{
+		item = img_timeline_get_item_at(timeline, event->x, event->y);
+		x = item ? event->x - item->old_x : -1;
+		if (item && (x <= 10 || x >= item->duration * priv->pixels_per_second - 10))
+			cursor = gdk_cursor_new_for_display(gdk_display_get_default(), GDK_SB_H_DOUBLE_ARROW);
+		else
+			cursor = gdk_cursor_new_for_display(gdk_display_get_default(), GDK_ARROW);
+		gdk_window_set_cursor(event->window, cursor);
+		g_object_unref(cursor);
+	}
+
 	if (priv->rubber_band_active)
     {
         priv->rubber_band_end_x = event->x;
@@ -955,7 +1058,7 @@ static void img_timeline_select_items_in_rubber_band(GtkWidget *timeline)
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
 	Track *track =NULL;
 	media_timeline *item = NULL;
-	GtkAllocation button_allocation;
+	gdouble item_x, item_width;
 
 	gdouble band_left = MIN(priv->rubber_band_start_x, priv->rubber_band_end_x);
 	gdouble band_right = MAX(priv->rubber_band_start_x, priv->rubber_band_end_x);
@@ -968,15 +1071,16 @@ static void img_timeline_select_items_in_rubber_band(GtkWidget *timeline)
 		for (gint j = 0; j < track->items->len; j++)
 		{
 			item = g_array_index(track->items, media_timeline *, j);
-			gtk_widget_get_allocation(item->button, &button_allocation);
+			item_x = item->start_time * priv->pixels_per_second;
+			item_width = item->duration * priv->pixels_per_second;
 			
 			// Check if the media item intersects with the rubber band
-			gboolean intersects = !(button_allocation.x + button_allocation.width < band_left ||
-								button_allocation.x > band_right ||
-								button_allocation.y + button_allocation.height < band_top ||
-								button_allocation.y > band_bottom);
+			gboolean intersects = !(item_x + item_width < band_left ||
+								item_x > band_right ||
+								item->timeline_y + TRACK_HEIGHT < band_top ||
+								item->timeline_y > band_bottom);
 		
-			gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(item->button), intersects);
+			img_timeline_select_item(timeline, item, intersects);
 			item->is_selected = intersects;
 		}
 	}
@@ -1000,25 +1104,25 @@ gboolean img_timeline_media_button_tooltip(GtkWidget *widget, gint x, gint y, gb
 	return TRUE;
 }
 
-gboolean img_timeline_media_button_press_event(GtkWidget *button, GdkEventButton *event, img_window_struct *img)
+/* What a click on a media does, x being relative to the media left
+ * edge and width the media width in pixels. The media buttons and
+ * the painted media of the virtualized timeline share it */
+static void img_timeline_media_press(img_window_struct *img, media_timeline *item, gdouble x, gdouble width)
 {
-	media_timeline *item;
-	
 	if (img->current_item->text)
 		img->current_item->text->visible = FALSE;
 	
-	item = g_object_get_data(G_OBJECT(button), "mem_address");
 	item->button_pressed = TRUE;
 	gtk_notebook_set_current_page (GTK_NOTEBOOK(img->side_notebook), 1);
 	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(img->toggle_button_image_options), TRUE);
 
 	// Store the initial mouse position and button width
-	item->timeline_drag_x = event->x;
-	item->initial_width = gtk_widget_get_allocated_width(button);
+	item->timeline_drag_x = x;
+	item->initial_width = width;
 	
-	if (event->x <= 10)
+	if (x <= 10)
 		item->resizing = RESIZE_LEFT;
-	else if (event->x >= item->initial_width - 10)
+	else if (x >= item->initial_width - 10)
 		item->resizing = RESIZE_RIGHT;
 	else
 		item->resizing = RESIZE_NONE;
@@ -1028,20 +1132,10 @@ gboolean img_timeline_media_button_press_event(GtkWidget *button, GdkEventButton
 	
 	if (img->current_item->text)
 		img->current_item->text->visible = TRUE;
-	return FALSE;
 }
 
-gboolean img_timeline_media_button_release_event(GtkWidget *button, GdkEventButton *event, img_window_struct *img)
+static void img_timeline_media_release(img_window_struct *img, media_timeline *item, gboolean shift_pressed)
 {
-	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline *)img->timeline);
-	Track *track;
-	media_timeline *item;
-	GtkTreeModel *model;
-	GtkTreeIter   iter;
-
-	gboolean shift_pressed = (event->state & GDK_SHIFT_MASK) != 0;
-
-	item = g_object_get_data(G_OBJECT(button), "mem_address");
 	item->button_pressed = FALSE;
 	item->resizing = RESIZE_NONE;
 	item->right_edge_pos = 0;
@@ -1050,121 +1144,187 @@ gboolean img_timeline_media_button_release_event(GtkWidget *button, GdkEventButt
 		img_deselect_all_surfaces(img);
 
 	gtk_widget_queue_draw(img->image_area);
-	return FALSE;
 }
 
-gboolean img_timeline_media_motion_notify(GtkWidget *button, GdkEventMotion *event, img_window_struct *img)
+static gdouble img_timeline_get_item_width(ImgTimelinePrivate *priv, media_timeline *item)
 {
-    ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline *)img->timeline);
-    gdouble x, new_width, button_width, timeline_width, nearest_tick;
-    GdkCursor *cursor;
-    GdkWindow *window;
-    media_timeline *item;
+	if (item->button)
+		return gtk_widget_get_allocated_width(item->button);
+
+	return item->duration * priv->pixels_per_second;
+}
+
+/* Moves or resizes the media being dragged, event_x being
+ * the pointer position relative to the media left edge */
+static void img_timeline_media_drag(img_window_struct *img, media_timeline *item, gdouble event_x)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline *)img->timeline);
+	gdouble x, new_width, button_width, timeline_width, nearest_tick;
+	gdouble old_start_time;
 	gint posx;
 
-    item = g_object_get_data(G_OBJECT(button), "mem_address");
-    window = gtk_widget_get_window(button);
-    button_width = gtk_widget_get_allocated_width(button);
+	switch (item->resizing)
+	{
+		case RESIZE_LEFT:
+			if (item->media_type == 1)
+				return;
 
-    if (item->button_pressed)
-    {
-        switch (item->resizing)
-        {
-			case RESIZE_LEFT:
-				if (item->media_type == 1)
-					return FALSE;
-
-				// Store the initial right edge position when resize starts
-				if (!item->right_edge_pos)
-					item->right_edge_pos = item->old_x + item->initial_width;
-				
-				// Calculate how much the mouse has moved from the drag start point
-				gdouble delta = event->x - item->timeline_drag_x;
-				
-				// Calculate new left edge position
-				x = item->old_x + delta;
-				
-				// Find nearest tick for snapping
-				nearest_tick = find_nearest_major_tick(priv->pixels_per_second, x);
-				if (abs(x - nearest_tick) < 10) {
-					x = nearest_tick;
-				}
-				
-				// Ensure x doesn't go beyond bounds
-				x = MAX(x, 0);
-				x = MIN(x, item->right_edge_pos - 1); // Ensure minimum width of 1
-				
-				// Calculate new width while maintaining right edge
-				new_width = item->right_edge_pos - x;
-				
-				// Apply changes
-				gtk_widget_set_size_request(button, new_width, 50);
-				gtk_layout_move(GTK_LAYOUT(img->timeline), button, x, item->timeline_y);
-				
-				// Update item properties
-				item->old_x = x;
-				item->initial_width = new_width;
-				item->start_time = x / priv->pixels_per_second;
-				item->duration = new_width / priv->pixels_per_second;
+			// Store the initial right edge position when resize starts
+			if (!item->right_edge_pos)
+				item->right_edge_pos = item->old_x + item->initial_width;
+			
+			// Calculate how much the mouse has moved from the drag start point
+			gdouble delta = event_x - item->timeline_drag_x;
+			
+			// Calculate new left edge position
+			x = item->old_x + delta;
+			
+			// Find nearest tick for snapping
+			nearest_tick = find_nearest_major_tick(priv->pixels_per_second, x);
+			if (abs(x - nearest_tick) < 10) {
+				x = nearest_tick;
+			}
+			
+			// Ensure x doesn't go beyond bounds
+			x = MAX(x, 0);
+			x = MIN(x, item->right_edge_pos - 1); // Ensure minimum width of 1
+			
+			// Calculate new width while maintaining right edge
+			new_width = item->right_edge_pos - x;
+			
+			// Apply changes
+			if (item->button)
+			{
+				gtk_widget_set_size_request(item->button, new_width, 50);
+				gtk_layout_move(GTK_LAYOUT(img->timeline), item->button, x, item->timeline_y);
+			}
+			
+			// Update item properties
+			item->old_x = x;
+			item->initial_width = new_width;
+			old_start_time = item->start_time;
+			item->start_time = x / priv->pixels_per_second;
+			item->duration = new_width / priv->pixels_per_second;
+			img_tracks_update_item(priv->tracks, item, old_start_time);
+			if (item->button)
 				img_timeline_center_button_image(item->button);
-			break;
+		break;
+		
+		case RESIZE_RIGHT:
+			if (item->media_type == 1)
+				return;
+			new_width = MAX(event_x, 1);
+			nearest_tick = find_nearest_major_tick(priv->pixels_per_second, item->old_x + new_width);
+			if (abs((item->old_x + new_width) - nearest_tick) < 10)
+				new_width = nearest_tick - item->old_x;
 			
-			case RESIZE_RIGHT:
-				if (item->media_type == 1)
-					return FALSE;
-				new_width = MAX(event->x, 1);
-				nearest_tick = find_nearest_major_tick(priv->pixels_per_second, item->old_x + new_width);
-				if (abs((item->old_x + new_width) - nearest_tick) < 10)
-					new_width = nearest_tick - item->old_x;
-				
-				gtk_widget_set_size_request(button, new_width, 50);
-				item->duration = new_width / priv->pixels_per_second;
+			item->duration = new_width / priv->pixels_per_second;
+			img_tracks_update_item(priv->tracks, item, item->start_time);
+			if (item->button)
+			{
+				gtk_widget_set_size_request(item->button, new_width, 50);
 				img_timeline_center_button_image(item->button);
-			break;
+			}
+		break;
+
 
+		case RESIZE_NONE:
+		{
+			GHashTableIter iter;
+			gpointer key;
 
-			case RESIZE_NONE:
+			timeline_width = gtk_widget_get_allocated_width(GTK_WIDGET(img->timeline));
+			
+			// Calculate the offset based on the drag event
+			gint offset = event_x - item->timeline_drag_x;
+		
+			// Iterate through the selected items and update their positions
+			g_hash_table_iter_init(&iter, priv->selected_items);
+			while (g_hash_table_iter_next(&iter, &key, NULL))
 			{
-				GArray *selected_items = img_timeline_get_selected_items(img->timeline);
-				timeline_width = gtk_widget_get_allocated_width(GTK_WIDGET(img->timeline));
-				
-				// Find the minimum and maximum x-coordinates of the selected items
-				gint min_x = G_MAXINT, max_x = 0;
-				for (gint j = 0; j < selected_items->len; j++)
-				{
-					media_timeline *item = g_array_index(selected_items, media_timeline *, j);
-					min_x = MIN(min_x, item->old_x);
-					max_x = MAX(max_x, item->old_x + gtk_widget_get_allocated_width(item->button));
-				}
-				// Calculate the offset based on the drag event
-				gint offset = event->x - item->timeline_drag_x;
+				media_timeline *item = key;
+				x = item->old_x + offset;
+				button_width = img_timeline_get_item_width(priv, item);
+
+				// Clamp the x-coordinate based on the combined width of the selected items
+				x = CLAMP(x, 0, timeline_width - button_width);
 			
-				// Iterate through the selected items and update their positions
-				for (gint j = 0; j < selected_items->len; j++)
-				{
-					media_timeline *item = g_array_index(selected_items, media_timeline *, j);
-					x = item->old_x + offset;
-					button_width = gtk_widget_get_allocated_width(item->button);
-
-					// Clamp the x-coordinate based on the combined width of the selected items
-					x = CLAMP(x, 0, timeline_width - button_width);
-				
-					nearest_tick = find_nearest_major_tick(priv->pixels_per_second, x);
-					if (abs(x - nearest_tick) < 10)
-						x = nearest_tick;
-				
-					// Move the button to the new position, maintaining the relative alignment
+				nearest_tick = find_nearest_major_tick(priv->pixels_per_second, x);
+				if (abs(x - nearest_tick) < 10)
+					x = nearest_tick;
+			
+				// Move the button to the new position, maintaining the relative alignment
+				if (item->button)
 					gtk_layout_move(GTK_LAYOUT(img->timeline), item->button, x, item->timeline_y);
-					item->start_time = x / priv->pixels_per_second;
-					item->old_x = x;
-				}
-				g_array_free(selected_items, FALSE);
-			break;
+				old_start_time = item->start_time;
+				item->start_time = x / priv->pixels_per_second;
+				item->old_x = x;
+				img_tracks_update_item(priv->tracks, item, old_start_time);
 			}
-        }
-        // Update the final time
-		posx = img_timeline_get_final_time(img);
-        gtk_widget_trigger_tooltip_query(GTK_WIDGET(item->button));
+		break;
+		}
+	}
+	// Update the final time
+	posx = img_timeline_get_final_time(img);
+
+	// The media shown under the needle may have changed
+	img_image_area_invalidate_cache(img);
+	gtk_widget_queue_draw(img->image_area);
+
+	if (item->button)
+		gtk_widget_trigger_tooltip_query(GTK_WIDGET(item->button));
+	else
+		gtk_widget_queue_draw(img->timeline);
+}
+
+gboolean img_timeline_query_tooltip(GtkWidget *timeline, gint x, gint y, gboolean keyboard_mode, GtkTooltip *tooltip, img_window_struct *img)
+{
+	media_timeline *item;
+
+	item = img_timeline_get_item_at(timeline, x, y);
+	if (item == NULL)
+		return FALSE;
+
+	return img_timeline_media_button_tooltip(timeline, x, y, keyboard_mode, tooltip, item);
+}
+
+gboolean img_timeline_media_button_press_event(GtkWidget *button, GdkEventButton *event, img_window_struct *img)
+{
+	media_timeline *item;
+	
+	item = g_object_get_data(G_OBJECT(button), "mem_address");
+	img_timeline_media_press(img, item, event->x, gtk_widget_get_allocated_width(button));
+	return FALSE;
+}
+
+gboolean img_timeline_media_button_release_event(GtkWidget *button, GdkEventButton *event, img_window_struct *img)
+{
+	media_timeline *item;
+
+	gboolean shift_pressed = (event->state & GDK_SHIFT_MASK) != 0;
+
+	item = g_object_get_data(G_OBJECT(button), "mem_address");
+	img_timeline_flush_drag(img);
+	img_timeline_media_release(img, item, shift_pressed);
+	return FALSE;
+}
+
+gboolean img_timeline_media_motion_notify(GtkWidget *button, GdkEventMotion *event, img_window_struct *img)
+{
+    gdouble button_width;
+    GdkCursor *cursor;
+    GdkWindow *window;
+    media_timeline *item;
+
+    item = g_object_get_data(G_OBJECT(button), "mem_address");
+    window = gtk_widget_get_window(button);
+    button_width = gtk_widget_get_allocated_width(button);
+
+    if (item->button_pressed)
+    {
+		if (item->media_type == 1 && item->resizing != RESIZE_NONE)
+			return FALSE;
+		img_timeline_queue_drag(img, item, item->old_x + event->x);
     }
 
     // Update cursor based on mouse position
@@ -1226,8 +1386,11 @@ gboolean img_timeline_scroll_event(GtkWidget *timeline, GdkEventScroll *event, G
 					if (item)
 					{
 						width = item->duration * priv->pixels_per_second;
-						gtk_widget_set_size_request(GTK_WIDGET(item->button), width, 50);
 						new_x = item->start_time * priv->pixels_per_second;
+						item->old_x = new_x;
+						if (item->button == NULL)
+							continue;
+						gtk_widget_set_size_request(GTK_WIDGET(item->button), width, 50);
 						gtk_layout_move(GTK_LAYOUT(timeline), item->button, new_x, item->timeline_y);
 						if (item->media_type == 0)
 							img_timeline_center_button_image(item->button);
@@ -1420,7 +1583,8 @@ void img_timeline_delete_all_media(ImgTimeline *timeline)
 			for (gint q = track->items->len - 1; q >= 0; q--)
 			{
 				item = g_array_index(track->items, media_timeline  *, q);
-				gtk_widget_destroy(item->button);
+				if (item->button)
+					gtk_widget_destroy(item->button);
 				if (item->tree_path)
 					g_free(item->tree_path);
 				if (item->trans_group)
@@ -1430,8 +1594,11 @@ void img_timeline_delete_all_media(ImgTimeline *timeline)
 				g_array_remove_index(track->items, q);
 				g_free(item);
 			}
+			img_track_invalidate_index(track);
 		}
 	}
+	g_hash_table_remove_all(priv->selected_items);
+	img_timeline_set_virtualized(GTK_WIDGET(timeline), FALSE, NULL);
 }
 
 void img_timeline_delete_additional_tracks(ImgTimeline *timeline)
@@ -1445,6 +1612,7 @@ void img_timeline_delete_additional_tracks(ImgTimeline *timeline)
 		if (! track->is_default)
 		{
 			g_free(track->background_color);
+			img_track_free_index(track);
 			g_array_remove_index(priv->tracks, i);
 			g_free(track);
 		}
@@ -1456,25 +1624,24 @@ void img_timeline_delete_additional_tracks(ImgTimeline *timeline)
 GArray *img_timeline_get_active_picture_media(GtkWidget *timeline, gdouble current_time)
 {
     ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
-    Track *track;
+
+    return img_tracks_get_active_picture_media(priv->tracks, current_time);
+}
+
+/* Same as img_timeline_get_active_picture_media() but working on a bare
+ * array of tracks, so it can be used when there is no timeline widget */
+GArray *img_tracks_get_active_picture_media(GArray *tracks, gdouble current_time)
+{
+    ImgTimelineIter iter;
     GArray* active_elements;
     media_timeline *item;
-    double item_end;
 
     active_elements = g_array_new(FALSE, TRUE, sizeof(media_timeline *));
-    for (gint i = 0; i < priv->tracks->len; i++)
+    img_tracks_iter_init(&iter, tracks, current_time);
+    while (img_tracks_iter_next(&iter, &item))
     {
-        track = g_array_index(priv->tracks, Track *, i);
-        for (gint j = 0; j < track->items->len; j++)
-        {
-            item = g_array_index(track->items, media_timeline *, j);
-            if (item->media_type == 0 || item->media_type == 2 || item->media_type == 3)  
-           {
-				item_end = item->start_time + item->duration;
-				if (current_time >= item->start_time && current_time < item_end)
-					g_array_append_val(active_elements, item);
-			}
-        }
+        if (item->media_type == 0 || item->media_type == 2 || item->media_type == 3)
+            g_array_append_val(active_elements, item);
     }
     return active_elements;
 }
@@ -1482,27 +1649,18 @@ GArray *img_timeline_get_active_picture_media(GtkWidget *timeline, gdouble curre
 GArray *img_timeline_get_active_audio_media(GtkWidget *timeline, gdouble current_time)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
-	Track *track;
+	ImgTimelineIter iter;
 	GArray* active_elements;
 	media_timeline *item;
-	double item_end;
 
 	active_elements = g_array_new(FALSE, TRUE, sizeof(media_timeline *));
-	for (gint i = 0; i < priv->tracks->len; i++)
+	img_tracks_iter_init(&iter, priv->tracks, current_time);
+	while (img_tracks_iter_next(&iter, &item))
 	{
-		track = g_array_index(priv->tracks, Track *, i);
-		for (gint j = 0; j < track->items->len; j++)
+		if (item->media_type == 1 && ! item->is_playing)
 		{
-			item = g_array_index(track->items, media_timeline *, j);
-			if (item->media_type == 1 && ! item->is_playing)
-			{
-				item_end = item->start_time + item->duration;
-				if (current_time >= item->start_time && current_time <= item_end)
-				{
-						g_print("Aggiungo %d %2.2f - %2.2f\n",item->id,item->start_time, current_time);
-						g_array_append_val(active_elements, item);
-				}
-			}
+			g_print("Aggiungo %d %2.2f - %2.2f\n",item->id,item->start_time, current_time);
+			g_array_append_val(active_elements, item);
 		}
 	}
 	return active_elements;
@@ -1559,7 +1717,6 @@ gint img_timeline_get_final_time(img_window_struct *img)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
 	Track *track;
-	media_timeline *item;
 	gint total_time = 0;
 	gint last_duration = 0;
 	gchar* total_time_string;
@@ -1569,15 +1726,14 @@ gint img_timeline_get_final_time(img_window_struct *img)
 		track = g_array_index(priv->tracks, Track *, i);
 		if (track->items)
 		{
-			for (gint q = track->items->len - 1; q >= 0; q--)
-			{
-				item = g_array_index(track->items, media_timeline *, q);
-				last_duration = item->start_time + item->duration;
-				if (last_duration > total_time)
-					total_time = last_duration;
-			}
+			last_duration = img_track_get_end_time(track);
+			if (last_duration > total_time)
+				total_time = last_duration;
 		}
 	}
+	if (total_time == img->total_time)
+		return total_time;
+
 	total_time_string = img_convert_time_to_string(total_time);
 	gtk_label_set_text(GTK_LABEL(img->total_time_label), total_time_string);
 	g_free(total_time_string);
@@ -1641,6 +1797,11 @@ void img_timeline_play_audio(media_timeline *media, img_window_struct *img, gdou
 {
 	ImgMediaAudioButtonPrivate *priv = img_media_audio_button_get_private_struct((ImgMediaAudioButton*)media->button);
 	GThread *playback_thread;
+
+	// The samples of a project being opened may not be read yet
+	img_assets_ensure_loaded(img, media);
+	if (priv->audio_data == NULL)
+		return;
 	
 	g_mutex_lock(&priv->audio_data->play_mutex);
 	g_atomic_int_set(&priv->audio_data->is_playing, TRUE);
@@ -1672,11 +1833,14 @@ void img_timeline_update_audio_states(img_window_struct *img, gdouble current_ti
 {
     if (img->preview_is_running) 
 	{
-		GArray* active_media = img_timeline_get_active_audio_media(img->timeline, current_time);
-        for (gint i = 0; i < active_media->len; i++) 
+		ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
+		ImgTimelineIter iter;
+		media_timeline *media;
+
+		img_tracks_iter_init(&iter, priv->tracks, current_time);
+        while (img_tracks_iter_next(&iter, &media))
 		{
-			media_timeline *media = g_array_index(active_media, media_timeline *, i);
-			if (!media->is_playing)
+			if (media->media_type == 1 && !media->is_playing)
 			{
 				//g_print("Aggiungo %d - %s\n",media->id,img_get_media_filename(img,media->id));
 				img->media_playing = g_slist_append(img->media_playing, media);
@@ -1685,7 +1849,6 @@ void img_timeline_update_audio_states(img_window_struct *img, gdouble current_ti
 				img_timeline_play_audio(media, img, current_time);
 			}
 		}
-	    g_array_free(active_media, FALSE);
     }
     else
 		g_slist_foreach(img->media_playing, (GFunc)  img_timeline_stop_audio, img);
@@ -1694,46 +1857,316 @@ void img_timeline_update_audio_states(img_window_struct *img, gdouble current_ti
 GArray *img_timeline_get_active_media_at_given_time(GtkWidget *timeline, gdouble current_time)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
-	Track *track;
+
+	return img_tracks_get_active_media_at_given_time(priv->tracks, current_time);
+}
+
+GArray *img_tracks_get_active_media_at_given_time(GArray *tracks, gdouble current_time)
+{
+	ImgTimelineIter iter;
 	media_timeline *item;
 	GArray* active_elements;
-	gint item_end;
-	
+
 	active_elements =  g_array_new(FALSE, TRUE, sizeof(media_timeline *));
-	
-	for (gint i = 0; i < priv->tracks->len; i++)
+
+	img_tracks_iter_init(&iter, tracks, current_time);
+	while (img_tracks_iter_next(&iter, &item))
+		g_array_append_val(active_elements, item);
+
+	return  active_elements;
+}
+
+static gint img_track_compare_entries(gconstpointer a, gconstpointer b)
+{
+	const TrackIndexEntry *entry_a = a;
+	const TrackIndexEntry *entry_b = b;
+
+	return (entry_a->start_time > entry_b->start_time) - (entry_a->start_time < entry_b->start_time);
+}
+
+/* The index tree is a segment tree stored as an array: node 1 is the
+ * root, the children of node n are 2n and 2n + 1 and the leaves, from
+ * the size of the tree on, hold the end times of the index entries. Each
+ * node holds the largest end time under it, so the entries still playing
+ * at a given time are found without walking the ones which have ended */
+static gint img_track_get_tree_size(Track *track)
+{
+	return track->index_tree->len / 2;
+}
+
+/* Sets the leaves of the entries from first to last and the nodes above them */
+static void img_track_update_max_end_time(Track *track, gint first, gint last)
+{
+	TrackIndexEntry *entries = (TrackIndexEntry *) track->index->data;
+	gdouble *tree = (gdouble *) track->index_tree->data;
+	gint size = img_track_get_tree_size(track);
+	gint node;
+
+	for (gint i = first; i <= last; i++)
 	{
-		track = g_array_index(priv->tracks, Track *, i);
-		for (gint j = 0; j < track->items->len; j++)
+		node = size + i;
+		tree[node] = entries[i].end_time;
+		for (node /= 2; node > 0; node /= 2)
+			tree[node] = MAX(tree[2 * node], tree[2 * node + 1]);
+	}
+}
+
+static void img_track_build_tree(Track *track)
+{
+	gdouble *tree;
+	gint size = 1;
+
+	while (size < track->index->len)
+		size *= 2;
+
+	if (track->index_tree == NULL)
+		track->index_tree = g_array_new(FALSE, FALSE, sizeof(gdouble));
+	g_array_set_size(track->index_tree, 2 * size);
+
+	// The leaves past the last entry are never playing
+	tree = (gdouble *) track->index_tree->data;
+	for (gint i = 0; i < size; i++)
+		tree[size + i] = i < track->index->len ? g_array_index(track->index, TrackIndexEntry, i).end_time : -G_MAXDOUBLE;
+	for (gint node = size - 1; node > 0; node--)
+		tree[node] = MAX(tree[2 * node], tree[2 * node + 1]);
+}
+
+/* Returns the first entry from first to last ending after time, -1 if
+ * none does. The subtrees which have all ended are skipped whole */
+static gint img_track_find_playing(Track *track, gint first, gint last, gdouble time)
+{
+	gdouble *tree = (gdouble *) track->index_tree->data;
+	gint size = img_track_get_tree_size(track);
+	gint node;
+
+	if (first > last)
+		return -1;
+
+	node = size + first;
+	while (tree[node] <= time)
+	{
+		// Go up while node is a right child, then to the subtree on its right
+		while (node & 1)
+			node /= 2;
+		if (node == 0)
+			return -1;
+		node++;
+	}
+	while (node < size)
+		node = tree[2 * node] > time ? 2 * node : 2 * node + 1;
+
+	return node - size <= last ? node - size : -1;
+}
+
+static GArray *img_track_get_index(Track *track)
+{
+	TrackIndexEntry *entry;
+	media_timeline *item;
+
+	if (track->index_valid)
+		return track->index;
+
+	if (track->index == NULL)
+		track->index = g_array_sized_new(FALSE, FALSE, sizeof(TrackIndexEntry), track->items->len);
+	g_array_set_size(track->index, track->items->len);
+
+	for (gint j = 0; j < track->items->len; j++)
+	{
+		item = g_array_index(track->items, media_timeline *, j);
+		entry = &g_array_index(track->index, TrackIndexEntry, j);
+		entry->start_time = item->start_time;
+		entry->end_time = item->start_time + item->duration;
+		entry->item = item;
+	}
+	/* g_array_sort() is stable so items starting together
+	 * keep the order they have on the track */
+	g_array_sort(track->index, img_track_compare_entries);
+	img_track_build_tree(track);
+	track->index_valid = TRUE;
+
+	return track->index;
+}
+
+/* To be called when items are added to or removed from the track,
+ * the index is rebuilt the next time it is queried */
+void img_track_invalidate_index(Track *track)
+{
+	track->index_valid = FALSE;
+}
+
+void img_track_free_index(Track *track)
+{
+	if (track->index)
+		g_array_free(track->index, TRUE);
+	if (track->index_tree)
+		g_array_free(track->index_tree, TRUE);
+	track->index = NULL;
+	track->index_tree = NULL;
+	track->index_valid = FALSE;
+}
+
+gdouble img_track_get_end_time(Track *track)
+{
+	GArray *index = img_track_get_index(track);
+
+	if (index->len == 0)
+		return 0;
+
+	return g_array_index(track->index_tree, gdouble, 1);
+}
+
+/* Moves the entry of an item whose start time or duration changed to its
+ * new place, old_start_time being its start time before the change */
+void img_tracks_update_item(GArray *tracks, media_timeline *item, gdouble old_start_time)
+{
+	TrackIndexEntry *entries, entry;
+	Track *track;
+	gint lo, hi, mid, pos, old_pos;
+
+	for (gint i = 0; i < tracks->len; i++)
+	{
+		track = g_array_index(tracks, Track *, i);
+		if (! track->index_valid)
+			continue;
+
+		entries = (TrackIndexEntry *) track->index->data;
+		lo = 0;
+		hi = track->index->len;
+		while (lo < hi)
 		{
-			item = g_array_index(track->items, media_timeline *, j);
-			item_end = item->start_time + item->duration;
-			if (current_time >= item->start_time && current_time < item_end)
-				g_array_append_val(active_elements, item);
+			mid = (lo + hi) / 2;
+			if (entries[mid].start_time < old_start_time)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (pos = lo; pos < track->index->len && entries[pos].start_time == old_start_time; pos++)
+		{
+			if (entries[pos].item == item)
+				break;
+		}
+		if (pos == track->index->len || entries[pos].item != item)
+			continue;
+
+		entry = entries[pos];
+		entry.start_time = item->start_time;
+		entry.end_time = item->start_time + item->duration;
+
+		old_pos = pos;
+		while (pos > 0 && entries[pos - 1].start_time > entry.start_time)
+		{
+			entries[pos] = entries[pos - 1];
+			pos--;
 		}
+		while (pos < track->index->len - 1 && entries[pos + 1].start_time < entry.start_time)
+		{
+			entries[pos] = entries[pos + 1];
+			pos++;
+		}
+		entries[pos] = entry;
+		img_track_update_max_end_time(track, MIN(pos, old_pos), MAX(pos, old_pos));
+		return;
 	}
-	return  active_elements;;
+
+	/* The item was changed somewhere without updating the index */
+	for (gint i = 0; i < tracks->len; i++)
+		img_track_invalidate_index(g_array_index(tracks, Track *, i));
 }
 
-GArray *img_timeline_get_selected_items(GtkWidget *timeline)
+/* Returns the last entry starting up to time */
+static gint img_track_find_last_started(GArray *index, gdouble time)
+{
+	TrackIndexEntry *entries = (TrackIndexEntry *) index->data;
+	gint lo, hi, mid;
+
+	lo = 0;
+	hi = index->len;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (entries[mid].start_time <= time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+/* Returns the item painted on top at the given time on the track */
+static media_timeline *img_track_get_item_at(Track *track, gdouble time)
+{
+	GArray *index;
+	gint last, i, top = -1;
+
+	index = img_track_get_index(track);
+	last = img_track_find_last_started(index, time);
+	for (i = img_track_find_playing(track, 0, last, time); i >= 0; i = img_track_find_playing(track, i + 1, last, time))
+		top = i;
+
+	return top >= 0 ? g_array_index(index, TrackIndexEntry, top).item : NULL;
+}
+
+void img_tracks_iter_init(ImgTimelineIter *iter, GArray *tracks, gdouble time)
+{
+	img_tracks_iter_init_range(iter, tracks, time, time);
+}
+
+void img_tracks_iter_init_range(ImgTimelineIter *iter, GArray *tracks, gdouble start_time, gdouble end_time)
+{
+	iter->tracks = tracks;
+	iter->start_time = start_time;
+	iter->end_time = end_time;
+	iter->track_nr = 0;
+	iter->entry_nr = -1;
+	iter->last_nr = -1;
+}
+
+/* Returns the items with start_time <= end time and start_time + duration
+ * > start time of the iter, for a single time the ones playing at it. In
+ * a track they come sorted by start time */
+gboolean img_tracks_iter_next(ImgTimelineIter *iter, media_timeline **item)
 {
-	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
 	Track *track;
-	media_timeline *item;
-	GArray* selected_items;
+	GArray *index;
+	gint i;
 
-	selected_items = g_array_new(FALSE, TRUE, sizeof(media_timeline *));
-	
-	for (gint i = 0; i < priv->tracks->len; i++)
+	while (iter->track_nr < iter->tracks->len)
 	{
-		track = g_array_index(priv->tracks, Track *, i);
-		for (gint j = 0; j < track->items->len; j++)
+		track = g_array_index(iter->tracks, Track *, iter->track_nr);
+		index = img_track_get_index(track);
+		if (iter->entry_nr < 0)
 		{
-			item = g_array_index(track->items, media_timeline *, j);
-			if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)))
-				g_array_append_val(selected_items, item);
+			iter->entry_nr = 0;
+			iter->last_nr = img_track_find_last_started(index, iter->end_time);
+		}
+
+		// Each item costs a walk down the index tree, whatever ended before is skipped
+		i = img_track_find_playing(track, iter->entry_nr, iter->last_nr, iter->start_time);
+		if (i >= 0)
+		{
+			iter->entry_nr = i + 1;
+			*item = g_array_index(index, TrackIndexEntry, i).item;
+			return TRUE;
 		}
+		iter->track_nr++;
+		iter->entry_nr = -1;
 	}
+	return FALSE;
+}
+
+GArray *img_timeline_get_selected_items(GtkWidget *timeline)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
+	GHashTableIter iter;
+	gpointer item;
+	GArray* selected_items;
+
+	selected_items = g_array_sized_new(FALSE, TRUE, sizeof(media_timeline *), g_hash_table_size(priv->selected_items));
+	
+	g_hash_table_iter_init(&iter, priv->selected_items);
+	while (g_hash_table_iter_next(&iter, &item, NULL))
+		g_array_append_val(selected_items, item);
+
 	return selected_items;
 }
 
@@ -1812,3 +2245,224 @@ void img_timeline_set_media_properties(img_window_struct *img, media_timeline *i
 		g_signal_handlers_unblock_by_func(img->media_volume, (gpointer)img_volume_value_changed, img);
 	}
 }
+
+gboolean img_timeline_item_is_selected(media_timeline *item)
+{
+	if (item->button)
+		return gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button));
+
+	return item->is_toggled;
+}
+
+void img_timeline_select_item(GtkWidget *timeline, media_timeline *item, gboolean selected)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
+
+	if (item->button)
+	{
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(item->button), selected);
+		return;
+	}
+	if (item->is_toggled == selected)
+		return;
+
+	item->is_toggled = selected;
+	if (selected)
+		g_hash_table_add(priv->selected_items, item);
+	else
+		g_hash_table_remove(priv->selected_items, item);
+	gtk_widget_queue_draw_area(timeline, item->start_time * priv->pixels_per_second - 1, item->timeline_y - 1,
+								item->duration * priv->pixels_per_second + 2, TRACK_HEIGHT + 2);
+}
+
+/* Past IMG_TIMELINE_VIRTUAL_THRESHOLD media the picture and text media
+ * lose their button and are painted by img_timeline_draw() instead, so
+ * only the ones in view cost something. It is turned off once all the
+ * media have been deleted */
+static void img_timeline_set_virtualized(GtkWidget *timeline, gboolean virtualized, ImgMediaRegistry *media_registry)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
+	Track *track;
+	media_timeline *item;
+
+	priv->virtualized = virtualized;
+	priv->media_registry = media_registry;
+	priv->pressed_item = NULL;
+	gtk_widget_set_has_tooltip(timeline, virtualized);
+	if (! virtualized)
+	{
+		g_hash_table_remove_all(priv->thumbnails);
+		return;
+	}
+
+	for (gint i = 0; i < priv->tracks->len; i++)
+	{
+		track = g_array_index(priv->tracks, Track *, i);
+		for (gint j = 0; j < track->items->len; j++)
+		{
+			item = g_array_index(track->items, media_timeline *, j);
+			if (item->media_type == 1 || item->button == NULL)
+				continue;
+
+			item->is_toggled = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button));
+			gtk_widget_destroy(item->button);
+			item->button = NULL;
+		}
+	}
+	gtk_widget_queue_draw(timeline);
+}
+
+/* Returns the thumbnail painted for the picture media id, made the first
+ * time it is painted from the thumbnail store, as the image of the
+ * buttons. NULL if the file can't be read, which is remembered too */
+static cairo_surface_t *img_timeline_get_thumbnail(ImgTimelinePrivate *priv, gint id)
+{
+	cairo_surface_t *surface = NULL;
+	media_struct *entry;
+	GdkPixbuf *pix = NULL;
+	cairo_t *cr;
+
+	if (g_hash_table_lookup_extended(priv->thumbnails, GINT_TO_POINTER(id), NULL, (gpointer *) &surface))
+		return surface;
+
+	entry = priv->media_registry ? img_media_registry_lookup(priv->media_registry, id) : NULL;
+	if (entry)
+		pix = img_thumbnail_get(entry->full_path, -1, 45);
+	if (pix)
+	{
+		surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, gdk_pixbuf_get_width(pix), gdk_pixbuf_get_height(pix));
+		cr = cairo_create(surface);
+		gdk_cairo_set_source_pixbuf(cr, pix, 0, 0);
+		cairo_paint(cr);
+		cairo_destroy(cr);
+		g_object_unref(pix);
+	}
+	g_hash_table_insert(priv->thumbnails, GINT_TO_POINTER(id), surface);
+
+	return surface;
+}
+
+static void img_timeline_paint_item(ImgTimelinePrivate *priv, cairo_t *cr, media_timeline *item)
+{
+	cairo_surface_t *surface;
+	gdouble x, width;
+
+	x = item->start_time * priv->pixels_per_second;
+	width = item->duration * priv->pixels_per_second;
+
+	// Same colors as the timeline-button CSS class
+	cairo_save(cr);
+	cairo_rectangle(cr, x + 0.5, item->timeline_y + 0.5, width - 1, TRACK_HEIGHT - 1);
+	if (img_timeline_item_is_selected(item))
+		cairo_set_source_rgb(cr, 0x35 / 255.0, 0x84 / 255.0, 0xe4 / 255.0);
+	else if (priv->dark_theme)
+		cairo_set_source_rgb(cr, 0xA9 / 255.0, 0xA9 / 255.0, 0xA9 / 255.0);
+	else
+		cairo_set_source_rgb(cr, 0xF0 / 255.0, 0xF0 / 255.0, 0xF0 / 255.0);
+	cairo_fill_preserve(cr);
+	if (priv->dark_theme)
+		cairo_set_source_rgb(cr, 1, 1, 1);
+	else
+		cairo_set_source_rgb(cr, 0, 0, 0);
+	cairo_set_line_width(cr, 1);
+	cairo_stroke_preserve(cr);
+	cairo_clip(cr);
+
+	surface = item->media_type == 0 ? img_timeline_get_thumbnail(priv, item->id) : NULL;
+	if (surface)
+	{
+		cairo_set_source_surface(cr, surface, x + 1, item->timeline_y + (TRACK_HEIGHT - 45) / 2.0);
+		cairo_paint(cr);
+	}
+	cairo_restore(cr);
+}
+
+/* Paints the media without button which are in the area being drawn */
+static void img_timeline_draw_virtual_items(GtkWidget *timeline, cairo_t *cr)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
+	ImgTimelineIter iter;
+	media_timeline *item;
+	gdouble x1, y1, x2, y2;
+
+	cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+	img_tracks_iter_init_range(&iter, priv->tracks, x1 / priv->pixels_per_second, x2 / priv->pixels_per_second);
+	while (img_tracks_iter_next(&iter, &item))
+	{
+		if (item->button || item->timeline_y + TRACK_HEIGHT < y1 || item->timeline_y > y2)
+			continue;
+
+		img_timeline_paint_item(priv, cr, item);
+	}
+}
+
+/* Returns the painted media under the given point of the timeline */
+static media_timeline *img_timeline_get_item_at(GtkWidget *timeline, gdouble x, gdouble y)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
+	media_timeline *item;
+	gint track_nr;
+
+	if (! priv->virtualized)
+		return NULL;
+
+	track_nr = img_timeline_get_track_at_position(timeline, y, NULL);
+	if (track_nr < 0)
+		return NULL;
+
+	item = img_track_get_item_at(g_array_index(priv->tracks, Track *, track_nr), x / priv->pixels_per_second);
+	if (item && item->button)
+		return NULL;
+
+	return item;
+}
+
+static void img_timeline_media_toggled(GtkToggleButton *button, GtkWidget *timeline)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
+	media_timeline *item;
+
+	item = g_object_get_data(G_OBJECT(button), "mem_address");
+	if (gtk_toggle_button_get_active(button))
+		g_hash_table_add(priv->selected_items, item);
+	else
+		g_hash_table_remove(priv->selected_items, item);
+}
+
+static gboolean img_timeline_drag_tick(GtkWidget *timeline, GdkFrameClock *frame_clock, img_window_struct *img)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)timeline);
+	media_timeline *item = priv->drag_item;
+
+	priv->drag_tick_id = 0;
+	priv->drag_item = NULL;
+	if (item && item->button_pressed)
+		img_timeline_media_drag(img, item, priv->drag_x - item->old_x);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* The motion events only record where the pointer is, the media
+ * are moved once per frame to the last position received */
+static void img_timeline_queue_drag(img_window_struct *img, media_timeline *item, gdouble x)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
+
+	priv->drag_item = item;
+	priv->drag_x = x;
+	if (priv->drag_tick_id == 0)
+		priv->drag_tick_id = gtk_widget_add_tick_callback(img->timeline, (GtkTickCallback) img_timeline_drag_tick, img, NULL);
+}
+
+/* Applies the drag still waiting for its frame, so
+ * the media end where the button was released */
+static void img_timeline_flush_drag(img_window_struct *img)
+{
+	ImgTimelinePrivate *priv = img_timeline_get_instance_private((ImgTimeline*)img->timeline);
+
+	if (priv->drag_tick_id == 0)
+		return;
+
+	gtk_widget_remove_tick_callback(img->timeline, priv->drag_tick_id);
+	img_timeline_drag_tick(img->timeline, NULL, img);
+}
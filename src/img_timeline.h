@@ -25,6 +25,15 @@
 
 #define BASE_SCALE 10
 
+/* Number of media on the timeline past which the picture and
+ * text media are painted by the timeline instead of being buttons */
+#define IMG_TIMELINE_VIRTUAL_THRESHOLD 500
+
+/* Height of the time ruler above the tracks and width of the
+ * pieces it is painted in, kept until the zoom changes */
+#define IMG_TIMELINE_RULER_HEIGHT 32
+#define IMG_TIMELINE_TILE_WIDTH 256
+
 G_BEGIN_DECLS
 
 struct _ImgTimeline
@@ -43,6 +52,21 @@ typedef struct _ImgTimelinePrivate
 	gboolean dark_theme;
 	gdouble pixels_per_second;
 	GArray *tracks;
+
+	gboolean virtualized;
+	ImgMediaRegistry *media_registry;		// Gives the files of the painted picture media
+	GHashTable *thumbnails;						// Their 45 pixels high thumbnails by media id
+	struct _media_timeline *pressed_item;	// Painted media being clicked or dragged
+
+	GHashTable *selected_items;					// Set of the media selected on the timeline
+	struct _media_timeline *drag_item;		// Media whose drag waits for the next frame
+	gdouble drag_x;									// Pointer x on the timeline for that drag
+	guint drag_tick_id;
+
+	GHashTable *ruler_tiles;						// Surfaces of the ruler by tile number
+	gdouble ruler_tiles_scale;					// pixels_per_second the tiles were painted for
+	gint ruler_tiles_width;
+	gboolean ruler_tiles_dark;
 	
 	gboolean rubber_band_active;
     gdouble rubber_band_start_x;
@@ -152,8 +176,10 @@ struct _media_timeline
     gboolean 		is_positioned;			// TRUE/FALSE to center it only once when added for the first time to the timeline
     gboolean 		is_selected;				// TRUE/FALSE when being clicked in the image area for panning and rotation
     gboolean 		is_resizing;				// TRUE/FALSE if a resizing operation is in progress
+    gboolean 		is_toggled;				// Selected on the timeline, used when the media has no button
     gboolean 		to_be_deleted;		// This is for multiple deletion when it occurs multiple times on the timeline
     gboolean 		is_playing;				// Audio flag needed during the preview
+    gboolean 		is_loading;				// Its surface or its samples are still being read in the background
     gboolean 		flipped_horizontally;
     gboolean 		flipped_vertically;
     gboolean 		draw_horizontal_line;
@@ -168,17 +194,42 @@ struct _media_timeline
 	media_text	*text;					/* Pointer to text structure */
 };
 
+/* The items of a track sorted by start time */
+typedef struct _TrackIndexEntry
+{
+	gdouble start_time;
+	gdouble end_time;
+	media_timeline *item;
+} TrackIndexEntry;
+
 typedef struct _Track
 {
 	GArray *items;
+	GArray *index;								// TrackIndexEntry, rebuilt when index_valid is FALSE
+	GArray *index_tree;						// Largest end time under each node of a segment tree over index
 	gchar *background_color;
+	GdkRGBA background_rgba;					// background_color parsed once
 	gint type;
 	gint order;
 	gdouble	last_media_posX;
 	gboolean is_selected;
 	gboolean is_default;
+	gboolean index_valid;
 } Track;
 
+/* Walks the items playing at a given time, or during a time range,
+ * without allocating,
+ * track after track in the order of the tracks array */
+typedef struct _ImgTimelineIter
+{
+	GArray *tracks;
+	gdouble start_time;
+	gdouble end_time;
+	gint track_nr;
+	gint entry_nr;
+	gint last_nr;
+} ImgTimelineIter;
+
 enum
 {
     SIGNAL_TIME_CHANGED,
@@ -197,6 +248,7 @@ ImgTimelinePrivate* img_timeline_get_private_struct(GtkWidget *);
 
 void img_timeline_start_stop_preview(GtkWidget *, img_window_struct *);
 void img_timeline_preview_update(img_window_struct *);
+void img_timeline_preview_seek(img_window_struct *, gdouble);
 gboolean img_timeline_preview_timeout(img_window_struct *);
 
 void img_timeline_set_total_time							(ImgTimeline *, gint );
@@ -214,6 +266,15 @@ GArray *img_timeline_get_active_audio_media		(GtkWidget *, gdouble);
 GArray *img_timeline_get_active_text_media			(GtkWidget *, gdouble);
 GArray *img_timeline_get_selected_items				(GtkWidget *);
 GArray *img_timeline_get_active_media_at_given_time(GtkWidget *, gdouble);
+GArray *img_tracks_get_active_picture_media			(GArray *, gdouble);
+GArray *img_tracks_get_active_media_at_given_time	(GArray *, gdouble);
+void img_track_invalidate_index								(Track *);
+void img_track_free_index										(Track *);
+gdouble img_track_get_end_time								(Track *);
+void img_tracks_update_item									(GArray *, media_timeline *, gdouble);
+void img_tracks_iter_init											(ImgTimelineIter *, GArray *, gdouble);
+void img_tracks_iter_init_range								(ImgTimelineIter *, GArray *, gdouble, gdouble);
+gboolean img_tracks_iter_next									(ImgTimelineIter *, media_timeline **);
 void img_timeline_go_start_time								(GtkWidget *, img_window_struct *);
 void img_timeline_go_final_time(							GtkWidget *, img_window_struct *);
 void img_timeline_play_audio									(media_timeline *, img_window_struct *, double);
@@ -221,6 +282,8 @@ void img_timeline_stop_audio									(media_timeline *, img_window_struct *);
 void img_timeline_update_audio_states					(img_window_struct *, double );
 gboolean img_timeline_check_for_media_audio		(GtkWidget *);
 void img_timeline_set_media_properties				(img_window_struct *, media_timeline *);
+gboolean img_timeline_item_is_selected					(media_timeline *);
+void img_timeline_select_item									(GtkWidget *, media_timeline *, gboolean);
 
 //Timeline events
 gboolean img_timeline_scroll_event					(GtkWidget *, GdkEventScroll *, GtkWidget *);
@@ -230,6 +293,7 @@ gboolean img_timeline_motion_notify				(GtkWidget *, GdkEventMotion *event, img_
 gboolean img_timeline_mouse_button_press 	(GtkWidget *, GdkEventButton *event, img_window_struct *);
 gboolean img_timeline_mouse_button_release (GtkWidget *, GdkEvent *event, img_window_struct *);
 gboolean img_timeline_key_press					(GtkWidget *, GdkEventKey *, img_window_struct *);
+gboolean img_timeline_query_tooltip				(GtkWidget *, gint, gint, gboolean, GtkTooltip *, img_window_struct *);
 void		img_timeline_drag_data_received 	(GtkWidget *, GdkDragContext *, gint , gint , GtkSelectionData *, guint , guint , img_window_struct *);
 void 		img_timeline_drag_data_get				(GtkWidget *, GdkDragContext *, GtkSelectionData *, guint , guint , img_window_struct *);
 
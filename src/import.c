@@ -0,0 +1,285 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#include "import.h"
+#include "support.h"
+
+/* One file to import. The worker fills media and thumbnail, media
+ * stays NULL when the file is not a picture, an audio or a video */
+typedef struct _ImgImportJob
+{
+	gchar			*full_path;
+	media_struct	*media;
+	GdkPixbuf		*thumbnail;
+} ImgImportJob;
+
+/* The files are probed and thumbnailed by a pool of threads. The jobs
+ * done are given back to the GUI through results and added to the
+ * media library a batch at a time from an idle callback */
+struct _ImgImport
+{
+	img_window_struct	*img;
+	GThreadPool			*pool;
+	GAsyncQueue			*results;
+	GCancellable			*cancellable;
+	GHashTable			*pending;			/* Paths queued and not in the library yet */
+	GString				*unsupported;
+	gint						total;
+	gint						done;
+	gint						flush_pending;
+};
+
+static void img_import_probe(ImgImportJob *, ImgImport *);
+static gboolean img_import_flush(ImgImport *);
+static void img_import_free(ImgImport *);
+
+static void img_import_free_job(ImgImportJob *job)
+{
+	g_free(job->full_path);
+	if (job->media)
+		img_free_media_struct(job->media);
+	if (job->thumbnail)
+		g_object_unref(job->thumbnail);
+	g_slice_free(ImgImportJob, job);
+}
+
+static void img_import_update_progress(ImgImport *import)
+{
+	gchar *string;
+
+	string = g_strdup_printf(_("Importing %d of %d"), import->done, import->total);
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(import->img->import_pbar), (gdouble) import->done / import->total);
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(import->img->import_pbar), string);
+	g_free(string);
+}
+
+/* Queues the files not in the library yet. The media are added to the
+ * library while the files are being read, the import of the files
+ * chosen while another one is running joins the running one */
+void img_import_media(img_window_struct *img, GSList *filenames)
+{
+	ImgImport *import = img->import;
+	ImgImportJob *job;
+
+	/* A cancelled import is left to drop its last jobs on its own */
+	if (import == NULL || g_cancellable_is_cancelled(import->cancellable))
+	{
+		import = g_new0(ImgImport, 1);
+		import->img = img;
+		import->results = g_async_queue_new();
+		import->cancellable = g_cancellable_new();
+		import->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		import->unsupported = g_string_new(NULL);
+		import->pool = g_thread_pool_new((GFunc) img_import_probe, import, g_get_num_processors(), FALSE, NULL);
+		img->import = import;
+	}
+
+	for (GSList *list = filenames; list; list = list->next)
+	{
+		if (img_find_media_in_list(img, list->data) || g_hash_table_contains(import->pending, list->data))
+			continue;
+
+		g_hash_table_add(import->pending, g_strdup(list->data));
+		job = g_slice_new0(ImgImportJob);
+		job->full_path = g_strdup(list->data);
+		import->total++;
+		g_thread_pool_push(import->pool, job, NULL);
+	}
+
+	if (import->total == 0)
+	{
+		img_import_free(import);
+		return;
+	}
+	img_import_update_progress(import);
+	gtk_widget_show(img->import_progress);
+	gtk_notebook_set_current_page(GTK_NOTEBOOK(img->side_notebook), 0);
+}
+
+/* The files not read yet are skipped and the ones already read are
+ * not added to the library */
+void img_import_cancel(img_window_struct *img)
+{
+	if (img->import)
+		g_cancellable_cancel(img->import->cancellable);
+}
+
+/* Runs in the threads of the pool */
+static void img_import_probe(ImgImportJob *job, ImgImport *import)
+{
+	GFile *file;
+	GFileInfo *file_info;
+	GdkPixbufFormat *format;
+	const gchar *content_type;
+	gchar *mime_type = NULL, *type;
+	gint width, height;
+
+	if (! g_cancellable_is_cancelled(import->cancellable))
+	{
+		// Determine the mime type
+		file = g_file_new_for_path(job->full_path);
+		file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE, 0, import->cancellable, NULL);
+		if (file_info)
+		{
+			content_type = g_file_info_get_content_type(file_info);
+			if (content_type)
+				mime_type = g_content_type_get_mime_type(content_type);
+			g_object_unref(file_info);
+		}
+		g_object_unref(file);
+	}
+
+	if (mime_type && strstr(mime_type, "image"))
+	{
+		job->media = img_media_new(0, 0, job->full_path);
+		format = gdk_pixbuf_get_file_info(job->full_path, &width, &height);
+		if (format)
+		{
+			job->media->width = width;
+			job->media->height = height;
+			type = gdk_pixbuf_format_get_name(format);
+			job->media->image_type = img_media_intern_type(type);
+			g_free(type);
+		}
+		job->thumbnail = img_thumbnail_get(job->full_path, 120, 60);
+	}
+	else if (mime_type && strstr(mime_type, "audio"))
+	{
+		job->media = img_media_new(0, 1, job->full_path);
+		img_get_audio_data(job->media);
+	}
+	else if (mime_type && strstr(mime_type, "video"))
+		job->media = img_media_new(0, 2, job->full_path);
+
+	g_free(mime_type);
+
+	g_async_queue_push(import->results, job);
+	if (g_atomic_int_compare_and_exchange(&import->flush_pending, 0, 1))
+		g_idle_add((GSourceFunc) img_import_flush, import);
+}
+
+/* Called once all the jobs are done, the threads are idle */
+static void img_import_free(ImgImport *import)
+{
+	img_window_struct *img = import->img;
+
+	if (img->import == import)
+	{
+		img->import = NULL;
+		gtk_widget_hide(img->import_progress);
+	}
+	g_thread_pool_free(import->pool, FALSE, TRUE);
+	g_async_queue_unref(import->results);
+	g_object_unref(import->cancellable);
+	g_hash_table_destroy(import->pending);
+	g_string_free(import->unsupported, TRUE);
+	g_free(import);
+}
+
+static void img_import_finish(ImgImport *import)
+{
+	img_window_struct *img = import->img;
+	gchar *string = NULL;
+
+	if (import->unsupported->len > 0 && ! g_cancellable_is_cancelled(import->cancellable))
+		string = g_strconcat(_("Unsupported media:\n"), import->unsupported->str, NULL);
+
+	img_import_free(import);
+
+	/* The message dialog runs a main loop, the import is already gone */
+	if (string)
+	{
+		img_message(img, string);
+		g_free(string);
+	}
+}
+
+/* Adds the media read since the last call to the library */
+static gboolean img_import_flush(ImgImport *import)
+{
+	img_window_struct *img = import->img;
+	ImgImportJob *job;
+	GdkPixbuf *audio_icon = NULL;
+	gchar *filename;
+	gint count = 0;
+	gboolean added = FALSE;
+
+	while (count < IMG_IMPORT_BATCH_SIZE && (job = g_async_queue_try_pop(import->results)))
+	{
+		count++;
+		import->done++;
+		g_hash_table_remove(import->pending, job->full_path);
+
+		if (g_cancellable_is_cancelled(import->cancellable))
+		{
+			img_import_free_job(job);
+			continue;
+		}
+		if (job->media == NULL)
+		{
+			g_string_append(import->unsupported, job->full_path);
+			g_string_append_c(import->unsupported, '\n');
+		}
+		else
+		{
+			// The library takes over the media of the job
+			job->media->id = img->next_id++;
+			img_media_registry_add(img->media_registry, job->media);
+			img->media_nr++;
+
+			if (job->media->media_type == 1 && audio_icon == NULL)
+				audio_icon = gtk_icon_theme_load_icon(img->icon_theme, "audio-x-generic", 46, 0, NULL);
+
+			filename = g_path_get_basename(job->full_path);
+			gtk_list_store_insert_with_values(img->media_model, NULL, -1,
+											  0, job->media->media_type == 1 ? audio_icon : job->thumbnail,
+											  1, filename,
+											  2, job->media,
+											  -1);
+			g_free(filename);
+			img->current_media = job->media;
+			job->media = NULL;
+			added = TRUE;
+		}
+		img_import_free_job(job);
+	}
+	if (audio_icon)
+		g_object_unref(audio_icon);
+
+	if (added)
+		img_taint_project(img);
+
+	if (import->done == import->total)
+	{
+		img_import_finish(import);
+		return FALSE;
+	}
+	img_import_update_progress(import);
+
+	/* Keep going if more jobs are waiting, a worker pushing one after
+	 * the flag is cleared schedules a new call */
+	if (g_async_queue_length(import->results) > 0)
+		return TRUE;
+
+	g_atomic_int_set(&import->flush_pending, 0);
+	if (g_async_queue_length(import->results) > 0 && g_atomic_int_compare_and_exchange(&import->flush_pending, 0, 1))
+		return TRUE;
+
+	return FALSE;
+}
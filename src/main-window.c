@@ -121,6 +121,7 @@ img_window_struct *img_create_window(gboolean dark_theme)
 	GtkWidget *content_area;
 	GtkWidget *preview_menu;
 	GtkWidget *import_menu;
+	GtkWidget *import_cancel;
 	GtkWidget *properties_menu;
 	GtkWidget *export_menu;
 	GdkPixbuf *pixbuf;
@@ -132,6 +133,7 @@ img_window_struct *img_create_window(gboolean dark_theme)
 	img_struct->background_color[2] = 0;
 	img_struct->media_nr = 0;
 	img_struct->next_id  = 1;
+	img_struct->media_registry = img_media_registry_new();
 	img_struct->maxoffx = 0;
 	img_struct->maxoffy = 0;
 	img_struct->current_point.offx = 0;
@@ -143,7 +145,8 @@ img_window_struct *img_create_window(gboolean dark_theme)
 	img_struct->video_ratio = (gdouble)1280 / 720;
 	img_struct->export_fps = 25;
     //img_struct->audio_fadeout = 5;
-	img_struct->cached_preview_surfaces = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, img_free_cached_preview_surfaces);
+	img_struct->cached_preview_surfaces = img_surface_cache_new(IMG_PREVIEW_CACHE_SIZE, (ImgSurfaceCachePinFunc) img_pin_preview_surfaces, img_struct);
+	img_struct->scrub_cache = g_queue_new();
 
 	img_struct->icon_theme = gtk_icon_theme_get_default();
 	icon = gtk_icon_theme_load_icon(img_struct->icon_theme, "imagination", 24, 0, NULL);
@@ -391,6 +394,21 @@ img_window_struct *img_create_window(gboolean dark_theme)
 	gtk_container_add (GTK_CONTAINER (	img_struct->media_iconview_swindow), img_struct->media_iconview);
 	gtk_box_pack_start (GTK_BOX(vbox), img_struct->media_iconview_swindow , TRUE, TRUE, 0);
 
+	// Progress of the media being imported, hidden when there are none
+	img_struct->import_progress = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+	gtk_widget_set_no_show_all(img_struct->import_progress, TRUE);
+	gtk_box_pack_start (GTK_BOX(vbox), img_struct->import_progress, FALSE, TRUE, 5);
+	img_struct->import_pbar = gtk_progress_bar_new();
+	gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(img_struct->import_pbar), TRUE);
+	g_object_set(img_struct->import_pbar, "valign", GTK_ALIGN_CENTER, NULL);
+	gtk_box_pack_start (GTK_BOX(img_struct->import_progress), img_struct->import_pbar, TRUE, TRUE, 0);
+	gtk_widget_show(img_struct->import_pbar);
+	import_cancel = gtk_button_new_from_icon_name("process-stop", GTK_ICON_SIZE_MENU);
+	gtk_widget_set_tooltip_text(import_cancel, _("Stop importing the media"));
+	g_signal_connect_swapped(import_cancel, "clicked", G_CALLBACK(img_import_cancel), img_struct);
+	gtk_box_pack_start (GTK_BOX(img_struct->import_progress), import_cancel, FALSE, FALSE, 0);
+	gtk_widget_show(import_cancel);
+
 	gtk_icon_view_set_item_orientation (GTK_ICON_VIEW (img_struct->media_iconview), GTK_ORIENTATION_VERTICAL);
 	gtk_icon_view_set_pixbuf_column (GTK_ICON_VIEW (img_struct->media_iconview), 0);
 	gtk_icon_view_set_column_spacing (GTK_ICON_VIEW (img_struct->media_iconview),0);
@@ -930,6 +948,7 @@ img_window_struct *img_create_window(gboolean dark_theme)
 	g_signal_connect(img_struct->timeline, 	"button-release-event",	G_CALLBACK(img_timeline_mouse_button_release), img_struct);
 	g_signal_connect(img_struct->timeline,	"motion-notify-event",	G_CALLBACK(img_timeline_motion_notify), img_struct);
 	g_signal_connect(img_struct->timeline,	"key-press-event",			G_CALLBACK(img_timeline_key_press), img_struct);
+	g_signal_connect(img_struct->timeline,	"query-tooltip",				G_CALLBACK(img_timeline_query_tooltip), img_struct);
 	g_signal_connect(img_struct->timeline,	"scroll-event",					G_CALLBACK(img_timeline_scroll_event), viewport);
 
 	// Set up CSS styling
@@ -1021,7 +1040,7 @@ void img_combo_box_transition_type_changed (GtkComboBox *combo, img_window_struc
 			for (gint q = 0; q < track->items->len; q++)
 			{
 				item = g_array_index(track->items, media_timeline *, q);
-				if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)) && item->media_type == 0)
+				if (img_timeline_item_is_selected(item) && item->media_type == 0)
 				{
 					item->render = (ImgRender)address;
 					item->transition_id = transition_id;
@@ -1059,7 +1078,7 @@ static void img_random_button_clicked(GtkButton *button, img_window_struct *img)
 			for (gint q = 0; q < track->items->len; q++)
 			{
 				item = g_array_index(track->items, media_timeline *, q);
-				if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(item->button)) && item->media_type == 0)
+				if (img_timeline_item_is_selected(item) && item->media_type == 0)
 				{
 					pixbuf = img_set_random_transition(img, item);
 					g_object_unref(pixbuf);
@@ -1411,16 +1430,21 @@ static void img_media_model_remove_media(GtkWidget *widget, img_window_struct *i
                         item = g_array_index(track->items, media_timeline *, q);
                         if (item->id == media->id)
                         {
-                            gtk_widget_destroy(item->button);
+                            img_timeline_select_item(img->timeline, item, FALSE);
+                            if (item->button)
+                                gtk_widget_destroy(item->button);
                             g_array_remove_index(track->items, q);
+                            img_track_invalidate_index(track);
                             g_free(item);
                         }
                     }
                 }
             }
-            img_free_media_struct(media);
-            img->media_nr--;
+            if (img->current_media == media)
+                img->current_media = NULL;
             gtk_list_store_remove(GTK_LIST_STORE(model), &iter);
+            img_media_registry_remove(img->media_registry, media->id);
+            img->media_nr--;
             img_taint_project(img);
             
             gtk_tree_path_free(current->data);
@@ -1594,7 +1618,7 @@ static void img_media_show_properties(GtkWidget *widget, img_window_struct *img)
 		scrolled_win = gtk_scrolled_window_new(NULL, NULL);
 		g_object_set (G_OBJECT (scrolled_win),"hscrollbar-policy",GTK_POLICY_AUTOMATIC,"vscrollbar-policy",GTK_POLICY_AUTOMATIC,"shadow-type",GTK_SHADOW_IN,NULL);
 		gtk_container_add(GTK_CONTAINER (scrolled_win), textview);
-		gtk_text_buffer_set_text(buffer, media->metadata, -1);
+		gtk_text_buffer_set_text(buffer, img_media_get_metadata(media), -1);
 		gtk_text_view_set_editable(GTK_TEXT_VIEW(textview), FALSE);
 		gtk_text_view_set_cursor_visible(GTK_TEXT_VIEW(textview), FALSE);
 		gtk_text_view_set_accepts_tab(GTK_TEXT_VIEW(textview), FALSE);
@@ -26,6 +26,7 @@
 #include "img_timeline.h"
 #include "callbacks.h"
 #include "export.h"
+#include "import.h"
 #include "text.h"
 
 img_window_struct *img_create_window(gboolean);
@@ -0,0 +1,147 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#include "media_registry.h"
+#include "support.h"
+
+/* The registry owns the media records. The rows of the media library
+ * model keep pointers to them, so a row is always removed before its
+ * record; the timeline items only refer to the media by id */
+struct _ImgMediaRegistry
+{
+	GHashTable	*by_id;		/* media_struct by id, holding the reference */
+	GHashTable	*by_path;	/* media_struct by full_path, borrowed */
+};
+
+ImgMediaRegistry *img_media_registry_new(void)
+{
+	ImgMediaRegistry *registry;
+
+	registry = g_new0(ImgMediaRegistry, 1);
+	registry->by_id = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) img_free_media_struct);
+	registry->by_path = g_hash_table_new(g_str_hash, g_str_equal);
+
+	return registry;
+}
+
+void img_media_registry_free(ImgMediaRegistry *registry)
+{
+	if (registry == NULL)
+		return;
+
+	g_hash_table_destroy(registry->by_path);
+	g_hash_table_destroy(registry->by_id);
+	g_free(registry);
+}
+
+/* The registry takes over the record */
+void img_media_registry_add(ImgMediaRegistry *registry, media_struct *media)
+{
+	img_media_registry_remove(registry, media->id);
+
+	if (media->full_path)
+		g_hash_table_insert(registry->by_path, media->full_path, media);
+	g_hash_table_insert(registry->by_id, GINT_TO_POINTER(media->id), media);
+}
+
+void img_media_registry_remove(ImgMediaRegistry *registry, gint id)
+{
+	media_struct *media;
+
+	media = g_hash_table_lookup(registry->by_id, GINT_TO_POINTER(id));
+	if (media == NULL)
+		return;
+
+	/* The path key belongs to the record so drop it first */
+	if (media->full_path && g_hash_table_lookup(registry->by_path, media->full_path) == media)
+		g_hash_table_remove(registry->by_path, media->full_path);
+	g_hash_table_remove(registry->by_id, GINT_TO_POINTER(id));
+}
+
+void img_media_registry_clear(ImgMediaRegistry *registry)
+{
+	g_hash_table_remove_all(registry->by_path);
+	g_hash_table_remove_all(registry->by_id);
+}
+
+media_struct *img_media_registry_lookup(ImgMediaRegistry *registry, gint id)
+{
+	return g_hash_table_lookup(registry->by_id, GINT_TO_POINTER(id));
+}
+
+media_struct *img_media_registry_lookup_path(ImgMediaRegistry *registry, const gchar *full_path)
+{
+	if (full_path == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(registry->by_path, full_path);
+}
+
+media_struct *img_media_new(gint id, gint media_type, const gchar *full_path)
+{
+	media_struct *media;
+
+	media = g_new0(media_struct, 1);
+	media->id = id;
+	media->media_type = media_type;
+	media->full_path = g_strdup(full_path);
+
+	return media;
+}
+
+/* Type names are shared by thousands of media so they are stored once,
+ * upper cased, in the GLib string pool and never freed */
+const gchar *img_media_intern_type(const gchar *type)
+{
+	const gchar *interned;
+	gchar *upper;
+
+	if (type == NULL)
+		return NULL;
+
+	upper = g_ascii_strup(type, -1);
+	interned = g_intern_string(upper);
+	g_free(upper);
+
+	return interned;
+}
+
+/* The metadata is only shown in the properties dialog so it is read
+ * from the file the first time it is asked for */
+const gchar *img_media_get_metadata(media_struct *media)
+{
+	AVFormatContext *fmt_ctx = NULL;
+	AVDictionaryEntry *tag = NULL;
+	GString *metadata;
+
+	if (media->metadata)
+		return media->metadata;
+
+	metadata = g_string_new(NULL);
+	if (media->full_path && avformat_open_input(&fmt_ctx, media->full_path, NULL, NULL) == 0)
+	{
+		while ((tag = av_dict_get(fmt_ctx->metadata, "", tag, AV_DICT_IGNORE_SUFFIX)))
+			g_string_append_printf(metadata, "%s: %s\n", tag->key, tag->value);
+
+		avformat_close_input(&fmt_ctx);
+	}
+	media->metadata = g_string_free(metadata, FALSE);
+
+	return media->metadata;
+}
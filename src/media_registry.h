@@ -0,0 +1,42 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#ifndef __IMG_MEDIA_REGISTRY_H__
+#define __IMG_MEDIA_REGISTRY_H__
+
+#include <gtk/gtk.h>
+#include "imagination.h"
+
+G_BEGIN_DECLS
+
+ImgMediaRegistry *img_media_registry_new(void);
+void img_media_registry_free(ImgMediaRegistry *);
+void img_media_registry_add(ImgMediaRegistry *, media_struct *);
+void img_media_registry_remove(ImgMediaRegistry *, gint);
+void img_media_registry_clear(ImgMediaRegistry *);
+media_struct *img_media_registry_lookup(ImgMediaRegistry *, gint);
+media_struct *img_media_registry_lookup_path(ImgMediaRegistry *, const gchar *);
+
+media_struct *img_media_new(gint, gint, const gchar *);
+const gchar *img_media_intern_type(const gchar *);
+const gchar *img_media_get_metadata(media_struct *);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,475 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#include <math.h>
+#include "preview.h"
+#include "img_timeline.h"
+#include "render_plan.h"
+#include "support.h"
+
+/* Where a media is painted on the preview, copied from the timeline
+ * item so that the render thread never reads the items themselves.
+ * The surface is only held while a frame showing it is composed */
+typedef struct _ImgPreviewSource
+{
+	gint					id;
+	cairo_surface_t *surface;
+	gdouble			x;
+	gdouble			y;
+} ImgPreviewSource;
+
+/* The timeline as it was at the last edit. The render thread keeps a
+ * reference while composing a frame so that an edit can replace it */
+typedef struct _ImgPreviewSnapshot
+{
+	gint					ref_count;
+	ImgRenderPlan	*plan;
+	GHashTable		*sources;			/* ImgPreviewSource by media_timeline */
+	ImgSurfaceCache *cache;			/* Where the surfaces of the sources are taken from */
+	gint					last_frame;
+	gint					area_width;		/* Size of the image area the frames are shown in */
+	gint					area_height;
+} ImgPreviewSnapshot;
+
+enum
+{
+	IMG_PREVIEW_SLOT_EMPTY,
+	IMG_PREVIEW_SLOT_RENDERING,
+	IMG_PREVIEW_SLOT_READY
+};
+
+/* Frame n is composed in the slot n % IMG_PREVIEW_RING_SIZE */
+typedef struct _ImgPreviewSlot
+{
+	gint					frame_nr;
+	gint					status;
+	cairo_surface_t *surface;			/* NULL if there is nothing to show at this time */
+} ImgPreviewSlot;
+
+struct _ImgPreviewRenderer
+{
+	img_window_struct *img;
+	GThread			*thread;
+	GMutex				mutex;
+	GCond				cond;					/* Signalled when the playhead moves or a frame is ready */
+	ImgPreviewSlot	ring[IMG_PREVIEW_RING_SIZE];
+	gdouble			fps;
+	gint					direction;			/* 1 when playing forward, -1 backward */
+	gint					next_frame;			/* Next frame to be presented */
+	guint				generation;			/* Incremented at each edit */
+	gboolean			quit;
+	ImgPreviewSnapshot *snapshot;
+};
+
+static gpointer img_preview_render_thread(gpointer);
+static cairo_surface_t *img_preview_compose(ImgPreviewSnapshot *, gdouble);
+static cairo_surface_t *img_preview_compose_segment(ImgPreviewSnapshot *, const ImgRenderSegment *, gdouble);
+static ImgPreviewSnapshot *img_preview_snapshot_new(img_window_struct *, gdouble);
+static void img_preview_snapshot_unref(ImgPreviewSnapshot *);
+static void img_preview_reset_ring(ImgPreviewRenderer *);
+
+/* Starts composing the frames following the playhead in a thread,
+ * the preview then only has to present them at the given rate */
+ImgPreviewRenderer *img_preview_renderer_new(img_window_struct *img, gdouble fps)
+{
+	ImgPreviewRenderer *renderer;
+
+	renderer = g_new0(ImgPreviewRenderer, 1);
+	renderer->img = img;
+	renderer->fps = fps;
+	renderer->direction = 1;
+	renderer->snapshot = img_preview_snapshot_new(img, fps);
+	g_mutex_init(&renderer->mutex);
+	g_cond_init(&renderer->cond);
+	img_preview_reset_ring(renderer);
+
+	renderer->thread = g_thread_new("preview", img_preview_render_thread, renderer);
+
+	return renderer;
+}
+
+void img_preview_renderer_free(ImgPreviewRenderer *renderer)
+{
+	if (renderer == NULL)
+		return;
+
+	g_mutex_lock(&renderer->mutex);
+	renderer->quit = TRUE;
+	g_cond_broadcast(&renderer->cond);
+	g_mutex_unlock(&renderer->mutex);
+	g_thread_join(renderer->thread);
+
+	img_preview_reset_ring(renderer);
+	img_preview_snapshot_unref(renderer->snapshot);
+	g_mutex_clear(&renderer->mutex);
+	g_cond_clear(&renderer->cond);
+	g_free(renderer);
+}
+
+/* Moves the playhead, the frames are then composed from the
+ * given time on in the direction the preview is playing */
+void img_preview_renderer_seek(ImgPreviewRenderer *renderer, gdouble time, gint direction)
+{
+	g_mutex_lock(&renderer->mutex);
+	renderer->next_frame = MAX(0, (gint) llround(time * renderer->fps));
+	renderer->direction = direction < 0 ? -1 : 1;
+	g_cond_broadcast(&renderer->cond);
+	g_mutex_unlock(&renderer->mutex);
+}
+
+/* Gives a new reference to the composed frame_nr and makes it the
+ * playhead, so the slots of the previous frames are reused. Returns
+ * FALSE if the frame isn't ready yet, the caller should then keep
+ * showing the previous one. The surface is NULL for an empty frame */
+gboolean img_preview_renderer_take(ImgPreviewRenderer *renderer, gint frame_nr, cairo_surface_t **surface)
+{
+	ImgPreviewSlot *slot;
+	gboolean ready;
+
+	g_mutex_lock(&renderer->mutex);
+	renderer->next_frame = frame_nr;
+	slot = &renderer->ring[frame_nr % IMG_PREVIEW_RING_SIZE];
+	ready = slot->frame_nr == frame_nr && slot->status == IMG_PREVIEW_SLOT_READY;
+	if (ready)
+		*surface = slot->surface ? cairo_surface_reference(slot->surface) : NULL;
+	g_cond_broadcast(&renderer->cond);
+	g_mutex_unlock(&renderer->mutex);
+
+	return ready;
+}
+
+/* To be called after any change of the timeline or of the preview
+ * surfaces. The frames composed so far are dropped and the following
+ * ones are composed from the timeline as it is now */
+void img_preview_invalidate(img_window_struct *img)
+{
+	ImgPreviewRenderer *renderer = img->preview_renderer;
+	ImgPreviewSnapshot *snapshot;
+
+	if (renderer == NULL)
+		return;
+
+	snapshot = img_preview_snapshot_new(img, renderer->fps);
+
+	g_mutex_lock(&renderer->mutex);
+	renderer->generation++;
+	img_preview_reset_ring(renderer);
+	img_preview_snapshot_unref(renderer->snapshot);
+	renderer->snapshot = snapshot;
+	g_cond_broadcast(&renderer->cond);
+	g_mutex_unlock(&renderer->mutex);
+}
+
+/* The render thread leaves out the pictures whose surface was dropped
+ * from the cache, the ones about to be shown are read again here */
+void img_preview_prefetch(img_window_struct *img, gdouble time)
+{
+	GArray *items;
+	media_timeline *item;
+
+	items = img_timeline_get_active_picture_media(img->timeline, time + IMG_PREVIEW_PREFETCH_TIME);
+	for (guint i = 0; i < items->len; i++)
+	{
+		item = g_array_index(items, media_timeline *, i);
+		if (item->media_type == 0 && img_surface_cache_peek(img->cached_preview_surfaces, item->id) == NULL)
+			img_get_preview_surface(img, item);
+	}
+	g_array_free(items, TRUE);
+}
+
+/* Called with the mutex held or before the thread is started. A slot
+ * being rendered is left to the thread, which drops the frame since
+ * the generation changed */
+static void img_preview_reset_ring(ImgPreviewRenderer *renderer)
+{
+	ImgPreviewSlot *slot;
+
+	for (gint i = 0; i < IMG_PREVIEW_RING_SIZE; i++)
+	{
+		slot = &renderer->ring[i];
+		if (slot->status == IMG_PREVIEW_SLOT_RENDERING)
+			continue;
+
+		if (slot->surface)
+			cairo_surface_destroy(slot->surface);
+		slot->surface = NULL;
+		slot->frame_nr = -1;
+		slot->status = IMG_PREVIEW_SLOT_EMPTY;
+	}
+}
+
+/* Composes the IMG_PREVIEW_RING_SIZE frames following the playhead,
+ * nearest first, and sleeps when they are all ready */
+static gpointer img_preview_render_thread(gpointer data)
+{
+	ImgPreviewRenderer *renderer = data;
+	ImgPreviewSnapshot *snapshot;
+	ImgPreviewSlot *slot;
+	cairo_surface_t *surface;
+	guint generation;
+	gint frame_nr;
+
+	g_mutex_lock(&renderer->mutex);
+	while (! renderer->quit)
+	{
+		slot = NULL;
+		for (gint i = 0; i < IMG_PREVIEW_RING_SIZE; i++)
+		{
+			frame_nr = renderer->next_frame + renderer->direction * i;
+			if (frame_nr < 0 || frame_nr > renderer->snapshot->last_frame)
+				break;
+
+			slot = &renderer->ring[frame_nr % IMG_PREVIEW_RING_SIZE];
+			if (slot->frame_nr != frame_nr || slot->status == IMG_PREVIEW_SLOT_EMPTY)
+				break;
+			slot = NULL;
+		}
+		if (slot == NULL || slot->status == IMG_PREVIEW_SLOT_RENDERING)
+		{
+			g_cond_wait(&renderer->cond, &renderer->mutex);
+			continue;
+		}
+
+		if (slot->surface)
+			cairo_surface_destroy(slot->surface);
+		slot->surface = NULL;
+		slot->frame_nr = frame_nr;
+		slot->status = IMG_PREVIEW_SLOT_RENDERING;
+		generation = renderer->generation;
+		snapshot = renderer->snapshot;
+		g_atomic_int_inc(&snapshot->ref_count);
+		g_mutex_unlock(&renderer->mutex);
+
+		surface = img_preview_compose(snapshot, frame_nr / renderer->fps);
+		img_preview_snapshot_unref(snapshot);
+
+		g_mutex_lock(&renderer->mutex);
+		if (generation == renderer->generation)
+		{
+			slot->surface = surface;
+			slot->status = IMG_PREVIEW_SLOT_READY;
+		}
+		else
+		{
+			if (surface)
+				cairo_surface_destroy(surface);
+			slot->frame_nr = -1;
+			slot->status = IMG_PREVIEW_SLOT_EMPTY;
+		}
+		g_cond_broadcast(&renderer->cond);
+	}
+	g_mutex_unlock(&renderer->mutex);
+
+	return NULL;
+}
+
+static void img_preview_get_size(ImgPreviewSnapshot *snapshot, const ImgRenderLayer *layers, gint nr_layers,
+									gint *width, gint *height)
+{
+	ImgPreviewSource *source;
+
+	for (gint i = 0; i < nr_layers; i++)
+	{
+		source = g_hash_table_lookup(snapshot->sources, layers[i].media);
+		if (source && source->surface)
+		{
+			*width = MAX(*width, cairo_image_surface_get_width(source->surface));
+			*height = MAX(*height, cairo_image_surface_get_height(source->surface));
+		}
+	}
+}
+
+/* Paints a source on a composite reduced by scale, from
+ * the smallest copy of its surface that is large enough */
+static void img_preview_paint_source(cairo_t *cr, ImgPreviewSource *source, gdouble x, gdouble y, gdouble scale)
+{
+	cairo_surface_t *level;
+	gdouble level_scale;
+
+	level = img_get_surface_mipmap(source->surface, scale, &level_scale);
+	cairo_save(cr);
+	cairo_scale(cr, scale, scale);
+	cairo_translate(cr, x, y);
+	cairo_scale(cr, 1.0 / level_scale, 1.0 / level_scale);
+	cairo_set_source_surface(cr, level, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+}
+
+/* Takes from the cache the surfaces of the layers, the ones dropped
+ * from it are left out of the frame. release gives them back */
+static void img_preview_hold_sources(ImgPreviewSnapshot *snapshot, const ImgRenderLayer *layers, gint nr_layers, gboolean release)
+{
+	ImgPreviewSource *source;
+
+	for (gint i = 0; i < nr_layers; i++)
+	{
+		source = g_hash_table_lookup(snapshot->sources, layers[i].media);
+		if (source == NULL)
+			continue;
+
+		if (release && source->surface)
+		{
+			cairo_surface_destroy(source->surface);
+			source->surface = NULL;
+		}
+		else if (! release && source->surface == NULL)
+			source->surface = img_surface_cache_get(snapshot->cache, source->id);
+	}
+}
+
+/* Composes the preview at the given time like the export does, with
+ * the preview surfaces. The frame is composed no larger than what
+ * the image area shows, halving its size as long as it's still large
+ * enough. Runs in the render thread */
+static cairo_surface_t *img_preview_compose(ImgPreviewSnapshot *snapshot, gdouble time)
+{
+	const ImgRenderSegment *segment;
+	cairo_surface_t *composite;
+
+	segment = img_render_plan_lookup(snapshot->plan, time);
+	if (segment == NULL || segment->nr_layers == 0)
+		return NULL;
+
+	img_preview_hold_sources(snapshot, segment->layers, segment->nr_layers, FALSE);
+	img_preview_hold_sources(snapshot, segment->next_layers, segment->nr_next_layers, FALSE);
+	composite = img_preview_compose_segment(snapshot, segment, time);
+	img_preview_hold_sources(snapshot, segment->layers, segment->nr_layers, TRUE);
+	img_preview_hold_sources(snapshot, segment->next_layers, segment->nr_next_layers, TRUE);
+
+	return composite;
+}
+
+static cairo_surface_t *img_preview_compose_segment(ImgPreviewSnapshot *snapshot, const ImgRenderSegment *segment, gdouble time)
+{
+	ImgPreviewSource *source;
+	cairo_surface_t *composite, *next_composite;
+	cairo_t *cr;
+	gint width = 0, height = 0, x, y;
+	gboolean is_transitioning;
+	gdouble progress, display_scale, scale = 1.0;
+
+	is_transitioning = segment->render && segment->nr_next_layers > 0;
+	img_preview_get_size(snapshot, segment->layers, segment->nr_layers, &width, &height);
+	if (is_transitioning)
+		img_preview_get_size(snapshot, segment->next_layers, segment->nr_next_layers, &width, &height);
+	if (width == 0 || height == 0)
+		return NULL;
+
+	display_scale = MIN((gdouble) snapshot->area_width / width, (gdouble) snapshot->area_height / height);
+	for (gint i = 0; i < IMG_MIPMAP_LEVELS && scale / 2 >= display_scale; i++)
+		scale /= 2;
+
+	composite = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ceil(width * scale), ceil(height * scale));
+	cr = cairo_create(composite);
+	for (gint i = segment->nr_layers - 1; i >= 0; i--)
+	{
+		source = g_hash_table_lookup(snapshot->sources, segment->layers[i].media);
+		if (source && source->surface)
+			img_preview_paint_source(cr, source, source->x, source->y, scale);
+	}
+	cairo_destroy(cr);
+
+	if (is_transitioning)
+	{
+		progress = 1.0 - ((segment->transition_end - time) / segment->transition_duration);
+
+		next_composite = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ceil(width * scale), ceil(height * scale));
+		cr = cairo_create(next_composite);
+		for (gint i = segment->nr_next_layers - 1; i >= 0; i--)
+		{
+			source = g_hash_table_lookup(snapshot->sources, segment->next_layers[i].media);
+			if (source && source->surface)
+			{
+				x = (width - cairo_image_surface_get_width(source->surface)) / 2;
+				y = (height - cairo_image_surface_get_height(source->surface)) / 2;
+				img_preview_paint_source(cr, source, x, y, scale);
+			}
+		}
+		cairo_destroy(cr);
+
+		cr = cairo_create(composite);
+		segment->render(cr, composite, next_composite, progress);
+		cairo_destroy(cr);
+		cairo_surface_destroy(next_composite);
+	}
+	return composite;
+}
+
+static void img_preview_source_free(gpointer data)
+{
+	ImgPreviewSource *source = data;
+
+	if (source->surface)
+		cairo_surface_destroy(source->surface);
+	g_slice_free(ImgPreviewSource, source);
+}
+
+/* Copies what the render thread needs from the timeline, the
+ * surfaces are taken from the cache when a frame is composed */
+static ImgPreviewSnapshot *img_preview_snapshot_new(img_window_struct *img, gdouble fps)
+{
+	ImgPreviewSnapshot *snapshot;
+	ImgPreviewSource *source;
+	GtkAllocation allocation;
+	GArray *tracks;
+	Track *track;
+	media_timeline *item;
+
+	tracks = img_timeline_get_private_struct(img->timeline)->tracks;
+	gtk_widget_get_allocation(img->image_area, &allocation);
+
+	snapshot = g_new0(ImgPreviewSnapshot, 1);
+	snapshot->ref_count = 1;
+	snapshot->plan = img_render_plan_new(img, tracks);
+	snapshot->sources = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, img_preview_source_free);
+	snapshot->cache = img->cached_preview_surfaces;
+	snapshot->last_frame = MAX(0, (gint) ceil(img->total_time * fps) - 1);
+	snapshot->area_width = MAX(1, allocation.width);
+	snapshot->area_height = MAX(1, allocation.height);
+
+	for (gint i = 0; i < tracks->len; i++)
+	{
+		track = g_array_index(tracks, Track *, i);
+		for (gint j = 0; j < track->items->len; j++)
+		{
+			item = g_array_index(track->items, media_timeline *, j);
+			if (item->media_type != 0)
+				continue;
+
+			source = g_slice_new(ImgPreviewSource);
+			source->id = item->id;
+			source->surface = NULL;
+			source->x = item->x;
+			source->y = item->y;
+			g_hash_table_insert(snapshot->sources, item, source);
+		}
+	}
+	return snapshot;
+}
+
+static void img_preview_snapshot_unref(ImgPreviewSnapshot *snapshot)
+{
+	if (! g_atomic_int_dec_and_test(&snapshot->ref_count))
+		return;
+
+	img_render_plan_free(snapshot->plan);
+	g_hash_table_destroy(snapshot->sources);
+	g_free(snapshot);
+}
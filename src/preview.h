@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#ifndef __IMG_PREVIEW_H__
+#define __IMG_PREVIEW_H__
+
+#include <gtk/gtk.h>
+#include "imagination.h"
+
+G_BEGIN_DECLS
+
+/* Number of frames composed ahead of the playhead */
+#define IMG_PREVIEW_RING_SIZE 8
+
+/* Largest gap in seconds between the audio heard and the preview
+ * clock for the preview to be synchronized on the audio */
+#define IMG_PREVIEW_MAX_AUDIO_DRIFT 0.5
+
+/* How far ahead of the playhead, in seconds, the surfaces dropped from
+ * the cache are read again */
+#define IMG_PREVIEW_PREFETCH_TIME 1.0
+
+typedef struct _ImgPreviewRenderer ImgPreviewRenderer;
+
+ImgPreviewRenderer *img_preview_renderer_new(img_window_struct *, gdouble);
+void img_preview_renderer_free(ImgPreviewRenderer *);
+void img_preview_renderer_seek(ImgPreviewRenderer *, gdouble, gint);
+gboolean img_preview_renderer_take(ImgPreviewRenderer *, gint, cairo_surface_t **);
+void img_preview_invalidate(img_window_struct *);
+void img_preview_prefetch(img_window_struct *, gdouble);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#include "render_plan.h"
+#include "support.h"
+
+static gboolean img_render_plan_is_visual(media_timeline *item)
+{
+	return item->media_type == 0 || item->media_type == 2 || item->media_type == 3;
+}
+
+static gint img_render_plan_compare_times(gconstpointer a, gconstpointer b)
+{
+	gdouble t1 = *(const gdouble *) a;
+	gdouble t2 = *(const gdouble *) b;
+
+	return (t1 > t2) - (t1 < t2);
+}
+
+/* Returns the visual media shown at the given time in the same
+ * order as img_tracks_get_active_media_at_given_time() */
+static ImgRenderLayer *img_render_plan_get_layers(ImgRenderPlan *plan, GArray *tracks, gdouble time, gint *nr_layers)
+{
+	GArray *layers;
+	ImgRenderLayer layer;
+	ImgTimelineIter iter;
+	media_timeline *item;
+
+	layers = g_array_new(FALSE, FALSE, sizeof(ImgRenderLayer));
+	img_tracks_iter_init(&iter, tracks, time);
+	while (img_tracks_iter_next(&iter, &item))
+	{
+		if (! img_render_plan_is_visual(item))
+			continue;
+
+		layer.media = item;
+		layer.filename = img_render_plan_get_filename(plan, item->id);
+		g_array_append_val(layers, layer);
+	}
+	*nr_layers = layers->len;
+
+	return (ImgRenderLayer *) g_array_free(layers, FALSE);
+}
+
+/* Flattens the tracks in segments. A segment starts at time 0 and at
+ * every time a media starts, ends or begins its transition, so what
+ * has to be painted doesn't change inside a segment. The media filenames
+ * are resolved here since the media library can't be walked from the
+ * export threads */
+ImgRenderPlan *img_render_plan_new(img_window_struct *img, GArray *tracks)
+{
+	ImgRenderPlan *plan;
+	ImgRenderSegment segment;
+	GArray *times, *segments;
+	Track *track;
+	media_timeline *item, *media;
+	const gchar *filename;
+	gdouble time, end_time, media_end;
+
+	plan = g_new0(ImgRenderPlan, 1);
+	plan->filenames = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+	times = g_array_new(FALSE, FALSE, sizeof(gdouble));
+	time = 0;
+	g_array_append_val(times, time);
+	for (gint i = 0; i < tracks->len; i++)
+	{
+		track = g_array_index(tracks, Track *, i);
+		for (gint j = 0; j < track->items->len; j++)
+		{
+			item = g_array_index(track->items, media_timeline *, j);
+			if (! g_hash_table_contains(plan->filenames, GINT_TO_POINTER(item->id)))
+			{
+				filename = img_get_media_filename(img, item->id);
+				if (filename)
+					g_hash_table_insert(plan->filenames, GINT_TO_POINTER(item->id), g_strdup(filename));
+			}
+			if (! img_render_plan_is_visual(item) || item->duration <= 0)
+				continue;
+
+			end_time = item->start_time + item->duration;
+			g_array_append_val(times, item->start_time);
+			g_array_append_val(times, end_time);
+			if (item->transition_id > -1 && item->render)
+			{
+				time = MAX(end_time - IMG_TRANSITION_DURATION, item->start_time);
+				g_array_append_val(times, time);
+			}
+		}
+	}
+	g_array_sort(times, img_render_plan_compare_times);
+
+	segments = g_array_new(FALSE, TRUE, sizeof(ImgRenderSegment));
+	for (gint i = 0; i + 1 < times->len; i++)
+	{
+		time = g_array_index(times, gdouble, i);
+		end_time = g_array_index(times, gdouble, i + 1);
+		if (end_time <= time)
+			continue;
+
+		memset(&segment, 0, sizeof(ImgRenderSegment));
+		segment.start_time = time;
+		segment.end_time = end_time;
+		segment.layers = img_render_plan_get_layers(plan, tracks, time, &segment.nr_layers);
+
+		for (gint l = 0; l < segment.nr_layers; l++)
+		{
+			media = segment.layers[l].media;
+			if (media->media_type == 3 && media->text && media->text->anim_id > 0)
+				segment.is_animated = TRUE;
+		}
+
+		/* Only the transition of the top media is rendered */
+		if (segment.nr_layers > 0)
+		{
+			media = segment.layers[0].media;
+			media_end = media->start_time + media->duration;
+			if (media->transition_id > -1 && media->render && time >= media_end - IMG_TRANSITION_DURATION)
+			{
+				segment.render = media->render;
+				segment.transition_end = media_end;
+				segment.transition_duration = IMG_TRANSITION_DURATION;
+				segment.next_layers = img_render_plan_get_layers(plan, tracks, media_end + 0.01, &segment.nr_next_layers);
+			}
+		}
+		g_array_append_val(segments, segment);
+	}
+	g_array_free(times, TRUE);
+
+	plan->nr_segments = segments->len;
+	plan->segments = (ImgRenderSegment *) g_array_free(segments, FALSE);
+
+	return plan;
+}
+
+void img_render_plan_free(ImgRenderPlan *plan)
+{
+	if (plan == NULL)
+		return;
+
+	for (gint i = 0; i < plan->nr_segments; i++)
+	{
+		g_free(plan->segments[i].layers);
+		g_free(plan->segments[i].next_layers);
+	}
+	g_free(plan->segments);
+	g_hash_table_destroy(plan->filenames);
+	g_free(plan);
+}
+
+/* Returns the segment containing the given time, NULL past the end */
+const ImgRenderSegment *img_render_plan_lookup(const ImgRenderPlan *plan, gdouble time)
+{
+	gint low = 0, high = plan->nr_segments - 1, middle;
+
+	while (low <= high)
+	{
+		middle = (low + high) / 2;
+		if (time < plan->segments[middle].start_time)
+			high = middle - 1;
+		else if (time >= plan->segments[middle].end_time)
+			low = middle + 1;
+		else
+			return &plan->segments[middle];
+	}
+	return NULL;
+}
+
+/* Like img_render_plan_lookup() but starts from the segment found by the
+ * previous call, which makes walking the frames in order O(1) per frame */
+const ImgRenderSegment *img_render_plan_seek(const ImgRenderPlan *plan, gint *cursor, gdouble time)
+{
+	const ImgRenderSegment *segment;
+	gint i = *cursor;
+
+	if (i < 0 || i >= plan->nr_segments || time < plan->segments[i].start_time)
+	{
+		segment = img_render_plan_lookup(plan, time);
+		*cursor = segment ? segment - plan->segments : 0;
+		return segment;
+	}
+	while (i < plan->nr_segments && time >= plan->segments[i].end_time)
+		i++;
+
+	if (i == plan->nr_segments)
+	{
+		*cursor = i - 1;
+		return NULL;
+	}
+	*cursor = i;
+	return &plan->segments[i];
+}
+
+const gchar *img_render_plan_get_filename(const ImgRenderPlan *plan, gint id)
+{
+	return g_hash_table_lookup(plan->filenames, GINT_TO_POINTER(id));
+}
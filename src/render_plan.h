@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#ifndef __IMG_RENDER_PLAN_H__
+#define __IMG_RENDER_PLAN_H__
+
+#include <gtk/gtk.h>
+#include "imagination.h"
+#include "img_timeline.h"
+
+G_BEGIN_DECLS
+
+/* Duration of the transition at the end of a media */
+#define IMG_TRANSITION_DURATION 1.5
+
+typedef struct _ImgRenderLayer
+{
+	media_timeline	*media;
+	const gchar		*filename;					/* Resolved once, owned by the plan */
+} ImgRenderLayer;
+
+/* A time range of the timeline in which the same media are shown */
+typedef struct _ImgRenderSegment
+{
+	gdouble				start_time;
+	gdouble				end_time;
+	ImgRenderLayer	*layers;						/* Top layer first */
+	gint					nr_layers;
+	gboolean			is_animated;				/* A text is animated, every frame differs */
+
+	/* Transition running during the whole segment, render is NULL if none */
+	ImgRender			render;
+	gdouble				transition_end;
+	gdouble				transition_duration;
+	ImgRenderLayer	*next_layers;				/* What the transition goes to */
+	gint					nr_next_layers;
+} ImgRenderSegment;
+
+/* The timeline flattened in sorted segments before the export.
+ * It isn't modified once built, so any thread can read it */
+typedef struct _ImgRenderPlan
+{
+	ImgRenderSegment	*segments;
+	gint					nr_segments;
+	GHashTable			*filenames;					/* Media filenames by id */
+} ImgRenderPlan;
+
+ImgRenderPlan *img_render_plan_new(img_window_struct *, GArray *);
+void img_render_plan_free(ImgRenderPlan *);
+const ImgRenderSegment *img_render_plan_lookup(const ImgRenderPlan *, gdouble);
+const ImgRenderSegment *img_render_plan_seek(const ImgRenderPlan *, gint *, gdouble);
+const gchar *img_render_plan_get_filename(const ImgRenderPlan *, gint);
+
+G_END_DECLS
+
+#endif
@@ -18,8 +18,10 @@
  */
 
 #include "support.h"
+#include "preview.h"
 
 static gboolean img_plugin_is_loaded(img_window_struct *, GModule *);
+static void img_get_transition_search_paths(gchar **);
 static gboolean filter_function(GtkTreeModel *model, GtkTreeIter *iter, img_window_struct *);
 
 GtkWidget *img_load_icon(gchar *filename, GtkIconSize size)
@@ -142,15 +144,7 @@ void img_load_available_transitions(img_window_struct *img)
 	gtk_combo_box_set_active( GTK_COMBO_BOX( img->transition_type ), 0 );
 	g_signal_handlers_unblock_by_func((gpointer)img->transition_type, (gpointer)img_combo_box_transition_type_changed, img);	
 	
-	/* Create NULL terminated array of paths that we'll be looking at */
-#if PLUGINS_INSTALLED
-	search_paths[0] = g_build_path(G_DIR_SEPARATOR_S, PACKAGE_LIB_DIR, "imagination", NULL );
-#else
-	search_paths[0] = g_strdup("./transitions");
-#endif
-	search_paths[1] = g_build_path(G_DIR_SEPARATOR_S, g_get_home_dir(), ".imagination",
-									"plugins", NULL );
-	search_paths[2] = NULL;
+	img_get_transition_search_paths(search_paths);
 
 	/* Search all paths listed in array */
 	for( path = search_paths; *path; path++ )
@@ -269,6 +263,78 @@ static gboolean img_plugin_is_loaded(img_window_struct *img, GModule *module)
 	return (g_slist_find(img->plugin_list,module) != NULL);
 }
 
+/* Create NULL terminated array of paths that we'll be looking at */
+static void img_get_transition_search_paths(gchar **search_paths)
+{
+#if PLUGINS_INSTALLED
+	search_paths[0] = g_build_path(G_DIR_SEPARATOR_S, PACKAGE_LIB_DIR, "imagination", NULL );
+#else
+	search_paths[0] = g_strdup("./transitions");
+#endif
+	search_paths[1] = g_build_path(G_DIR_SEPARATOR_S, g_get_home_dir(), ".imagination",
+									"plugins", NULL );
+	search_paths[2] = NULL;
+}
+
+/* Load the transition plugins without touching the transition combo box.
+ * Returns an hash table mapping the transition id to its render function,
+ * to be used when no main window is available (command line export) */
+GHashTable *img_get_transition_renderers(img_window_struct *img)
+{
+	GHashTable *renderers;
+	gpointer    address;
+	gchar      *search_paths[3],
+			  **path;
+
+	renderers = g_hash_table_new(g_direct_hash, g_direct_equal);
+	img_get_transition_search_paths(search_paths);
+
+	for( path = search_paths; *path; path++ )
+	{
+		GDir *dir;
+		const gchar *transition_name;
+
+		dir = g_dir_open( *path, 0, NULL );
+		if( dir == NULL )
+		{
+			g_free( *path );
+			continue;
+		}
+
+		while( (transition_name = g_dir_read_name( dir )) != NULL )
+		{
+			gchar    *fname;
+			GModule  *module;
+			void (*plugin_set_name)(gchar **, gchar ***);
+
+			fname = g_build_filename( *path, transition_name, NULL );
+			module = g_module_open( fname, G_MODULE_BIND_LOCAL );
+			g_free( fname );
+			if( module == NULL || img_plugin_is_loaded(img, module) )
+				continue;
+
+			if( g_module_symbol( module, "img_get_plugin_info", (void *)&plugin_set_name) )
+			{
+				gchar  *name,
+					  **trans,
+					  **bak;
+
+				plugin_set_name( &name, &trans );
+				for( bak = trans; *trans; trans += 3 )
+				{
+					if( g_module_symbol( module, trans[1], &address ) )
+						g_hash_table_insert(renderers, trans[2], address);
+				}
+				g_free( bak );
+			}
+			img->plugin_list = g_slist_append(img->plugin_list, module);
+		}
+		g_free( *path );
+		g_dir_close( dir );
+	}
+	return renderers;
+}
+
 void img_show_file_chooser(GtkWidget *entry, GtkEntryIconPosition icon_pos,int button, img_window_struct *img)
 {
 	GtkWidget		*file_selector;
@@ -517,15 +583,12 @@ void img_free_media_struct( media_struct *entry )
 	if (entry->full_path)
 		g_free(entry->full_path);
 
-	if (entry->image_type)
-		g_free(entry->image_type);
-		
-	if (entry->audio_type)
-		g_free(entry->audio_type);
-
+	/* The type strings are interned and must not be freed */
 	if (entry->audio_duration)
 		g_free(entry->audio_duration);
 
+	g_free(entry->metadata);
+
 	/* Free stop point list */
 	for( tmp = entry->points; tmp; tmp = g_list_next( tmp ) )
 		g_slice_free( ImgStopPoint, tmp->data );
@@ -556,6 +619,8 @@ gint img_calc_slide_duration_points( GList *list, gint   length )
 
 void img_taint_project(img_window_struct *img)
 {
+    img_preview_invalidate(img);
+    img_image_area_invalidate_cache(img);
     if (!img->project_is_modified) {
 	img->project_is_modified = TRUE;
 	img_refresh_window_title(img);
@@ -823,6 +888,15 @@ void img_message(img_window_struct *img, gchar *message)
 {
 	GtkWidget *dialog, *action_area, *image, *content_area, *box, *label;
 
+	/* No widgets when exporting from the command line */
+	if (img->headless)
+	{
+		g_printerr("imagination: %s", message);
+		if (! g_str_has_suffix(message, "\n"))
+			g_printerr("\n");
+		return;
+	}
+
 	dialog = gtk_dialog_new_with_buttons ("Imagination",
                                       GTK_WINDOW(img->imagination_window),
                                       GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
@@ -921,29 +995,12 @@ gboolean img_check_for_recent_file(img_window_struct *img, const gchar *input)
 
 gboolean img_find_media_in_list(img_window_struct *img, gchar *full_path_filename)
 {
-	GtkTreeIter iter;
-	media_struct *entry;
-
-	if( gtk_tree_model_get_iter_first(GTK_TREE_MODEL(img->media_model), &iter) )
-	{
-		do
-		{
-			gtk_tree_model_get(GTK_TREE_MODEL(img->media_model), &iter, 2, &entry, -1);
-			if (g_strcmp0(entry->full_path, full_path_filename) == 0)
-				return TRUE;
-		}
-		while( gtk_tree_model_iter_next(GTK_TREE_MODEL(img->media_model), &iter) );
-	}
-	else
-		return FALSE;
-
+	return img_media_registry_lookup_path(img->media_registry, full_path_filename) != NULL;
 }
 
 void img_get_audio_data(media_struct *media)
 {
 	AVFormatContext *fmt_ctx = NULL;
-	AVDictionaryEntry *tag = NULL;
-	char metadata[1024] = {0};
 	gchar *time = NULL;
 	gint audio_stream_index = -1;
     
@@ -969,8 +1026,7 @@ void img_get_audio_data(media_struct *media)
 	media->audio_duration = img_convert_time_to_string(duration_seconds);
 	
 	//Get the audio type
-	media->audio_type = g_strdup(fmt_ctx->iformat->long_name);
-	to_upper(&media->audio_type);
+	media->audio_type = img_media_intern_type(fmt_ctx->iformat->long_name);
 	
 	AVCodecParameters *codecpar = fmt_ctx->streams[audio_stream_index]->codecpar;
 
@@ -986,14 +1042,7 @@ void img_get_audio_data(media_struct *media)
 	//Get the channels
 	media->channels = codecpar->ch_layout.nb_channels;
 
-	//Get the metadata
-	 while ((tag = av_dict_get(fmt_ctx->metadata, "", tag, AV_DICT_IGNORE_SUFFIX)))
-	{
-		char temp[256];
-		snprintf(temp, sizeof(temp), "%s: %s\n", tag->key, tag->value);
-		strncat(media->metadata, temp, sizeof(metadata) - strlen(media->metadata)-1);
-    }
-	
+	/* The metadata is read by img_media_get_metadata() when needed */
 	avformat_close_input(&fmt_ctx);
 }
 
@@ -1122,55 +1171,242 @@ gdouble find_nearest_major_tick(gdouble pixels_per_second, gdouble x)
 
 const gchar *img_get_media_filename(img_window_struct *img, gint id)
 {
-	GtkTreeIter iter;
-	const gchar *filename;
 	media_struct *entry;
 
-	if( gtk_tree_model_get_iter_first(GTK_TREE_MODEL(img->media_model), &iter) )
+	entry = img_media_registry_lookup(img->media_registry, id);
+	return entry ? entry->full_path : NULL;
+}
+
+/* Reads the picture of the item at the preview size. Returns a new
+ * surface which isn't in the cache yet, or NULL if the file can't be read */
+cairo_surface_t *img_read_preview_surface(img_window_struct *img, media_timeline *item, const gchar *full_path)
+{
+	GdkPixbuf *pix;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+
+	pix = gdk_pixbuf_new_from_file_at_scale(full_path, img->video_size[0] * img->image_area_zoom, img->video_size[1] * img->image_area_zoom, TRUE, NULL);
+	if (pix == NULL)
+		return NULL;
+
+	item->width =  gdk_pixbuf_get_width(pix);
+	item->height = gdk_pixbuf_get_height(pix);
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, item->width, item->height);
+	cr = cairo_create(surface);
+	gdk_cairo_set_source_pixbuf(cr, pix, 0, 0);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	g_object_unref(pix);
+
+	return surface;
+}
+
+void img_create_cached_cairo_surface(img_window_struct *img, media_timeline *item, gchar *full_path)
+{
+	cairo_surface_t *surface;
+
+	if (img_surface_cache_peek(img->cached_preview_surfaces, item->id) == NULL)
 	{
-		do
-		{
-			gtk_tree_model_get(GTK_TREE_MODEL(img->media_model), &iter, 2, &entry, -1);
-			if (entry->id == id)
-			{
-				return entry->full_path;
-			}
-		}
-		while( gtk_tree_model_iter_next(GTK_TREE_MODEL(img->media_model), &iter) );
+		surface = img_read_preview_surface(img, item, full_path);
+		if (surface == NULL)
+			return;
+
+		img_surface_cache_insert(img->cached_preview_surfaces, item->id, surface);
+		img_image_area_invalidate_cache(img);
 	}
-	
-	return NULL; 
 }
 
-void img_free_cached_preview_surfaces(gpointer data)
+/* Applies the filter, the rotations and the flips of the item to a
+ * surface just read, before it is put in the cache where the render
+ * thread can see it. Takes over the reference on surface and returns
+ * the one to cache. With move_item the rotations move the item like
+ * img_rotate_surface() does */
+cairo_surface_t *img_restore_surface_effects(cairo_surface_t *surface, media_timeline *item, gboolean move_item)
 {
-	cairo_surface_t *surface = data;
-	cairo_surface_destroy(surface);
+	cairo_surface_t *effect;
+
+	img_apply_filter_on_surface(surface, item->color_filter);
+	for (gint r = 0; r < item->nr_rotations; r++)
+	{
+		effect = img_rotate_surface_data(surface);
+		if (move_item)
+			img_move_rotated_item(item, cairo_image_surface_get_width(surface), cairo_image_surface_get_height(surface));
+		cairo_surface_destroy(surface);
+		surface = effect;
+	}
+	if (item->flipped_horizontally)
+	{
+		effect = img_flip_surface_data(surface, TRUE);
+		cairo_surface_destroy(surface);
+		surface = effect;
+	}
+	if (item->flipped_vertically)
+	{
+		effect = img_flip_surface_data(surface, FALSE);
+		cairo_surface_destroy(surface);
+		surface = effect;
+	}
+	return surface;
 }
 
-void img_create_cached_cairo_surface(img_window_struct *img, media_timeline *item, gchar *full_path)
+/* Returns the preview surface of a picture, reading it again if it was
+ * dropped from the cache. NULL while the project is still being read,
+ * for the media without surface and if the file can't be read */
+cairo_surface_t *img_get_preview_surface(img_window_struct *img, media_timeline *item)
 {
-	GdkPixbuf *pix = NULL;
-	gint item_id = 0, width, height;
 	cairo_surface_t *surface;
-	cairo_t *cr;
+	const gchar *filename;
+
+	surface = img_surface_cache_lookup(img->cached_preview_surfaces, item->id);
+	if (surface || item->media_type != 0 || item->is_loading)
+		return surface;
+
+	filename = img_get_media_filename(img, item->id);
+	if (filename == NULL)
+		return NULL;
+
+	surface = img_read_preview_surface(img, item, filename);
+	if (surface == NULL)
+		return NULL;
 
-	if (! g_hash_table_contains(img->cached_preview_surfaces, GINT_TO_POINTER(item->id)))
+	// The item stays where it is, only its surface was dropped
+	surface = img_restore_surface_effects(surface, item, FALSE);
+	img_surface_cache_insert(img->cached_preview_surfaces, item->id, surface);
+	img_image_area_invalidate_cache(img);
+
+	return surface;
+}
+
+/* The surfaces of the pictures shown at the time marker and of the
+ * selected ones are never dropped from the cache */
+void img_pin_preview_surfaces(GHashTable *pinned, img_window_struct *img)
+{
+	GArray *items;
+	media_timeline *item;
+	gdouble current_time;
+
+	g_object_get(G_OBJECT(img->timeline), "time_marker_pos", &current_time, NULL);
+	items = img_timeline_get_active_picture_media(img->timeline, current_time);
+	for (guint i = 0; i < items->len; i++)
 	{
-		pix = gdk_pixbuf_new_from_file_at_scale(full_path, img->video_size[0] * img->image_area_zoom, img->video_size[1] * img->image_area_zoom, TRUE, NULL);
-		width =  gdk_pixbuf_get_width(pix);
-		height = gdk_pixbuf_get_height(pix);
-		surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-		cr = cairo_create(surface);
-		gdk_cairo_set_source_pixbuf(cr, pix, 0, 0);
-		cairo_paint(cr);
-		cairo_destroy(cr);
-		g_object_unref(pix);
-		item->width = width;
-		item->height = height;
+		item = g_array_index(items, media_timeline *, i);
+		g_hash_table_add(pinned, GINT_TO_POINTER(item->id));
+	}
+	g_array_free(items, TRUE);
+
+	items = img_timeline_get_selected_items(img->timeline);
+	for (guint i = 0; i < items->len; i++)
+	{
+		item = g_array_index(items, media_timeline *, i);
+		g_hash_table_add(pinned, GINT_TO_POINTER(item->id));
+	}
+	g_array_free(items, TRUE);
+}
+
+/* The half size copies of a preview surface, attached to it
+ * so that they are freed along with it */
+typedef struct _ImgMipmap
+{
+	cairo_surface_t *levels[IMG_MIPMAP_LEVELS];
+} ImgMipmap;
+
+static cairo_user_data_key_t img_mipmap_key;
+static GMutex img_mipmap_mutex;
+
+static void img_free_mipmap(gpointer data)
+{
+	ImgMipmap *mipmap = data;
+
+	for (gint i = 0; i < IMG_MIPMAP_LEVELS; i++)
+	{
+		if (mipmap->levels[i])
+			cairo_surface_destroy(mipmap->levels[i]);
+	}
+	g_free(mipmap);
+}
+
+/* Halves the size of the surface averaging each 2x2 block of pixels.
+ * The values being premultiplied the channels can be averaged alone */
+static cairo_surface_t *img_downscale_surface(cairo_surface_t *surface)
+{
+	cairo_surface_t *scaled;
+	const guint8 *src, *row0, *row1;
+	guint8 *dst;
+	gint width, height, src_stride, dst_stride, x0, x1;
+
+	width = cairo_image_surface_get_width(surface);
+	height = cairo_image_surface_get_height(surface);
+	scaled = cairo_image_surface_create(cairo_image_surface_get_format(surface), MAX(1, width / 2), MAX(1, height / 2));
+
+	cairo_surface_flush(surface);
+	src = cairo_image_surface_get_data(surface);
+	src_stride = cairo_image_surface_get_stride(surface);
+	dst_stride = cairo_image_surface_get_stride(scaled);
 
-		g_hash_table_insert(img->cached_preview_surfaces, GINT_TO_POINTER(item->id), (gpointer) surface);
+	for (gint y = 0; y < MAX(1, height / 2); y++)
+	{
+		row0 = src + 2 * y * src_stride;
+		row1 = src + MIN(2 * y + 1, height - 1) * src_stride;
+		dst = cairo_image_surface_get_data(scaled) + y * dst_stride;
+		for (gint x = 0; x < MAX(1, width / 2); x++)
+		{
+			x0 = 2 * x * 4;
+			x1 = MIN(2 * x + 1, width - 1) * 4;
+			for (gint c = 0; c < 4; c++)
+				dst[x * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+		}
+	}
+	cairo_surface_mark_dirty(scaled);
+
+	return scaled;
+}
+
+/* Returns the smallest copy of the surface, among itself and its half,
+ * quarter and eighth size ones, which is still at least as large as the
+ * surface once scaled by scale. The copies are made the first time they
+ * are needed, from any thread. level_scale is set to the size of the
+ * returned surface relative to the given one */
+cairo_surface_t *img_get_surface_mipmap(cairo_surface_t *surface, gdouble scale, gdouble *level_scale)
+{
+	ImgMipmap *mipmap;
+	cairo_surface_t *level = surface;
+	cairo_format_t format;
+	gint nr_levels = 0;
+
+	*level_scale = 1.0;
+	while (nr_levels < IMG_MIPMAP_LEVELS && *level_scale / 2 >= scale)
+	{
+		*level_scale /= 2;
+		nr_levels++;
+	}
+	if (nr_levels == 0 || cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE)
+	{
+		*level_scale = 1.0;
+		return surface;
+	}
+	format = cairo_image_surface_get_format(surface);
+	if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)
+	{
+		*level_scale = 1.0;
+		return surface;
 	}
+
+	g_mutex_lock(&img_mipmap_mutex);
+	mipmap = cairo_surface_get_user_data(surface, &img_mipmap_key);
+	if (mipmap == NULL)
+	{
+		mipmap = g_new0(ImgMipmap, 1);
+		cairo_surface_set_user_data(surface, &img_mipmap_key, mipmap, img_free_mipmap);
+	}
+	for (gint i = 0; i < nr_levels; i++)
+	{
+		if (mipmap->levels[i] == NULL)
+			mipmap->levels[i] = img_downscale_surface(level);
+		level = mipmap->levels[i];
+	}
+	g_mutex_unlock(&img_mipmap_mutex);
+
+	return level;
 }
 
 void img_apply_button_styles(GtkWidget *button)
@@ -1387,8 +1623,7 @@ void img_filter_icon_view(GtkEntry *entry, img_window_struct *img)
 void img_select_surface_on_click(img_window_struct *img, gdouble x, gdouble y)
 {
 	ImgTimelinePrivate *priv = img_timeline_get_private_struct(img->timeline);
-	GArray *active_media;
-	Track *track;
+	ImgTimelineIter iter;
 	media_timeline *item;
 	cairo_surface_t *surface = NULL;
 	gdouble scale, w, h, current_time;
@@ -1402,11 +1637,13 @@ void img_select_surface_on_click(img_window_struct *img, gdouble x, gdouble y)
 	
 	img_deselect_all_surfaces(img);
 
-	active_media = img_timeline_get_active_picture_media(img->timeline, current_time);
-	for (gint i = 0; i < active_media->len; i++)
+	img_tracks_iter_init(&iter, priv->tracks, current_time);
+	while (img_tracks_iter_next(&iter, &item))
 	{
-		item = g_array_index(active_media, media_timeline *,i);
-		surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
+		if (item->media_type == 1)
+			continue;
+
+		surface = img_get_preview_surface(img, item);
 		if (surface)
 		{
 			w = cairo_image_surface_get_width(surface);
@@ -1415,18 +1652,16 @@ void img_select_surface_on_click(img_window_struct *img, gdouble x, gdouble y)
 			if (x >= item->x && x <= item->x + w * scale && y >= item->y && y <= item->y + h * scale)
 			{
 				item->is_selected = TRUE;
-				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(item->button), TRUE);
+				img_timeline_select_item(img->timeline, item, TRUE);
 				gtk_notebook_set_current_page (GTK_NOTEBOOK(img->side_notebook), 1);
 				item->drag_x = x - item->x;
 				item->drag_y = y - item->y;
 				img->current_item = item;
 				img_timeline_set_media_properties(img,  item);
-				goto end;
+				return;
 			}
 		}
 	}
-end:
-	g_array_free(active_media, FALSE);
 }
 
 void img_deselect_all_surfaces(img_window_struct *img)
@@ -1442,7 +1677,7 @@ void img_deselect_all_surfaces(img_window_struct *img)
 		{
 			item = g_array_index(track->items, media_timeline *, j);
 			item->is_selected = FALSE;
-			gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(item->button), FALSE);
+			img_timeline_select_item(img->timeline, item, FALSE);
 		}
 	}	
 }
@@ -1523,70 +1758,71 @@ void img_draw_rotating_handle(cairo_t *cr, gdouble x, gdouble width, gdouble y,
 	cairo_stroke(cr);
 }
 
-void img_flip_surface_horizontally(img_window_struct *img, media_timeline *item)
+/* Returns a new surface with the picture of surface flipped
+ * around its center, horizontally or vertically */
+cairo_surface_t *img_flip_surface_data(cairo_surface_t *surface, gboolean horizontally)
 {
-	cairo_surface_t *surface, *flipped_surface;
+	cairo_surface_t *flipped_surface;
 	cairo_t *cr;
 	gint width, height;
 
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
 	width = cairo_image_surface_get_width(surface);
 	height = cairo_image_surface_get_height(surface);
 	flipped_surface = cairo_surface_create_similar(surface, CAIRO_CONTENT_COLOR_ALPHA, width, height);
 	cr = cairo_create(flipped_surface);
 
-	// Flip horizontally around the center of the image
-	cairo_translate(cr, width / 2.0, 0);
-	cairo_scale(cr, -1, 1);
-	cairo_translate(cr, -width / 2.0, 0);
+	if (horizontally)
+	{
+		cairo_translate(cr, width / 2.0, 0);
+		cairo_scale(cr, -1, 1);
+		cairo_translate(cr, -width / 2.0, 0);
+	}
+	else
+	{
+		cairo_translate(cr, 0, height / 2.0);
+		cairo_scale(cr, 1, -1);
+		cairo_translate(cr, 0, -height / 2.0);
+	}
 	cairo_set_source_surface(cr, surface, 0, 0);
 	cairo_paint(cr);
 	cairo_destroy(cr);
-	g_hash_table_remove(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	g_hash_table_insert(img->cached_preview_surfaces, GINT_TO_POINTER(item->id), (gpointer) flipped_surface);
+
+	return flipped_surface;
+}
+
+void img_flip_surface_horizontally(img_window_struct *img, media_timeline *item)
+{
+	cairo_surface_t *surface;
+
+	surface = img_get_preview_surface(img, item);
+	if (surface == NULL)
+		return;
+
+	img_surface_cache_insert(img->cached_preview_surfaces, item->id, img_flip_surface_data(surface, TRUE));
 }
 
 void img_flip_surface_vertically(img_window_struct *img, media_timeline *item)
 {
-	cairo_surface_t *surface, *flipped_surface;
-	cairo_t *cr;
-	gint width, height;
+	cairo_surface_t *surface;
 
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	width = cairo_image_surface_get_width(surface);
-	height = cairo_image_surface_get_height(surface);
-	flipped_surface = cairo_surface_create_similar(surface, CAIRO_CONTENT_COLOR_ALPHA, width, height);
-	cr = cairo_create(flipped_surface);
+	surface = img_get_preview_surface(img, item);
+	if (surface == NULL)
+		return;
 
-	// Flip vertically around the center of the image
-	cairo_translate(cr, 0, height / 2.0);
-	cairo_scale(cr, 1, -1);
-	cairo_translate(cr, 0, -height / 2.0);
-	cairo_set_source_surface(cr, surface, 0, 0);
-	cairo_paint(cr);
-	cairo_destroy(cr);
-	g_hash_table_remove(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	g_hash_table_insert(img->cached_preview_surfaces, GINT_TO_POINTER(item->id), (gpointer) flipped_surface);
+	img_surface_cache_insert(img->cached_preview_surfaces, item->id, img_flip_surface_data(surface, FALSE));
 }
 
-void img_rotate_surface(img_window_struct *img, media_timeline *item, gboolean update_angle)
+/* Returns a new surface with the picture of surface turned by 90 degrees */
+cairo_surface_t *img_rotate_surface_data(cairo_surface_t *surface)
 {
-	cairo_surface_t *surface, *rotated_surface;
+	cairo_surface_t *rotated_surface;
 	cairo_t *cr;
 	gint width, height;
-	gdouble old_cx, old_cy;
-    gdouble new_cx, new_cy;
-    
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
+
 	width = cairo_image_surface_get_width(surface);
 	height = cairo_image_surface_get_height(surface);
-	
 	rotated_surface = cairo_surface_create_similar(surface, CAIRO_CONTENT_COLOR_ALPHA, height, width);
-	
-	old_cx = item->x + width / 2.0;
-    old_cy = item->y + height / 2.0;
-    
-    // Rotate the surface
+
 	cr = cairo_create(rotated_surface);
 	cairo_translate(cr, height / 2.0, width / 2.0);
 	cairo_rotate(cr, G_PI / 2.0);
@@ -1595,18 +1831,33 @@ void img_rotate_surface(img_window_struct *img, media_timeline *item, gboolean u
 	cairo_paint(cr);
 	cairo_destroy(cr);
 
-	// Update the hash table
-	g_hash_table_remove(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	g_hash_table_insert(img->cached_preview_surfaces, GINT_TO_POINTER(item->id), (gpointer)rotated_surface);
-	
-	new_cx = old_cx;
-    new_cy = old_cy;
-    
-    // Update position to maintain center point after rotation
-    item->x = new_cx - height  / 2.0;
-    item->y = new_cy - width  / 2.0;
-    
-    if (update_angle)
+	return rotated_surface;
+}
+
+/* Keeps the center of the item where it was once its surface
+ * of width x height is turned by 90 degrees */
+void img_move_rotated_item(media_timeline *item, gint width, gint height)
+{
+	gdouble cx, cy;
+
+	cx = item->x + width / 2.0;
+	cy = item->y + height / 2.0;
+	item->x = cx - height / 2.0;
+	item->y = cy - width / 2.0;
+}
+
+void img_rotate_surface(img_window_struct *img, media_timeline *item, gboolean update_angle)
+{
+	cairo_surface_t *surface;
+
+	surface = img_get_preview_surface(img, item);
+	if (surface == NULL)
+		return;
+
+	img_move_rotated_item(item, cairo_image_surface_get_width(surface), cairo_image_surface_get_height(surface));
+	img_surface_cache_insert(img->cached_preview_surfaces, item->id, img_rotate_surface_data(surface));
+
+	if (update_angle)
 	{
 		item->nr_rotations ++;
 		if (item->nr_rotations >= 4)
@@ -1614,14 +1865,11 @@ void img_rotate_surface(img_window_struct *img, media_timeline *item, gboolean u
 	}
 }
 
-void img_turn_surface_black_and_white(img_window_struct *img, media_timeline *item)
+void img_turn_surface_black_and_white(cairo_surface_t *surface)
 {
-	cairo_surface_t *surface;
 	gint width, height, stride;
 	unsigned char *data, *row, *pixel;
 	
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	
     width = cairo_image_surface_get_width(surface);
     height = cairo_image_surface_get_height(surface);
     stride = cairo_image_surface_get_stride(surface);
@@ -1651,14 +1899,11 @@ void img_turn_surface_black_and_white(img_window_struct *img, media_timeline *it
     cairo_surface_mark_dirty(surface);
 }
 
-void img_turn_surface_sepia(img_window_struct *img, media_timeline *item)
+void img_turn_surface_sepia(cairo_surface_t *surface)
 {
-	cairo_surface_t *surface;
 	gint width, height, stride;
 	unsigned char *data, *row, *pixel;
 	
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	
     width = cairo_image_surface_get_width(surface);
     height = cairo_image_surface_get_height(surface);
     stride = cairo_image_surface_get_stride(surface);
@@ -1691,14 +1936,11 @@ void img_turn_surface_sepia(img_window_struct *img, media_timeline *item)
     cairo_surface_mark_dirty(surface);
 }
 
-void img_turn_surface_infrared(img_window_struct *img, media_timeline *item)
+void img_turn_surface_infrared(cairo_surface_t *surface)
 {
-	cairo_surface_t *surface;
 	gint width, height, stride;
 	unsigned char *data, *row, *pixel;
 	
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	
     width = cairo_image_surface_get_width(surface);
     height = cairo_image_surface_get_height(surface);
     stride = cairo_image_surface_get_stride(surface);
@@ -1730,14 +1972,11 @@ void img_turn_surface_infrared(img_window_struct *img, media_timeline *item)
     cairo_surface_mark_dirty(surface);
 }
 
-void img_turn_surface_pencil_sketch(img_window_struct *img, media_timeline *item)
+void img_turn_surface_pencil_sketch(cairo_surface_t *surface)
 {
-	cairo_surface_t *surface;
 	gint width, height, stride;
 	unsigned char *data, *row, *pixel;
 	
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	
     width = cairo_image_surface_get_width(surface);
     height = cairo_image_surface_get_height(surface);
     stride = cairo_image_surface_get_stride(surface);
@@ -1778,14 +2017,11 @@ void img_turn_surface_pencil_sketch(img_window_struct *img, media_timeline *item
     cairo_surface_mark_dirty(surface);
 }
 
-void img_turn_surface_negative(img_window_struct *img, media_timeline *item)
+void img_turn_surface_negative(cairo_surface_t *surface)
 {
-	cairo_surface_t *surface;
 	gint width, height, stride;
 	unsigned char *data, *row, *pixel;
 	
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	
     width = cairo_image_surface_get_width(surface);
     height = cairo_image_surface_get_height(surface);
     stride = cairo_image_surface_get_stride(surface);
@@ -1805,14 +2041,11 @@ void img_turn_surface_negative(img_window_struct *img, media_timeline *item)
     cairo_surface_mark_dirty(surface);
 }
 
-void img_turn_surface_emboss(img_window_struct *img, media_timeline *item)
+void img_turn_surface_emboss(cairo_surface_t *surface)
 {
-	cairo_surface_t *surface;
 	gint width, height, stride;
 	unsigned char *data, *row, *pixel;
 	
-	surface = g_hash_table_lookup(img->cached_preview_surfaces, GINT_TO_POINTER(item->id));
-	
     width = cairo_image_surface_get_width(surface);
     height = cairo_image_surface_get_height(surface);
     stride = cairo_image_surface_get_stride(surface);
@@ -1890,7 +2123,9 @@ void img_turn_surface_emboss(img_window_struct *img, media_timeline *item)
     cairo_surface_mark_dirty(surface);
 }
 
-void img_apply_filter_on_surface(img_window_struct *img, media_timeline *item, gint filter_nr)
+/* Changes the pixels of surface in place, so surface
+ * must not be in the cache yet */
+void img_apply_filter_on_surface(cairo_surface_t *surface, gint filter_nr)
 {
 	switch (filter_nr)
 	{
@@ -1899,27 +2134,27 @@ void img_apply_filter_on_surface(img_window_struct *img, media_timeline *item, g
 		break;
 		
 		case 1:
-			img_turn_surface_black_and_white(img, item);
+			img_turn_surface_black_and_white(surface);
 		break;
 		
 		case 2:
-			img_turn_surface_sepia(img, item);
+			img_turn_surface_sepia(surface);
 		break;
 
 		case 3:
-			img_turn_surface_infrared(img, item);
+			img_turn_surface_infrared(surface);
 		break;
 		
 		case 4:
-			img_turn_surface_pencil_sketch(img, item);
+			img_turn_surface_pencil_sketch(surface);
 		break;
 		
 		case 5:
-			img_turn_surface_negative(img, item);
+			img_turn_surface_negative(surface);
 		break;
 
 		case 6:
-			img_turn_surface_emboss(img, item);
+			img_turn_surface_emboss(surface);
 		break;
 	}
 }
@@ -35,6 +35,12 @@
 #include "main-window.h"
 #include "img_timeline.h"
 #include "imgcellrendereranim.h"
+#include "media_registry.h"
+#include "thumbnail.h"
+#include "surface_cache.h"
+
+/* Number of half size copies kept for each preview surface */
+#define IMG_MIPMAP_LEVELS 3
 
 #ifdef ENABLE_NLS
 #  include <glib/gi18n.h>
@@ -55,6 +61,7 @@ GtkWidget *_gtk_combo_box_new_text(gint);
 gint img_ask_user_confirmation(img_window_struct *, gchar *);
 void img_message(img_window_struct *, gchar *);
 void img_load_available_transitions(img_window_struct *);
+GHashTable *img_get_transition_renderers(img_window_struct *);
 void img_show_file_chooser(GtkWidget *, GtkEntryIconPosition, int, img_window_struct *);
 void img_delete_subtitle_pattern(GtkButton *, img_window_struct *);
 void img_update_zoom_variables(img_window_struct *);
@@ -85,8 +92,12 @@ gint img_calc_slide_duration_points( GList *, gint );
 GdkPixbuf *img_convert_surface_to_pixbuf( cairo_surface_t * );
 void img_taint_project(img_window_struct *);
 void img_sync_timings( media_struct  *, img_window_struct * );
-void img_free_cached_preview_surfaces(gpointer );
+cairo_surface_t *img_read_preview_surface(img_window_struct *, media_timeline *, const gchar *);
 void img_create_cached_cairo_surface(img_window_struct *, media_timeline * , gchar *);
+cairo_surface_t *img_restore_surface_effects(cairo_surface_t *, media_timeline *, gboolean);
+cairo_surface_t *img_get_preview_surface(img_window_struct *, media_timeline *);
+void img_pin_preview_surfaces(GHashTable *, img_window_struct *);
+cairo_surface_t *img_get_surface_mipmap(cairo_surface_t *, gdouble, gdouble *);
 void img_apply_button_styles(GtkWidget *);
 GdkPixbuf *img_create_bordered_pixbuf(gint , gint , gboolean );
 GtkWidget *img_create_flip_button(gboolean);
@@ -95,16 +106,19 @@ void img_filter_icon_view(GtkEntry *entry, img_window_struct *);
 void img_select_surface_on_click(img_window_struct *, gdouble, gdouble);
 void img_deselect_all_surfaces(img_window_struct *);
 void img_draw_rotation_angle(cairo_t *, gdouble, gdouble, gdouble, gdouble,  gdouble);
+cairo_surface_t *img_flip_surface_data(cairo_surface_t *, gboolean);
 void img_flip_surface_horizontally(img_window_struct *, media_timeline *);
 void img_flip_surface_vertically(img_window_struct *, media_timeline *);
+cairo_surface_t *img_rotate_surface_data(cairo_surface_t *);
+void img_move_rotated_item(media_timeline *, gint, gint);
 void img_rotate_surface(img_window_struct *, media_timeline *, gboolean);
-void img_turn_surface_black_and_white(img_window_struct *, media_timeline *);
-void img_turn_surface_sepia(img_window_struct *, media_timeline *);
-void img_turn_surface_infrared(img_window_struct *, media_timeline *);
-void img_turn_surface_pencil_sketch(img_window_struct *, media_timeline *);
-void img_turn_surface_negative(img_window_struct *, media_timeline *);
-void img_turn_surface_emboss(img_window_struct *, media_timeline *);
-void img_apply_filter_on_surface(img_window_struct *, media_timeline *, gint );
+void img_turn_surface_black_and_white(cairo_surface_t *);
+void img_turn_surface_sepia(cairo_surface_t *);
+void img_turn_surface_infrared(cairo_surface_t *);
+void img_turn_surface_pencil_sketch(cairo_surface_t *);
+void img_turn_surface_negative(cairo_surface_t *);
+void img_turn_surface_emboss(cairo_surface_t *);
+void img_apply_filter_on_surface(cairo_surface_t *, gint );
 void img_draw_rotating_handle(cairo_t *, gdouble, gdouble, gdouble, gdouble, gdouble, gboolean);
 void img_draw_horizontal_line(cairo_t *, GtkAllocation *);
 void img_draw_vertical_line(cairo_t *, GtkAllocation *);
@@ -0,0 +1,242 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#include "surface_cache.h"
+
+/* The preview surfaces of the pictures, by media id. The ones used the
+ * least recently are dropped when their size goes over the budget,
+ * except the ones the pin function asks to keep. The render thread of
+ * the preview takes its references through img_surface_cache_get(),
+ * everything else runs in the GTK thread */
+
+typedef struct _ImgSurfaceCacheEntry
+{
+	gint					id;
+	cairo_surface_t	*surface;
+	gsize					size;
+	GList					link;			/* In lru, data points to the entry */
+} ImgSurfaceCacheEntry;
+
+struct _ImgSurfaceCache
+{
+	GMutex				mutex;
+	GHashTable			*entries;		/* ImgSurfaceCacheEntry by id */
+	GQueue				lru;				/* Most recently used first */
+	gsize					budget;
+	gsize					resident;
+	guint					hits;
+	guint					misses;
+	ImgSurfaceCachePinFunc pin_func;
+	gpointer				pin_data;
+};
+
+static void img_surface_cache_free_entry(ImgSurfaceCacheEntry *entry)
+{
+	cairo_surface_destroy(entry->surface);
+	g_slice_free(ImgSurfaceCacheEntry, entry);
+}
+
+ImgSurfaceCache *img_surface_cache_new(gsize budget, ImgSurfaceCachePinFunc pin_func, gpointer pin_data)
+{
+	ImgSurfaceCache *cache;
+
+	cache = g_new0(ImgSurfaceCache, 1);
+	g_mutex_init(&cache->mutex);
+	cache->entries = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) img_surface_cache_free_entry);
+	g_queue_init(&cache->lru);
+	cache->budget = budget;
+	cache->pin_func = pin_func;
+	cache->pin_data = pin_data;
+
+	return cache;
+}
+
+void img_surface_cache_free(ImgSurfaceCache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	img_surface_cache_clear(cache);
+	g_hash_table_destroy(cache->entries);
+	g_mutex_clear(&cache->mutex);
+	g_free(cache);
+}
+
+gsize img_surface_cache_get_budget(ImgSurfaceCache *cache)
+{
+	return cache->budget;
+}
+
+/* Called with the mutex held */
+static void img_surface_cache_drop(ImgSurfaceCache *cache, ImgSurfaceCacheEntry *entry)
+{
+	g_queue_unlink(&cache->lru, &entry->link);
+	cache->resident -= entry->size;
+	g_hash_table_remove(cache->entries, GINT_TO_POINTER(entry->id));
+}
+
+/* Drops the least recently used surfaces until the cache fits in its
+ * budget again, keep is never dropped. The pinned surfaces stay even
+ * if the cache can't fit then */
+static void img_surface_cache_evict(ImgSurfaceCache *cache, ImgSurfaceCacheEntry *keep)
+{
+	ImgSurfaceCacheEntry *entry;
+	GHashTable *pinned;
+	GList *link, *prev;
+
+	if (cache->resident <= cache->budget)
+		return;
+
+	// The pin function reads the timeline so it's called without the mutex
+	pinned = g_hash_table_new(g_direct_hash, g_direct_equal);
+	if (cache->pin_func)
+		cache->pin_func(pinned, cache->pin_data);
+
+	g_mutex_lock(&cache->mutex);
+	for (link = cache->lru.tail; link && cache->resident > cache->budget; link = prev)
+	{
+		prev = link->prev;
+		entry = link->data;
+		if (entry == keep || g_hash_table_contains(pinned, GINT_TO_POINTER(entry->id)))
+			continue;
+		img_surface_cache_drop(cache, entry);
+	}
+	g_mutex_unlock(&cache->mutex);
+
+	g_hash_table_destroy(pinned);
+}
+
+void img_surface_cache_set_budget(ImgSurfaceCache *cache, gsize budget)
+{
+	cache->budget = budget;
+	img_surface_cache_evict(cache, NULL);
+}
+
+void img_surface_cache_report(ImgSurfaceCache *cache)
+{
+	g_debug("Preview surfaces: %u hits, %u misses, %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " MB resident",
+			cache->hits, cache->misses, cache->resident >> 20, cache->budget >> 20);
+}
+
+/* Called with the mutex held */
+static ImgSurfaceCacheEntry *img_surface_cache_touch(ImgSurfaceCache *cache, gint id)
+{
+	ImgSurfaceCacheEntry *entry;
+
+	entry = g_hash_table_lookup(cache->entries, GINT_TO_POINTER(id));
+	if (entry)
+	{
+		cache->hits++;
+		g_queue_unlink(&cache->lru, &entry->link);
+		g_queue_push_head_link(&cache->lru, &entry->link);
+	}
+	else
+		cache->misses++;
+
+	if ((cache->hits + cache->misses) % 1000 == 0)
+		img_surface_cache_report(cache);
+
+	return entry;
+}
+
+/* Returns the surface of the media, which stays owned by the cache, and
+ * makes it the most recently used. NULL if it isn't in the cache */
+cairo_surface_t *img_surface_cache_lookup(ImgSurfaceCache *cache, gint id)
+{
+	ImgSurfaceCacheEntry *entry;
+
+	g_mutex_lock(&cache->mutex);
+	entry = img_surface_cache_touch(cache, id);
+	g_mutex_unlock(&cache->mutex);
+
+	return entry ? entry->surface : NULL;
+}
+
+/* As img_surface_cache_lookup() but without counting a hit or a miss
+ * nor changing the order the surfaces are dropped in */
+cairo_surface_t *img_surface_cache_peek(ImgSurfaceCache *cache, gint id)
+{
+	ImgSurfaceCacheEntry *entry;
+
+	g_mutex_lock(&cache->mutex);
+	entry = g_hash_table_lookup(cache->entries, GINT_TO_POINTER(id));
+	g_mutex_unlock(&cache->mutex);
+
+	return entry ? entry->surface : NULL;
+}
+
+/* As img_surface_cache_lookup() but gives a new reference to the
+ * surface, it can be called from any thread */
+cairo_surface_t *img_surface_cache_get(ImgSurfaceCache *cache, gint id)
+{
+	ImgSurfaceCacheEntry *entry;
+	cairo_surface_t *surface = NULL;
+
+	g_mutex_lock(&cache->mutex);
+	entry = img_surface_cache_touch(cache, id);
+	if (entry)
+		surface = cairo_surface_reference(entry->surface);
+	g_mutex_unlock(&cache->mutex);
+
+	return surface;
+}
+
+/* The cache takes over the reference of the caller and drops the
+ * surface the media had before */
+void img_surface_cache_insert(ImgSurfaceCache *cache, gint id, cairo_surface_t *surface)
+{
+	ImgSurfaceCacheEntry *entry, *old;
+
+	entry = g_slice_new0(ImgSurfaceCacheEntry);
+	entry->id = id;
+	entry->surface = surface;
+	entry->size = (gsize) cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+	entry->link.data = entry;
+
+	g_mutex_lock(&cache->mutex);
+	old = g_hash_table_lookup(cache->entries, GINT_TO_POINTER(id));
+	if (old)
+		img_surface_cache_drop(cache, old);
+	g_hash_table_insert(cache->entries, GINT_TO_POINTER(id), entry);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+	cache->resident += entry->size;
+	g_mutex_unlock(&cache->mutex);
+
+	img_surface_cache_evict(cache, entry);
+}
+
+void img_surface_cache_remove(ImgSurfaceCache *cache, gint id)
+{
+	ImgSurfaceCacheEntry *entry;
+
+	g_mutex_lock(&cache->mutex);
+	entry = g_hash_table_lookup(cache->entries, GINT_TO_POINTER(id));
+	if (entry)
+		img_surface_cache_drop(cache, entry);
+	g_mutex_unlock(&cache->mutex);
+}
+
+void img_surface_cache_clear(ImgSurfaceCache *cache)
+{
+	g_mutex_lock(&cache->mutex);
+	g_hash_table_remove_all(cache->entries);
+	g_queue_init(&cache->lru);
+	cache->resident = 0;
+	g_mutex_unlock(&cache->mutex);
+}
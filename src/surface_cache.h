@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#ifndef __IMG_SURFACE_CACHE_H__
+#define __IMG_SURFACE_CACHE_H__
+
+#include <gtk/gtk.h>
+#include "imagination.h"
+
+G_BEGIN_DECLS
+
+/* Adds to pinned the ids of the surfaces which must not be dropped */
+typedef void (*ImgSurfaceCachePinFunc)(GHashTable *pinned, gpointer data);
+
+ImgSurfaceCache *img_surface_cache_new(gsize, ImgSurfaceCachePinFunc, gpointer);
+void img_surface_cache_free(ImgSurfaceCache *);
+void img_surface_cache_set_budget(ImgSurfaceCache *, gsize);
+gsize img_surface_cache_get_budget(ImgSurfaceCache *);
+cairo_surface_t *img_surface_cache_lookup(ImgSurfaceCache *, gint);
+cairo_surface_t *img_surface_cache_peek(ImgSurfaceCache *, gint);
+cairo_surface_t *img_surface_cache_get(ImgSurfaceCache *, gint);
+void img_surface_cache_insert(ImgSurfaceCache *, gint, cairo_surface_t *);
+void img_surface_cache_remove(ImgSurfaceCache *, gint);
+void img_surface_cache_clear(ImgSurfaceCache *);
+void img_surface_cache_report(ImgSurfaceCache *);
+
+G_END_DECLS
+
+#endif
@@ -56,7 +56,7 @@ void img_textbox_button_pressed(GdkEventButton *event, img_window_struct *img)
 	else if (x >= item->x && x <= item->x + item->width &&
 			y >= item->y && y <= item->y + item->height)
 	{
-		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(img->current_item->button), TRUE);
+		img_timeline_select_item(img->timeline, img->current_item, TRUE);
 		gtk_notebook_set_current_page(GTK_NOTEBOOK(img->side_notebook), 2);
 		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(img->toggle_button_text), TRUE);
 		
@@ -1055,8 +1055,11 @@ media_text *img_create_text_item(img_window_struct *img, gint track_nr, gint tra
 	item->old_x = position_x;
     item->start_time = position_x / (BASE_SCALE * priv->zoom_scale);
     
-   	gtk_widget_set_size_request(item->button, width, 50);
-	gtk_layout_move(GTK_LAYOUT(img->timeline), item->button, item->start_time * BASE_SCALE * priv->zoom_scale, item->timeline_y);
+	if (item->button)
+	{
+		gtk_widget_set_size_request(item->button, width, 50);
+		gtk_layout_move(GTK_LAYOUT(img->timeline), item->button, item->start_time * BASE_SCALE * priv->zoom_scale, item->timeline_y);
+	}
 	track->last_media_posX += width;
 
 	// Then the media_text struct
@@ -1120,6 +1123,7 @@ media_text *img_create_text_item(img_window_struct *img, gint track_nr, gint tra
 	item->text = text;
 	img->current_item = item;
 	g_array_append_val(track->items, item);
+	img_track_invalidate_index(track);
 
 	img_taint_project(img);
 	pango_layout_set_text(text->layout, text->text->str, -1);
@@ -0,0 +1,398 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "thumbnail.h"
+
+/* The thumbnails are stored the way the freedesktop.org thumbnail spec
+ * says so the ones made by the file manager are used here and the other
+ * way round. A thumbnail is named after the MD5 of the URI of the
+ * picture and holds its modification time and size, it is made again
+ * when the picture has changed since */
+
+typedef struct _ImgThumbnailJob
+{
+	const gchar	*path;
+	gint			width;
+	gint			height;
+	GdkPixbuf	**pixbuf;
+} ImgThumbnailJob;
+
+static gchar *img_thumbnail_get_filename(const gchar *uri, gint size)
+{
+	gchar *md5, *name, *filename;
+
+	md5 = g_compute_checksum_for_string(G_CHECKSUM_MD5, uri, -1);
+	name = g_strconcat(md5, ".png", NULL);
+	filename = g_build_filename(g_get_user_cache_dir(), "thumbnails",
+								size == IMG_THUMBNAIL_NORMAL ? "normal" : "large", name, NULL);
+	g_free(name);
+	g_free(md5);
+
+	return filename;
+}
+
+/* Returns the stored thumbnail if it is still the one of the picture */
+static GdkPixbuf *img_thumbnail_load(const gchar *filename, const gchar *uri, GStatBuf *st)
+{
+	GdkPixbuf *pixbuf;
+	const gchar *option;
+	gboolean valid;
+
+	pixbuf = gdk_pixbuf_new_from_file(filename, NULL);
+	if (pixbuf == NULL)
+		return NULL;
+
+	option = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::URI");
+	valid = g_strcmp0(option, uri) == 0;
+
+	option = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::MTime");
+	if (valid)
+		valid = option && g_ascii_strtoll(option, NULL, 10) == (gint64) st->st_mtime;
+
+	// The size is optional in the spec
+	option = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::Size");
+	if (valid && option)
+		valid = g_ascii_strtoll(option, NULL, 10) == (gint64) st->st_size;
+
+	if (! valid)
+	{
+		g_object_unref(pixbuf);
+		return NULL;
+	}
+	return pixbuf;
+}
+
+static guint img_thumbnail_exif_get16(const guchar *data, gboolean motorola)
+{
+	if (motorola)
+		return data[0] << 8 | data[1];
+	return data[1] << 8 | data[0];
+}
+
+static guint32 img_thumbnail_exif_get32(const guchar *data, gboolean motorola)
+{
+	if (motorola)
+		return (guint32) data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+	return (guint32) data[3] << 24 | data[2] << 16 | data[1] << 8 | data[0];
+}
+
+/* Reads the APP1 segment of a JPEG file, the EXIF data follows the
+ * "Exif" header and is at most 64 KB long */
+static guchar *img_thumbnail_exif_read(const gchar *path, gsize *length)
+{
+	FILE *fp;
+	guchar marker[4], *data = NULL;
+	gsize size;
+
+	fp = g_fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	if (fread(marker, 1, 2, fp) != 2 || marker[0] != 0xFF || marker[1] != 0xD8)
+	{
+		fclose(fp);
+		return NULL;
+	}
+
+	// The APP segments come right after the start of the image
+	while (fread(marker, 1, 4, fp) == 4 && marker[0] == 0xFF && marker[1] >= 0xE0 && marker[1] <= 0xEF)
+	{
+		size = marker[2] << 8 | marker[3];
+		if (size < 2)
+			break;
+		size -= 2;
+
+		if (marker[1] == 0xE1)
+		{
+			data = g_malloc(size);
+			if (fread(data, 1, size, fp) == size && size > 14 && memcmp(data, "Exif\0\0", 6) == 0)
+			{
+				*length = size;
+				break;
+			}
+			// An XMP segment or a short read
+			g_free(data);
+			data = NULL;
+		}
+		else if (fseek(fp, size, SEEK_CUR) != 0)
+			break;
+	}
+	fclose(fp);
+
+	return data;
+}
+
+/* Returns the preview cameras store in the EXIF data of their pictures,
+ * about 160 x 120, so that the picture itself isn't decoded. The preview
+ * is only used if it is large enough for the size asked for and has the
+ * shape of the picture, some cameras add black bands to it. The EXIF
+ * orientation of the picture is set on the pixbuf returned */
+static GdkPixbuf *img_thumbnail_load_exif(const gchar *path, gint width, gint height, gint size)
+{
+	GdkPixbufLoader *loader;
+	GdkPixbuf *pixbuf = NULL, *scaled;
+	const guchar *tiff, *entry;
+	guchar *data;
+	gsize length = 0, tiff_size;
+	guint32 ifd, offset = 0, jpeg_length = 0;
+	guint count, tag, orientation = 1;
+	gboolean motorola;
+	gdouble ratio;
+	gchar *value;
+
+	data = img_thumbnail_exif_read(path, &length);
+	if (data == NULL)
+		return NULL;
+
+	tiff = data + 6;
+	tiff_size = length - 6;
+	if (tiff[0] == 'I' && tiff[1] == 'I')
+		motorola = FALSE;
+	else if (tiff[0] == 'M' && tiff[1] == 'M')
+		motorola = TRUE;
+	else
+	{
+		g_free(data);
+		return NULL;
+	}
+
+	/* IFD0 holds the orientation of the picture and IFD1 the offset and
+	 * the length of the preview */
+	ifd = img_thumbnail_exif_get32(tiff + 4, motorola);
+	for (gint n = 0; n < 2 && ifd > 0 && ifd <= tiff_size - 2; n++)
+	{
+		count = img_thumbnail_exif_get16(tiff + ifd, motorola);
+		if (ifd + 2 + count * 12 + 4 > tiff_size)
+			break;
+
+		for (guint i = 0; i < count; i++)
+		{
+			entry = tiff + ifd + 2 + i * 12;
+			tag = img_thumbnail_exif_get16(entry, motorola);
+			if (n == 0 && tag == 0x0112)
+				orientation = img_thumbnail_exif_get16(entry + 8, motorola);
+			else if (n == 1 && tag == 0x0201)
+				offset = img_thumbnail_exif_get32(entry + 8, motorola);
+			else if (n == 1 && tag == 0x0202)
+				jpeg_length = img_thumbnail_exif_get32(entry + 8, motorola);
+		}
+		ifd = img_thumbnail_exif_get32(tiff + ifd + 2 + count * 12, motorola);
+	}
+
+	if (offset > 0 && jpeg_length > 0 && offset <= tiff_size && jpeg_length <= tiff_size - offset)
+	{
+		loader = gdk_pixbuf_loader_new_with_type("jpeg", NULL);
+		if (loader)
+		{
+			if (gdk_pixbuf_loader_write(loader, tiff + offset, jpeg_length, NULL) && gdk_pixbuf_loader_close(loader, NULL))
+			{
+				pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+				if (pixbuf)
+					g_object_ref(pixbuf);
+			}
+			else
+				gdk_pixbuf_loader_close(loader, NULL);
+			g_object_unref(loader);
+		}
+	}
+	g_free(data);
+
+	if (pixbuf == NULL)
+		return NULL;
+
+	ratio = (gdouble) width / height;
+	if (MAX(gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf)) < size
+		|| ABS((gdouble) gdk_pixbuf_get_width(pixbuf) / gdk_pixbuf_get_height(pixbuf) - ratio) > ratio * 0.02)
+	{
+		g_object_unref(pixbuf);
+		return NULL;
+	}
+
+	ratio = MIN((gdouble) size / gdk_pixbuf_get_width(pixbuf), (gdouble) size / gdk_pixbuf_get_height(pixbuf));
+	scaled = gdk_pixbuf_scale_simple(pixbuf,
+									MAX(1, (gint) (gdk_pixbuf_get_width(pixbuf) * ratio + 0.5)),
+									MAX(1, (gint) (gdk_pixbuf_get_height(pixbuf) * ratio + 0.5)),
+									GDK_INTERP_BILINEAR);
+	g_object_unref(pixbuf);
+
+	// Let gdk_pixbuf_apply_embedded_orientation() turn it upright
+	if (scaled && orientation > 1 && orientation <= 8)
+	{
+		value = g_strdup_printf("%u", orientation);
+		gdk_pixbuf_set_option(scaled, "orientation", value);
+		g_free(value);
+	}
+	return scaled;
+}
+
+static GdkPixbuf *img_thumbnail_make(const gchar *path, const gchar *uri, const gchar *filename, gint size, GStatBuf *st)
+{
+	GdkPixbuf *pixbuf, *oriented;
+	gchar *dir, *tmp, *mtime, *file_size;
+	gint fd;
+	gint width, height;
+
+	if (gdk_pixbuf_get_file_info(path, &width, &height) == NULL)
+		return NULL;
+
+	// Pictures smaller than the thumbnail are stored as they are
+	if (width <= size && height <= size)
+		pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+	else if ((pixbuf = img_thumbnail_load_exif(path, width, height, size)) == NULL)
+		pixbuf = gdk_pixbuf_new_from_file_at_scale(path, size, size, TRUE, NULL);
+	if (pixbuf == NULL)
+		return NULL;
+
+	oriented = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+	g_object_unref(pixbuf);
+	pixbuf = oriented;
+
+	dir = g_path_get_dirname(filename);
+	if (g_mkdir_with_parents(dir, S_IRWXU) == 0)
+	{
+		/* Written aside and renamed over so that no one, another thread
+		 * or another program, ever reads half a thumbnail. g_mkstemp()
+		 * gives a name of our own, readable by the user only as the spec
+		 * wants, next to the thumbnail so the rename stays on one disk */
+		tmp = g_strdup_printf("%s.XXXXXX", filename);
+		fd = g_mkstemp(tmp);
+		if (fd != -1)
+		{
+			close(fd);
+			mtime = g_strdup_printf("%" G_GINT64_FORMAT, (gint64) st->st_mtime);
+			file_size = g_strdup_printf("%" G_GINT64_FORMAT, (gint64) st->st_size);
+
+			if (gdk_pixbuf_save(pixbuf, tmp, "png", NULL,
+								"tEXt::Thumb::URI", uri,
+								"tEXt::Thumb::MTime", mtime,
+								"tEXt::Thumb::Size", file_size,
+								"tEXt::Software", "Imagination",
+								NULL) == FALSE || g_rename(tmp, filename) != 0)
+				g_unlink(tmp);
+
+			g_free(file_size);
+			g_free(mtime);
+		}
+		g_free(tmp);
+	}
+	g_free(dir);
+
+	return pixbuf;
+}
+
+/* Scale to fit the thumbnail in width x height, -1 leaves the side free
+ * as in gdk_pixbuf_new_from_file_at_scale() */
+static gdouble img_thumbnail_get_scale(GdkPixbuf *pixbuf, gint width, gint height)
+{
+	gdouble x, y;
+
+	x = (gdouble) width / gdk_pixbuf_get_width(pixbuf);
+	y = (gdouble) height / gdk_pixbuf_get_height(pixbuf);
+
+	if (width < 0 && height < 0)
+		return 1.0;
+	if (width < 0)
+		return y;
+	if (height < 0)
+		return x;
+	return MIN(x, y);
+}
+
+/* Returns the thumbnail of the picture at path scaled to fit in width x
+ * height or NULL if it can't be read. It can be called from any thread */
+GdkPixbuf *img_thumbnail_get(const gchar *path, gint width, gint height)
+{
+	static const gint sizes[] = { IMG_THUMBNAIL_NORMAL, IMG_THUMBNAIL_LARGE };
+	GdkPixbuf *thumbnail = NULL, *pixbuf;
+	GStatBuf st;
+	gchar *uri, *filename;
+	gdouble scale = 1.0;
+
+	if (path == NULL || g_stat(path, &st) != 0)
+		return NULL;
+
+	uri = g_filename_to_uri(path, NULL, NULL);
+	if (uri == NULL)
+		return NULL;
+
+	// The large one is only used when the normal one would be blown up
+	for (guint i = 0; i < G_N_ELEMENTS(sizes); i++)
+	{
+		if (thumbnail)
+			g_object_unref(thumbnail);
+
+		filename = img_thumbnail_get_filename(uri, sizes[i]);
+		thumbnail = img_thumbnail_load(filename, uri, &st);
+		if (thumbnail == NULL)
+			thumbnail = img_thumbnail_make(path, uri, filename, sizes[i], &st);
+		g_free(filename);
+
+		if (thumbnail == NULL)
+			break;
+
+		scale = img_thumbnail_get_scale(thumbnail, width, height);
+		if (scale <= 1.0 || MAX(gdk_pixbuf_get_width(thumbnail), gdk_pixbuf_get_height(thumbnail)) < sizes[i])
+			break;
+	}
+	g_free(uri);
+
+	if (thumbnail == NULL || scale == 1.0)
+		return thumbnail;
+
+	pixbuf = gdk_pixbuf_scale_simple(thumbnail,
+									MAX(1, (gint) (gdk_pixbuf_get_width(thumbnail) * scale + 0.5)),
+									MAX(1, (gint) (gdk_pixbuf_get_height(thumbnail) * scale + 0.5)),
+									GDK_INTERP_BILINEAR);
+	g_object_unref(thumbnail);
+
+	return pixbuf;
+}
+
+static void img_thumbnail_run_job(ImgThumbnailJob *job, gpointer data)
+{
+	*job->pixbuf = img_thumbnail_get(job->path, job->width, job->height);
+}
+
+/* Fills pixbufs with the thumbnails of the n paths, the ones which are
+ * not stored yet are made by several threads at once */
+void img_thumbnail_get_batch(gchar **paths, gint n, gint width, gint height, GdkPixbuf **pixbufs)
+{
+	ImgThumbnailJob *jobs;
+	GThreadPool *pool;
+
+	if (n == 0)
+		return;
+
+	jobs = g_new(ImgThumbnailJob, n);
+	pool = g_thread_pool_new((GFunc) img_thumbnail_run_job, NULL, g_get_num_processors(), FALSE, NULL);
+	for (gint i = 0; i < n; i++)
+	{
+		jobs[i].path = paths[i];
+		jobs[i].width = width;
+		jobs[i].height = height;
+		jobs[i].pixbuf = &pixbufs[i];
+		g_thread_pool_push(pool, &jobs[i], NULL);
+	}
+	// Wait for all of them
+	g_thread_pool_free(pool, FALSE, TRUE);
+	g_free(jobs);
+}
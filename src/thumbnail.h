@@ -0,0 +1,36 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+#ifndef __IMG_THUMBNAIL_H__
+#define __IMG_THUMBNAIL_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* Sizes of the freedesktop.org thumbnail directories */
+#define IMG_THUMBNAIL_NORMAL 128
+#define IMG_THUMBNAIL_LARGE 256
+
+GdkPixbuf *img_thumbnail_get(const gchar *, gint, gint);
+void img_thumbnail_get_batch(gchar **, gint, gint, gint, GdkPixbuf **);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+/* Checks the YUV converter of yuv_convert.c, run by make check.
+ *
+ * The SSE2 and AVX2 kernels must give the scalar output bit for bit,
+ * for the three pixel formats. The output in each format is also compared
+ * with sws_scale, using SWS_POINT as the export does for the formats
+ * img_yuv_convert() doesn't handle. The export used SWS_BICUBIC before,
+ * which only changes how the chroma is subsampled since the size never
+ * changes. The coefficients are not rounded the same way so a difference
+ * of IMG_YUV_CHECK_TOLERANCE 8 bits levels is accepted. swscale doesn't
+ * average the chroma like we do, so it is only compared on the frames
+ * made of uniform 2x2 blocks, where both ways give the same chroma sample.
+ *
+ * The speed of every kernel and of sws_scale is printed in Mpix/s,
+ * at 1080p and 4K. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+#include "yuv_convert.h"
+
+#define IMG_YUV_CHECK_TOLERANCE	2
+#define IMG_YUV_CHECK_RUNS			50
+
+typedef enum
+{
+	IMG_YUV_CHECK_RANDOM,			/* Random pixels */
+	IMG_YUV_CHECK_BLOCKS,			/* Random uniform 2x2 blocks */
+	IMG_YUV_CHECK_BLACK,
+	IMG_YUV_CHECK_WHITE,
+	IMG_YUV_CHECK_PRIMARIES,		/* Bars of red, green, blue, cyan, magenta and yellow */
+	IMG_YUV_CHECK_GRADIENT
+} ImgYuvCheckPattern;
+
+static const gchar *patterns[] = { "random", "blocks", "black", "white", "primaries", "gradient" };
+static const gchar *isas[] = { "C", "SSE2", "AVX2" };
+
+/* Odd sizes go through the tails of the kernels and the last chroma column and row */
+static const gint sizes[][2] = { { 2, 2 }, { 17, 9 }, { 67, 33 }, { 1920, 1080 }, { 3840, 2160 } };
+
+static guint32 img_yuv_check_pixel(ImgYuvCheckPattern pattern, GRand *rand, gint x, gint y, gint width, gint height)
+{
+	static const guint32 primaries[] = { 0xffff0000, 0xff00ff00, 0xff0000ff, 0xff00ffff, 0xffff00ff, 0xffffff00 };
+
+	switch (pattern)
+	{
+		case IMG_YUV_CHECK_RANDOM:
+		case IMG_YUV_CHECK_BLOCKS:
+		return 0xff000000 | (g_rand_int(rand) & 0xffffff);
+
+		case IMG_YUV_CHECK_BLACK:
+		return 0xff000000;
+
+		case IMG_YUV_CHECK_WHITE:
+		return 0xffffffff;
+
+		case IMG_YUV_CHECK_PRIMARIES:
+		return primaries[(x / 2 * 2) * G_N_ELEMENTS(primaries) / width];
+
+		case IMG_YUV_CHECK_GRADIENT:
+		default:
+		return 0xff000000 | ((x * 255 / MAX(width - 1, 1)) << 16) | ((y * 255 / MAX(height - 1, 1)) << 8) |
+							((x + y) * 255 / MAX(width + height - 2, 1));
+	}
+}
+
+/* Fills the ARGB32 data like a composed export frame, always opaque */
+static void img_yuv_check_fill(guint32 *data, ImgYuvCheckPattern pattern, GRand *rand, gint width, gint height)
+{
+	for (gint y = 0; y < height; y++)
+	{
+		for (gint x = 0; x < width; x++)
+		{
+			if (pattern == IMG_YUV_CHECK_BLOCKS && (x % 2 || y % 2))
+				data[y * width + x] = data[(y / 2 * 2) * width + x / 2 * 2];
+			else
+				data[y * width + x] = img_yuv_check_pixel(pattern, rand, x, y, width, height);
+		}
+	}
+}
+
+static AVFrame *img_yuv_check_frame_new(enum AVPixelFormat pix_fmt, gint width, gint height)
+{
+	AVFrame *frame = av_frame_alloc();
+
+	if (frame == NULL)
+		return NULL;
+
+	frame->format = pix_fmt;
+	frame->width = width;
+	frame->height = height;
+	if (av_frame_get_buffer(frame, 0) < 0)
+		av_frame_free(&frame);
+
+	return frame;
+}
+
+/* Returns the largest difference between the samples of plane in a and b */
+static gint img_yuv_check_compare(AVFrame *a, AVFrame *b, gint plane)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(a->format);
+	gint width = a->width, height = a->height, bytes, diff = 0;
+
+	if (plane > 0)
+	{
+		width = AV_CEIL_RSHIFT(width, desc->log2_chroma_w);
+		height = AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+	}
+	bytes = desc->comp[0].depth > 8 ? 2 : 1;
+
+	for (gint y = 0; y < height; y++)
+	{
+		const guint8 *pa = a->data[plane] + y * a->linesize[plane];
+		const guint8 *pb = b->data[plane] + y * b->linesize[plane];
+
+		for (gint x = 0; x < width; x++)
+		{
+			gint va = bytes == 2 ? ((const guint16 *) pa)[x] : pa[x];
+			gint vb = bytes == 2 ? ((const guint16 *) pb)[x] : pb[x];
+
+			diff = MAX(diff, ABS(va - vb));
+		}
+	}
+	return diff;
+}
+
+/* The SIMD kernels against the scalar code */
+static gboolean img_yuv_check_kernels(const guint32 *data, enum AVPixelFormat pix_fmt, gint width, gint height,
+													const gchar *pattern)
+{
+	AVFrame *ref, *frame;
+	gboolean ok = TRUE;
+
+	ref = img_yuv_check_frame_new(pix_fmt, width, height);
+	frame = img_yuv_check_frame_new(pix_fmt, width, height);
+	if (ref == NULL || frame == NULL)
+	{
+		av_frame_free(&ref);
+		av_frame_free(&frame);
+		return FALSE;
+	}
+	img_yuv_convert_set_isa("C");
+	img_yuv_convert((const guint8 *) data, width * 4, ref, 0, height);
+
+	for (gint i = 1; i < G_N_ELEMENTS(isas); i++)
+	{
+		if (! img_yuv_convert_set_isa(isas[i]))
+			continue;
+
+		img_yuv_convert((const guint8 *) data, width * 4, frame, 0, height);
+		for (gint plane = 0; plane < 3; plane++)
+		{
+			if (img_yuv_check_compare(ref, frame, plane) != 0)
+			{
+				printf("FAIL %s %s %dx%d %s: plane %d differs from C\n", isas[i], av_get_pix_fmt_name(pix_fmt),
+											width, height, pattern, plane);
+				ok = FALSE;
+			}
+		}
+	}
+	img_yuv_convert_set_isa(NULL);
+
+	av_frame_free(&ref);
+	av_frame_free(&frame);
+	return ok;
+}
+
+/* The C output against sws_scale */
+static gboolean img_yuv_check_swscale(const guint32 *data, enum AVPixelFormat pix_fmt, gint width, gint height,
+														ImgYuvCheckPattern pattern)
+{
+	struct SwsContext *sws_ctx;
+	AVFrame *ref, *frame;
+	const guint8 *src[4] = { (const guint8 *) data };
+	gint src_linesize[4] = { width * 4 };
+	gint diff, tolerance;
+	gboolean ok = TRUE;
+
+	/* SWS_POINT as the export for the other formats, rounded as well as it can */
+	sws_ctx = sws_getContext(width, height, AV_PIX_FMT_RGB32, width, height, pix_fmt,
+									SWS_POINT | SWS_ACCURATE_RND | SWS_BITEXACT, NULL, NULL, NULL);
+	if (sws_ctx == NULL)
+	{
+		printf("skip swscale %s %dx%d: no context for this size\n", av_get_pix_fmt_name(pix_fmt), width, height);
+		return TRUE;
+	}
+	// The tolerance is in 8 bits levels
+	tolerance = IMG_YUV_CHECK_TOLERANCE << (av_pix_fmt_desc_get(pix_fmt)->comp[0].depth - 8);
+	ref = img_yuv_check_frame_new(pix_fmt, width, height);
+	frame = img_yuv_check_frame_new(pix_fmt, width, height);
+	if (ref == NULL || frame == NULL)
+	{
+		ok = FALSE;
+		goto end;
+	}
+	sws_scale(sws_ctx, src, src_linesize, 0, height, ref->data, ref->linesize);
+	img_yuv_convert_set_isa("C");
+	img_yuv_convert((const guint8 *) data, width * 4, frame, 0, height);
+	img_yuv_convert_set_isa(NULL);
+
+	for (gint plane = 0; plane < 3; plane++)
+	{
+		if (plane > 0 && (pattern == IMG_YUV_CHECK_RANDOM || pattern == IMG_YUV_CHECK_GRADIENT))
+			break;
+
+		diff = img_yuv_check_compare(ref, frame, plane);
+		if (diff > tolerance)
+		{
+			printf("FAIL swscale %s %dx%d %s: plane %d is %d away\n", av_get_pix_fmt_name(pix_fmt),
+										width, height, patterns[pattern], plane, diff);
+			ok = FALSE;
+		}
+	}
+
+end:
+	av_frame_free(&ref);
+	av_frame_free(&frame);
+	sws_freeContext(sws_ctx);
+	return ok;
+}
+
+static void img_yuv_check_speed(gint width, gint height)
+{
+	struct SwsContext *sws_ctx;
+	AVFrame *frame;
+	guint32 *data;
+	GRand *rand;
+	gint64 start;
+	gdouble mpix = (gdouble) width * height * IMG_YUV_CHECK_RUNS / 1e6;
+	const guint8 *src[4];
+	gint src_linesize[4] = { width * 4 };
+
+	frame = img_yuv_check_frame_new(AV_PIX_FMT_YUV420P, width, height);
+	if (frame == NULL)
+		return;
+
+	rand = g_rand_new_with_seed(1);
+	data = g_new(guint32, width * height);
+	img_yuv_check_fill(data, IMG_YUV_CHECK_RANDOM, rand, width, height);
+	src[0] = (const guint8 *) data;
+
+	printf("yuv420p %dx%d:\n", width, height);
+	for (gint i = 0; i < G_N_ELEMENTS(isas); i++)
+	{
+		if (! img_yuv_convert_set_isa(isas[i]))
+			continue;
+
+		start = g_get_monotonic_time();
+		for (gint run = 0; run < IMG_YUV_CHECK_RUNS; run++)
+			img_yuv_convert((const guint8 *) data, width * 4, frame, 0, height);
+		printf("  %-8s %8.1f Mpix/s\n", isas[i], mpix / ((g_get_monotonic_time() - start) / 1e6));
+	}
+	img_yuv_convert_set_isa(NULL);
+
+	sws_ctx = sws_getContext(width, height, AV_PIX_FMT_RGB32, width, height, AV_PIX_FMT_YUV420P,
+									SWS_POINT, NULL, NULL, NULL);
+	if (sws_ctx)
+	{
+		start = g_get_monotonic_time();
+		for (gint run = 0; run < IMG_YUV_CHECK_RUNS; run++)
+			sws_scale(sws_ctx, src, src_linesize, 0, height, frame->data, frame->linesize);
+		printf("  %-8s %8.1f Mpix/s\n", "swscale", mpix / ((g_get_monotonic_time() - start) / 1e6));
+		sws_freeContext(sws_ctx);
+	}
+
+	g_free(data);
+	g_rand_free(rand);
+	av_frame_free(&frame);
+}
+
+int main(int argc, char **argv)
+{
+	static const enum AVPixelFormat formats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUV422P10LE };
+	GRand *rand = g_rand_new_with_seed(20240101);
+	gboolean ok = TRUE;
+	guint32 *data;
+	gint width, height;
+
+	for (gint s = 0; s < G_N_ELEMENTS(sizes); s++)
+	{
+		width = sizes[s][0];
+		height = sizes[s][1];
+		data = g_new(guint32, width * height);
+
+		for (gint p = 0; p < G_N_ELEMENTS(patterns); p++)
+		{
+			img_yuv_check_fill(data, p, rand, width, height);
+			for (gint f = 0; f < G_N_ELEMENTS(formats); f++)
+			{
+				if (! img_yuv_convert_supported(formats[f]))
+					continue;
+				ok &= img_yuv_check_kernels(data, formats[f], width, height, patterns[p]);
+				ok &= img_yuv_check_swscale(data, formats[f], width, height, p);
+			}
+		}
+		g_free(data);
+	}
+	g_rand_free(rand);
+
+	img_yuv_check_speed(1920, 1080);
+	img_yuv_check_speed(3840, 2160);
+
+	printf("%s, best kernels: %s\n", ok ? "PASS" : "FAIL", img_yuv_convert_get_isa());
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
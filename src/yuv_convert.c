@@ -0,0 +1,513 @@
+/*
+ *  Copyright (c) 2024 Giuseppe Torelli <colossus73@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License,or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not,write to the Free Software
+ *  Foundation,Inc.,59 Temple Place - Suite 330,Boston,MA 02111-1307,USA.
+ *
+ */
+
+/* Converts the composed cairo ARGB32 frames to the pixel format of the
+ * encoder. The frames are painted over the opaque background color so
+ * the alpha channel is always 255 and is ignored, and source and
+ * destination have the same size so no scaling is involved.
+ *
+ * All the arithmetic is done on 16 bits words, the SIMD kernels and the
+ * scalar code compute exactly the same values so the output doesn't
+ * depend on the CPU. Chroma is taken from the average of the 2x2 (4:2:0)
+ * or 2x1 (4:2:2) pixel blocks. */
+
+#include "yuv_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMG_YUV_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct _ImgYuvCoefficients
+{
+	gint16	y[3];					/* R, G, B weights, scaled by 1 << shift */
+	gint16	u[3];
+	gint16	v[3];
+	gint		shift;
+	guint16	y_offset;				/* Added to Y after the shift */
+} ImgYuvCoefficients;
+
+/* BT.601, limited and full range for 8 bits, limited range for 10 bits */
+static const ImgYuvCoefficients img_yuv_bt601 = { { 66, 129, 25 }, { -38, -74, 112 }, { 112, -94, -18 }, 8, 16 };
+static const ImgYuvCoefficients img_yuv_bt601_full = { { 77, 150, 29 }, { -43, -85, 128 }, { 128, -107, -21 }, 8, 0 };
+static const ImgYuvCoefficients img_yuv_bt601_10 = { { 66, 129, 25 }, { -38, -74, 112 }, { 112, -94, -18 }, 6, 64 };
+
+/* The chroma sums are made positive with 32768, which also
+ * centers them on 128 (8 bits) or 512 (10 bits) after the shift */
+#define IMG_YUV_Y_BIAS(c) (1 << ((c)->shift - 1))
+#define IMG_YUV_C_BIAS(c) (32768 + (1 << ((c)->shift - 1)) - 1)
+
+/* Each row function converts the pixels from x to width and returns */
+typedef gint (*ImgYuvLumaFunc)	(const guint32 *, void *, gint, gint, const ImgYuvCoefficients *);
+typedef gint (*ImgYuvChromaFunc)	(const guint32 *, const guint32 *, void *, void *, gint, gint, const ImgYuvCoefficients *);
+
+typedef struct _ImgYuvKernels
+{
+	const gchar			*isa;
+	ImgYuvLumaFunc		luma8;
+	ImgYuvChromaFunc	chroma420;
+	ImgYuvLumaFunc		luma16;
+	ImgYuvChromaFunc	chroma422_16;
+} ImgYuvKernels;
+
+#define R(p) (((p) >> 16) & 0xff)
+#define G(p) (((p) >> 8) & 0xff)
+#define B(p) ((p) & 0xff)
+
+static inline guint img_yuv_dot(gint r, gint g, gint b, const gint16 *k, guint bias, gint shift)
+{
+	return (guint) (k[0] * r + k[1] * g + k[2] * b + (gint) bias) >> shift;
+}
+
+static gint img_yuv_luma8_c(const guint32 *src, void *dst, gint x, gint width, const ImgYuvCoefficients *c)
+{
+	guint8 *y = dst;
+
+	for (; x < width; x++)
+		y[x] = img_yuv_dot(R(src[x]), G(src[x]), B(src[x]), c->y, IMG_YUV_Y_BIAS(c), c->shift) + c->y_offset;
+
+	return x;
+}
+
+static gint img_yuv_luma16_c(const guint32 *src, void *dst, gint x, gint width, const ImgYuvCoefficients *c)
+{
+	guint16 *y = dst;
+
+	for (; x < width; x++)
+		y[x] = img_yuv_dot(R(src[x]), G(src[x]), B(src[x]), c->y, IMG_YUV_Y_BIAS(c), c->shift) + c->y_offset;
+
+	return x;
+}
+
+static gint img_yuv_chroma420_c(const guint32 *src0, const guint32 *src1, void *u_dst, void *v_dst, gint x, gint width,
+												const ImgYuvCoefficients *c)
+{
+	guint8 *u = u_dst, *v = v_dst;
+	gint x1, r, g, b;
+
+	for (; x < width; x += 2)
+	{
+		x1 = MIN(x + 1, width - 1);
+		r = (R(src0[x]) + R(src0[x1]) + R(src1[x]) + R(src1[x1]) + 2) >> 2;
+		g = (G(src0[x]) + G(src0[x1]) + G(src1[x]) + G(src1[x1]) + 2) >> 2;
+		b = (B(src0[x]) + B(src0[x1]) + B(src1[x]) + B(src1[x1]) + 2) >> 2;
+		u[x / 2] = img_yuv_dot(r, g, b, c->u, IMG_YUV_C_BIAS(c), c->shift);
+		v[x / 2] = img_yuv_dot(r, g, b, c->v, IMG_YUV_C_BIAS(c), c->shift);
+	}
+	return x;
+}
+
+static gint img_yuv_chroma422_16_c(const guint32 *src, const guint32 *unused, void *u_dst, void *v_dst, gint x, gint width,
+												const ImgYuvCoefficients *c)
+{
+	guint16 *u = u_dst, *v = v_dst;
+	gint x1, r, g, b;
+
+	for (; x < width; x += 2)
+	{
+		x1 = MIN(x + 1, width - 1);
+		r = (R(src[x]) + R(src[x1]) + 1) >> 1;
+		g = (G(src[x]) + G(src[x1]) + 1) >> 1;
+		b = (B(src[x]) + B(src[x1]) + 1) >> 1;
+		u[x / 2] = img_yuv_dot(r, g, b, c->u, IMG_YUV_C_BIAS(c), c->shift);
+		v[x / 2] = img_yuv_dot(r, g, b, c->v, IMG_YUV_C_BIAS(c), c->shift);
+	}
+	return x;
+}
+
+static const ImgYuvKernels img_yuv_kernels_c = { "C", img_yuv_luma8_c, img_yuv_chroma420_c, img_yuv_luma16_c, img_yuv_chroma422_16_c };
+
+#ifdef IMG_YUV_X86
+
+/* SSE2, 8 pixels per register. The 16 bits sums wrap around but the
+ * final values are always within 0-65535, so the logical shift gives
+ * the same result as the scalar code */
+#define SSE2 __attribute__((target("sse2")))
+
+static inline SSE2 void img_yuv_split_sse2(const guint32 *src, __m128i *r, __m128i *g, __m128i *b)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i p0 = _mm_loadu_si128((const __m128i *) src);
+	__m128i p1 = _mm_loadu_si128((const __m128i *) (src + 4));
+
+	*b = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+	*g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask), _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+	*r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask), _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+}
+
+static inline SSE2 __m128i img_yuv_dot_sse2(__m128i r, __m128i g, __m128i b, const gint16 *k, guint bias, gint shift)
+{
+	__m128i sum;
+
+	sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(k[0])), _mm_mullo_epi16(g, _mm_set1_epi16(k[1])));
+	sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(k[2])));
+	sum = _mm_add_epi16(sum, _mm_set1_epi16((gint16) bias));
+
+	return _mm_srl_epi16(sum, _mm_cvtsi32_si128(shift));
+}
+
+static inline SSE2 __m128i img_yuv_luma_sse2(const guint32 *src, const ImgYuvCoefficients *c)
+{
+	__m128i r, g, b;
+
+	img_yuv_split_sse2(src, &r, &g, &b);
+	return _mm_add_epi16(img_yuv_dot_sse2(r, g, b, c->y, IMG_YUV_Y_BIAS(c), c->shift), _mm_set1_epi16(c->y_offset));
+}
+
+/* Sums the pixels two by two, 16 pixels give 8 sums */
+static inline SSE2 __m128i img_yuv_pairs_sse2(__m128i a, __m128i b)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+
+	return _mm_packs_epi32(_mm_madd_epi16(a, ones), _mm_madd_epi16(b, ones));
+}
+
+static SSE2 gint img_yuv_luma8_sse2(const guint32 *src, void *dst, gint x, gint width, const ImgYuvCoefficients *c)
+{
+	guint8 *y = dst;
+
+	for (; x + 16 <= width; x += 16)
+		_mm_storeu_si128((__m128i *) (y + x), _mm_packus_epi16(img_yuv_luma_sse2(src + x, c), img_yuv_luma_sse2(src + x + 8, c)));
+
+	return img_yuv_luma8_c(src, dst, x, width, c);
+}
+
+static SSE2 gint img_yuv_luma16_sse2(const guint32 *src, void *dst, gint x, gint width, const ImgYuvCoefficients *c)
+{
+	guint16 *y = dst;
+
+	for (; x + 8 <= width; x += 8)
+		_mm_storeu_si128((__m128i *) (y + x), img_yuv_luma_sse2(src + x, c));
+
+	return img_yuv_luma16_c(src, dst, x, width, c);
+}
+
+static SSE2 gint img_yuv_chroma420_sse2(const guint32 *src0, const guint32 *src1, void *u_dst, void *v_dst, gint x, gint width,
+												const ImgYuvCoefficients *c)
+{
+	guint8 *u = u_dst, *v = v_dst;
+	__m128i r0, g0, b0, r1, g1, b1, r2, g2, b2, r3, g3, b3, r, g, b;
+	const __m128i two = _mm_set1_epi16(2);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		img_yuv_split_sse2(src0 + x, &r0, &g0, &b0);
+		img_yuv_split_sse2(src1 + x, &r1, &g1, &b1);
+		img_yuv_split_sse2(src0 + x + 8, &r2, &g2, &b2);
+		img_yuv_split_sse2(src1 + x + 8, &r3, &g3, &b3);
+
+		r = img_yuv_pairs_sse2(_mm_add_epi16(r0, r1), _mm_add_epi16(r2, r3));
+		g = img_yuv_pairs_sse2(_mm_add_epi16(g0, g1), _mm_add_epi16(g2, g3));
+		b = img_yuv_pairs_sse2(_mm_add_epi16(b0, b1), _mm_add_epi16(b2, b3));
+		r = _mm_srli_epi16(_mm_add_epi16(r, two), 2);
+		g = _mm_srli_epi16(_mm_add_epi16(g, two), 2);
+		b = _mm_srli_epi16(_mm_add_epi16(b, two), 2);
+
+		r0 = img_yuv_dot_sse2(r, g, b, c->u, IMG_YUV_C_BIAS(c), c->shift);
+		r1 = img_yuv_dot_sse2(r, g, b, c->v, IMG_YUV_C_BIAS(c), c->shift);
+		_mm_storel_epi64((__m128i *) (u + x / 2), _mm_packus_epi16(r0, r0));
+		_mm_storel_epi64((__m128i *) (v + x / 2), _mm_packus_epi16(r1, r1));
+	}
+	return img_yuv_chroma420_c(src0, src1, u_dst, v_dst, x, width, c);
+}
+
+static SSE2 gint img_yuv_chroma422_16_sse2(const guint32 *src, const guint32 *unused, void *u_dst, void *v_dst, gint x, gint width,
+												const ImgYuvCoefficients *c)
+{
+	guint16 *u = u_dst, *v = v_dst;
+	__m128i r0, g0, b0, r1, g1, b1, r, g, b;
+	const __m128i one = _mm_set1_epi16(1);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		img_yuv_split_sse2(src + x, &r0, &g0, &b0);
+		img_yuv_split_sse2(src + x + 8, &r1, &g1, &b1);
+
+		r = _mm_srli_epi16(_mm_add_epi16(img_yuv_pairs_sse2(r0, r1), one), 1);
+		g = _mm_srli_epi16(_mm_add_epi16(img_yuv_pairs_sse2(g0, g1), one), 1);
+		b = _mm_srli_epi16(_mm_add_epi16(img_yuv_pairs_sse2(b0, b1), one), 1);
+
+		_mm_storeu_si128((__m128i *) (u + x / 2), img_yuv_dot_sse2(r, g, b, c->u, IMG_YUV_C_BIAS(c), c->shift));
+		_mm_storeu_si128((__m128i *) (v + x / 2), img_yuv_dot_sse2(r, g, b, c->v, IMG_YUV_C_BIAS(c), c->shift));
+	}
+	return img_yuv_chroma422_16_c(src, unused, u_dst, v_dst, x, width, c);
+}
+
+static const ImgYuvKernels img_yuv_kernels_sse2 = { "SSE2", img_yuv_luma8_sse2, img_yuv_chroma420_sse2, img_yuv_luma16_sse2, img_yuv_chroma422_16_sse2 };
+
+/* AVX2, the same with 16 pixels per register. The packs work inside each
+ * 128 bits lane so their result is put back in order with a permute */
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i img_yuv_order_avx2(__m256i a)
+{
+	return _mm256_permute4x64_epi64(a, 0xd8);
+}
+
+static inline AVX2 void img_yuv_split_avx2(const guint32 *src, __m256i *r, __m256i *g, __m256i *b)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	__m256i p0 = _mm256_loadu_si256((const __m256i *) src);
+	__m256i p1 = _mm256_loadu_si256((const __m256i *) (src + 8));
+
+	*b = img_yuv_order_avx2(_mm256_packs_epi32(_mm256_and_si256(p0, mask), _mm256_and_si256(p1, mask)));
+	*g = img_yuv_order_avx2(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 8), mask),
+															_mm256_and_si256(_mm256_srli_epi32(p1, 8), mask)));
+	*r = img_yuv_order_avx2(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 16), mask),
+															_mm256_and_si256(_mm256_srli_epi32(p1, 16), mask)));
+}
+
+static inline AVX2 __m256i img_yuv_dot_avx2(__m256i r, __m256i g, __m256i b, const gint16 *k, guint bias, gint shift)
+{
+	__m256i sum;
+
+	sum = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(k[0])), _mm256_mullo_epi16(g, _mm256_set1_epi16(k[1])));
+	sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(b, _mm256_set1_epi16(k[2])));
+	sum = _mm256_add_epi16(sum, _mm256_set1_epi16((gint16) bias));
+
+	return _mm256_srl_epi16(sum, _mm_cvtsi32_si128(shift));
+}
+
+static inline AVX2 __m256i img_yuv_luma_avx2(const guint32 *src, const ImgYuvCoefficients *c)
+{
+	__m256i r, g, b;
+
+	img_yuv_split_avx2(src, &r, &g, &b);
+	return _mm256_add_epi16(img_yuv_dot_avx2(r, g, b, c->y, IMG_YUV_Y_BIAS(c), c->shift), _mm256_set1_epi16(c->y_offset));
+}
+
+static inline AVX2 __m256i img_yuv_pairs_avx2(__m256i a, __m256i b)
+{
+	const __m256i ones = _mm256_set1_epi16(1);
+
+	return img_yuv_order_avx2(_mm256_packs_epi32(_mm256_madd_epi16(a, ones), _mm256_madd_epi16(b, ones)));
+}
+
+static AVX2 gint img_yuv_luma8_avx2(const guint32 *src, void *dst, gint x, gint width, const ImgYuvCoefficients *c)
+{
+	guint8 *y = dst;
+	__m256i y0, y1;
+
+	for (; x + 32 <= width; x += 32)
+	{
+		y0 = img_yuv_luma_avx2(src + x, c);
+		y1 = img_yuv_luma_avx2(src + x + 16, c);
+		_mm256_storeu_si256((__m256i *) (y + x), img_yuv_order_avx2(_mm256_packus_epi16(y0, y1)));
+	}
+	return img_yuv_luma8_sse2(src, dst, x, width, c);
+}
+
+static AVX2 gint img_yuv_luma16_avx2(const guint32 *src, void *dst, gint x, gint width, const ImgYuvCoefficients *c)
+{
+	guint16 *y = dst;
+
+	for (; x + 16 <= width; x += 16)
+		_mm256_storeu_si256((__m256i *) (y + x), img_yuv_luma_avx2(src + x, c));
+
+	return img_yuv_luma16_sse2(src, dst, x, width, c);
+}
+
+static AVX2 gint img_yuv_chroma420_avx2(const guint32 *src0, const guint32 *src1, void *u_dst, void *v_dst, gint x, gint width,
+												const ImgYuvCoefficients *c)
+{
+	guint8 *u = u_dst, *v = v_dst;
+	__m256i r0, g0, b0, r1, g1, b1, r2, g2, b2, r3, g3, b3, r, g, b;
+	const __m256i two = _mm256_set1_epi16(2);
+
+	for (; x + 32 <= width; x += 32)
+	{
+		img_yuv_split_avx2(src0 + x, &r0, &g0, &b0);
+		img_yuv_split_avx2(src1 + x, &r1, &g1, &b1);
+		img_yuv_split_avx2(src0 + x + 16, &r2, &g2, &b2);
+		img_yuv_split_avx2(src1 + x + 16, &r3, &g3, &b3);
+
+		r = img_yuv_pairs_avx2(_mm256_add_epi16(r0, r1), _mm256_add_epi16(r2, r3));
+		g = img_yuv_pairs_avx2(_mm256_add_epi16(g0, g1), _mm256_add_epi16(g2, g3));
+		b = img_yuv_pairs_avx2(_mm256_add_epi16(b0, b1), _mm256_add_epi16(b2, b3));
+		r = _mm256_srli_epi16(_mm256_add_epi16(r, two), 2);
+		g = _mm256_srli_epi16(_mm256_add_epi16(g, two), 2);
+		b = _mm256_srli_epi16(_mm256_add_epi16(b, two), 2);
+
+		r0 = img_yuv_dot_avx2(r, g, b, c->u, IMG_YUV_C_BIAS(c), c->shift);
+		r1 = img_yuv_dot_avx2(r, g, b, c->v, IMG_YUV_C_BIAS(c), c->shift);
+		_mm_storeu_si128((__m128i *) (u + x / 2), _mm256_castsi256_si128(img_yuv_order_avx2(_mm256_packus_epi16(r0, r0))));
+		_mm_storeu_si128((__m128i *) (v + x / 2), _mm256_castsi256_si128(img_yuv_order_avx2(_mm256_packus_epi16(r1, r1))));
+	}
+	return img_yuv_chroma420_sse2(src0, src1, u_dst, v_dst, x, width, c);
+}
+
+static AVX2 gint img_yuv_chroma422_16_avx2(const guint32 *src, const guint32 *unused, void *u_dst, void *v_dst, gint x, gint width,
+												const ImgYuvCoefficients *c)
+{
+	guint16 *u = u_dst, *v = v_dst;
+	__m256i r0, g0, b0, r1, g1, b1, r, g, b;
+	const __m256i one = _mm256_set1_epi16(1);
+
+	for (; x + 32 <= width; x += 32)
+	{
+		img_yuv_split_avx2(src + x, &r0, &g0, &b0);
+		img_yuv_split_avx2(src + x + 16, &r1, &g1, &b1);
+
+		r = _mm256_srli_epi16(_mm256_add_epi16(img_yuv_pairs_avx2(r0, r1), one), 1);
+		g = _mm256_srli_epi16(_mm256_add_epi16(img_yuv_pairs_avx2(g0, g1), one), 1);
+		b = _mm256_srli_epi16(_mm256_add_epi16(img_yuv_pairs_avx2(b0, b1), one), 1);
+
+		_mm256_storeu_si256((__m256i *) (u + x / 2), img_yuv_dot_avx2(r, g, b, c->u, IMG_YUV_C_BIAS(c), c->shift));
+		_mm256_storeu_si256((__m256i *) (v + x / 2), img_yuv_dot_avx2(r, g, b, c->v, IMG_YUV_C_BIAS(c), c->shift));
+	}
+	return img_yuv_chroma422_16_sse2(src, unused, u_dst, v_dst, x, width, c);
+}
+
+static const ImgYuvKernels img_yuv_kernels_avx2 = { "AVX2", img_yuv_luma8_avx2, img_yuv_chroma420_avx2, img_yuv_luma16_avx2, img_yuv_chroma422_16_avx2 };
+
+#endif
+
+/* Returns the kernels of the instruction set named isa,
+ * or NULL if they don't exist or the CPU can't run them */
+static const ImgYuvKernels *img_yuv_find_kernels(const gchar *isa)
+{
+	if (g_ascii_strcasecmp(isa, "C") == 0)
+		return &img_yuv_kernels_c;
+
+#ifdef IMG_YUV_X86
+	__builtin_cpu_init();
+	if (g_ascii_strcasecmp(isa, "SSE2") == 0 && __builtin_cpu_supports("sse2"))
+		return &img_yuv_kernels_sse2;
+	if (g_ascii_strcasecmp(isa, "AVX2") == 0 && __builtin_cpu_supports("avx2"))
+		return &img_yuv_kernels_avx2;
+#endif
+	return NULL;
+}
+
+/* Set by img_yuv_convert_set_isa() */
+static const ImgYuvKernels *img_yuv_forced_kernels = NULL;
+
+/* Picks the kernels for the CPU once. IMAGINATION_YUV_ISA=C
+ * or SSE2 forces the slower ones to compare their output */
+static const ImgYuvKernels *img_yuv_get_kernels(void)
+{
+	static gsize kernels = 0;
+	const ImgYuvKernels *forced = g_atomic_pointer_get(&img_yuv_forced_kernels);
+
+	if (forced)
+		return forced;
+
+	if (g_once_init_enter(&kernels))
+	{
+		const ImgYuvKernels *best = NULL;
+		const gchar *isa = g_getenv("IMAGINATION_YUV_ISA");
+
+		if (isa)
+			best = img_yuv_find_kernels(isa);
+		if (best == NULL)
+			best = img_yuv_find_kernels("AVX2");
+		if (best == NULL)
+			best = img_yuv_find_kernels("SSE2");
+		if (best == NULL)
+			best = &img_yuv_kernels_c;
+
+		g_once_init_leave(&kernels, (gsize) best);
+	}
+	return (const ImgYuvKernels *) kernels;
+}
+
+gboolean img_yuv_convert_supported(enum AVPixelFormat pix_fmt)
+{
+	switch (pix_fmt)
+	{
+		case AV_PIX_FMT_YUV420P:
+		case AV_PIX_FMT_YUVJ420P:
+		return TRUE;
+
+		case AV_PIX_FMT_YUV422P10LE:
+		return G_BYTE_ORDER == G_LITTLE_ENDIAN;
+
+		default:
+		return FALSE;
+	}
+}
+
+const gchar *img_yuv_convert_get_isa(void)
+{
+	return img_yuv_get_kernels()->isa;
+}
+
+/* Makes img_yuv_convert() use the kernels of isa ("C", "SSE2" or "AVX2")
+ * instead of the best ones, NULL goes back to those. Returns FALSE if the
+ * CPU can't run them. Meant for yuv_check, not while frames are converted */
+gboolean img_yuv_convert_set_isa(const gchar *isa)
+{
+	const ImgYuvKernels *kernels = NULL;
+
+	if (isa)
+	{
+		kernels = img_yuv_find_kernels(isa);
+		if (kernels == NULL)
+			return FALSE;
+	}
+	g_atomic_pointer_set(&img_yuv_forced_kernels, kernels);
+	return TRUE;
+}
+
+/* Converts the rows from first_row to last_row (excluded) of the ARGB32
+ * data to the frame, which must have the same size and a format accepted
+ * by img_yuv_convert_supported(). With 4:2:0 first_row must be even */
+void img_yuv_convert(const guint8 *data, gint stride, AVFrame *frame, gint first_row, gint last_row)
+{
+	const ImgYuvKernels *kernels = img_yuv_get_kernels();
+	const guint32 *src0, *src1;
+	gint width = frame->width;
+	gint height = frame->height;
+
+	last_row = MIN(last_row, height);
+	switch (frame->format)
+	{
+		case AV_PIX_FMT_YUV420P:
+		case AV_PIX_FMT_YUVJ420P:
+		{
+			const ImgYuvCoefficients *c = frame->format == AV_PIX_FMT_YUVJ420P ? &img_yuv_bt601_full : &img_yuv_bt601;
+
+			for (gint y = first_row; y < last_row; y++)
+			{
+				src0 = (const guint32 *) (data + y * stride);
+				kernels->luma8(src0, frame->data[0] + y * frame->linesize[0], 0, width, c);
+				if (y % 2)
+					continue;
+
+				src1 = (const guint32 *) (data + MIN(y + 1, height - 1) * stride);
+				kernels->chroma420(src0, src1, frame->data[1] + (y / 2) * frame->linesize[1],
+													frame->data[2] + (y / 2) * frame->linesize[2], 0, width, c);
+			}
+		}
+		break;
+
+		case AV_PIX_FMT_YUV422P10LE:
+		for (gint y = first_row; y < last_row; y++)
+		{
+			src0 = (const guint32 *) (data + y * stride);
+			kernels->luma16(src0, frame->data[0] + y * frame->linesize[0], 0, width, &img_yuv_bt601_10);
+			kernels->chroma422_16(src0, NULL, frame->data[1] + y * frame->linesize[1],
+												frame->data[2] + y * frame->linesize[2], 0, width, &img_yuv_bt601_10);
+		}
+		break;
+
+		default:
+		break;
+	}
+}